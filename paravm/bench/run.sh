@@ -0,0 +1,44 @@
+#!/bin/sh
+
+# Runs the interpreter benchmarks. Each kernel is assembled,
+# run in the emulator, and checked against the result given
+# in its source; the best wall clock time of all runs is then
+# reported in milliseconds.
+#
+# Usage: run.sh [PARAVM [RUNS]]
+
+set -e
+
+paravm="${1:-paravm}"
+runs="${2:-5}"
+dir=`dirname ${0}`
+tmp=`mktemp -d`
+
+trap 'rm -rf "${tmp}"' EXIT
+
+for src in "${dir}"/*.pva; do
+    name=`basename ${src} .pva`
+    exp=`sed -n 's/^; Result: //p' ${src}`
+
+    "${paravm}" asm ${src} --out "${tmp}/${name}.pvc"
+
+    best=
+
+    for i in `seq ${runs}`; do
+        start=`date +%s%N`
+        res=`"${paravm}" exe "${tmp}/${name}.pvc" --emu`
+        end=`date +%s%N`
+        ms=$(((end - start) / 1000000))
+
+        if [ "${res}" != "${exp}" ]; then
+            echo "${name}: expected '${exp}', got '${res}'" >&2
+            exit 1
+        fi
+
+        if [ -z "${best}" ] || [ ${ms} -lt ${best} ]; then
+            best=${ms}
+        fi
+    done
+
+    printf '%-10s %6d ms\n' ${name} ${best}
+done
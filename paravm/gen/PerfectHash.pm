@@ -0,0 +1,146 @@
+package PerfectHash;
+
+# Builds perfect hash tables for fixed sets of strings. The
+# lookup side lives in `include/internal/hash.h`; the two must
+# agree on the hash function and the slot computation.
+
+use strict;
+use warnings;
+
+use Exporter qw(import);
+
+our @EXPORT_OK = qw(fnv1a build_table format_array);
+
+sub fnv1a
+{
+    my ($str) = @_;
+    my $hash = 2166136261;
+
+    for my $byte (unpack('C*', $str))
+    {
+        $hash ^= $byte;
+        $hash = ($hash * 16777619) & 0xffffffff;
+    }
+
+    return $hash;
+}
+
+sub slot_of
+{
+    my ($hash, $disp, $bits) = @_;
+
+    return 0 if !$bits;
+
+    # Multiply in two halves so the product never exceeds what
+    # a double can represent exactly.
+    my $x = ($hash ^ $disp) & 0xffffffff;
+    my $lo = ($x & 0xffff) * 2654435761;
+    my $hi = (($x >> 16) * 2654435761) & 0xffff;
+    my $mixed = ($lo + ($hi << 16)) & 0xffffffff;
+
+    return $mixed >> (32 - $bits);
+}
+
+sub log2_ceil
+{
+    my ($n) = @_;
+    my $bits = 0;
+
+    $bits++ while (1 << $bits) < $n;
+
+    return $bits;
+}
+
+# Takes a list of distinct strings. Returns a hash with `bits`
+# (log2 of the slot count), `disps` (one displacement per
+# bucket), and `slots` (the index of the string stored in each
+# slot, or -1 for empty slots).
+sub build_table
+{
+    my @keys = @_;
+    my %seen;
+
+    for my $key (@keys)
+    {
+        die "Duplicate key '$key'\n" if $seen{$key}++;
+    }
+
+    my @hashes = map { fnv1a($_) } @keys;
+    my $bucket_bits = log2_ceil(int(@keys / 2) || 1);
+    my $bits = log2_ceil(int(@keys * 5 / 4) || 1);
+
+    while (1)
+    {
+        my $nbuckets = 1 << $bucket_bits;
+        my @buckets = map { [] } 1 .. $nbuckets;
+
+        push @{$buckets[$hashes[$_] & ($nbuckets - 1)]}, $_ for 0 .. $#keys;
+
+        my @disps = (0) x $nbuckets;
+        my @slots = (-1) x (1 << $bits);
+        my $ok = 1;
+
+        # Place the largest buckets first, while the table is
+        # still mostly empty.
+        for my $b (sort { @{$buckets[$b]} <=> @{$buckets[$a]} || $a <=> $b } 0 .. $nbuckets - 1)
+        {
+            my @members = @{$buckets[$b]};
+
+            next if !@members;
+
+            my $placed = 0;
+
+            for my $disp (0 .. 65535)
+            {
+                my %taken;
+                my $fits = 1;
+
+                for my $k (@members)
+                {
+                    my $s = slot_of($hashes[$k], $disp, $bits);
+
+                    if ($slots[$s] != -1 || $taken{$s}++)
+                    {
+                        $fits = 0;
+                        last;
+                    }
+                }
+
+                next if !$fits;
+
+                $slots[slot_of($hashes[$_], $disp, $bits)] = $_ for @members;
+                $disps[$b] = $disp;
+                $placed = 1;
+
+                last;
+            }
+
+            if (!$placed)
+            {
+                $ok = 0;
+                last;
+            }
+        }
+
+        return { bits => $bits, disps => \@disps, slots => \@slots } if $ok;
+
+        $bits++;
+    }
+}
+
+# Formats a list of C expressions as the body of an array
+# initializer.
+sub format_array
+{
+    my @items = @_;
+    my @lines;
+
+    while (my @row = splice(@items, 0, 8))
+    {
+        push @lines, '    ' . join(', ', @row) . ',';
+    }
+
+    return join("\n", @lines);
+}
+
+1;
@@ -0,0 +1,92 @@
+#!/usr/bin/env perl
+
+# Generates the reserved atom headers from `atoms.def`.
+#
+# Usage: atoms.pl public|internal atoms.def > header.h
+
+use strict;
+use warnings;
+
+use PerfectHash qw(fnv1a build_table format_array);
+
+my ($mode, $def) = @ARGV;
+
+die "Usage: $0 public|internal <def>\n" if !$def || ($mode ne 'public' && $mode ne 'internal');
+
+open(my $fh, '<', $def) or die "Could not open '$def': $!\n";
+
+my @atoms;
+
+while (my $line = <$fh>)
+{
+    $line =~ s/#.*//;
+
+    next if $line !~ /\S/;
+
+    my ($name, $const) = split(' ', $line);
+
+    die "$def:$.: Malformed line\n" if !defined($const) || $name !~ /^[a-z_]+$/ || $const !~ /^[A-Z_]+$/;
+
+    push @atoms, { name => $name, const => $const };
+}
+
+close($fh);
+
+# Slots are stored as bytes below.
+die "$def: Too many atoms\n" if @atoms > 254;
+
+print "/* Generated from atoms.def by atoms.pl. Do not edit. */\n\n";
+print "#pragma once\n\n";
+
+if ($mode eq 'public')
+{
+    print "#include \"common.h\"\n\n";
+    print "paravm_begin\n\n";
+    print "typedef enum ParaVMReservedAtom ParaVMReservedAtom;\n\n";
+    print "/* Atoms that exist in every atom table with fixed IDs.\n";
+    print " * Dynamically created atoms are allocated from\n";
+    print " * `PARAVM_ATOM_RESERVED_COUNT` upwards.\n";
+    print " */\n";
+    print "enum ParaVMReservedAtom\n{\n";
+
+    for my $i (0 .. $#atoms)
+    {
+        print "    PARAVM_ATOM_$atoms[$i]{const} = $i, // The `'$atoms[$i]{name}'` atom.\n";
+    }
+
+    print "    PARAVM_ATOM_RESERVED_COUNT = " . scalar(@atoms) . ", // The number of reserved atoms.\n";
+    print "};\n\n";
+    print "paravm_end\n";
+
+    exit;
+}
+
+my $table = build_table(map { $_->{name} } @atoms);
+my @slots = @{$table->{slots}};
+my @disps = @{$table->{disps}};
+
+print "#include \"internal/hash.h\"\n\n";
+print "#define RESERVED_HASH_BITS $table->{bits}\n";
+print "#define RESERVED_DISPS_MASK " . (@disps - 1) . "\n\n";
+
+print "static const char *const reserved_names[] =\n{\n";
+print format_array(map { "\"$_->{name}\"" } @atoms), "\n";
+print "};\n\n";
+
+print "static const uint32_t reserved_disps[] =\n{\n";
+print format_array(map { "${_}u" } @disps), "\n";
+print "};\n\n";
+
+# Slots hold the atom plus one so that zero means empty.
+print "static const uint8_t reserved_slots[] =\n{\n";
+print format_array(map { $_ + 1 } @slots), "\n";
+print "};\n\n";
+
+print "// Looks up `str` among the reserved atoms given its hash.\n";
+print "static inline size_t find_reserved_atom(const char *str, uint32_t hash)\n{\n";
+print "    uint32_t slot = perfect_hash_slot(hash, reserved_disps, RESERVED_DISPS_MASK, RESERVED_HASH_BITS);\n";
+print "    uint8_t atom = reserved_slots[slot];\n\n";
+print "    if (!atom || strcmp(reserved_names[atom - 1], str))\n";
+print "        return SIZE_MAX;\n\n";
+print "    return atom - 1u;\n";
+print "}\n";
@@ -0,0 +1,177 @@
+#!/usr/bin/env perl
+
+# Generates the opcode headers from `opcodes.def`.
+#
+# Usage: opcodes.pl public|internal opcodes.def > header.h
+
+use strict;
+use warnings;
+
+use PerfectHash qw(build_table format_array);
+
+my ($mode, $def) = @ARGV;
+
+die "Usage: $0 public|internal <def>\n" if !$def || ($mode ne 'public' && $mode ne 'internal');
+
+my %flag_names = (
+    S => 'PARAVM_OPCODE_FLAG_SIDE_EFFECTS',
+    T => 'PARAVM_OPCODE_FLAG_THROWS',
+    A => 'PARAVM_OPCODE_FLAG_ALLOCATES',
+    F => 'PARAVM_OPCODE_FLAG_FUSED',
+);
+
+sub parse_positions
+{
+    my ($def, $field, $regs) = @_;
+    my $mask = 0;
+
+    return 0 if $field eq '-';
+
+    for my $pos (split(/,/, $field))
+    {
+        die "$def:$.: Bad register position '$pos'\n" if $pos !~ /^\d+$/ || $pos >= $regs;
+
+        $mask |= 1 << $pos;
+    }
+
+    return $mask;
+}
+
+open(my $fh, '<', $def) or die "Could not open '$def': $!\n";
+
+my (@opcodes, %codes, %names);
+
+while (my $line = <$fh>)
+{
+    $line =~ s/#.*//;
+
+    next if $line !~ /\S/;
+
+    my @fields = split(' ', $line);
+
+    die "$def:$.: Malformed line\n" if @fields != 9;
+
+    my ($code, $name, $regs, $oper, $flow, $defs, $uses, $flags, $cost) = @fields;
+
+    die "$def:$.: Bad code '$code'\n" if $code !~ /^\d+$/ || $code > 255;
+    die "$def:$.: Bad name '$name'\n" if $name !~ /^[a-z]+(\.[a-z]+){0,2}$/;
+    die "$def:$.: Bad register count '$regs'\n" if $regs !~ /^(\d)(\+?)$/ || $1 > 8;
+
+    my $count = $1;
+    my $variable = $2 ? 'true' : 'false';
+
+    die "$def:$.: Bad flags '$flags'\n" if $flags !~ /^(-|[STAF]+)$/;
+    die "$def:$.: Bad cost '$cost'\n" if $cost !~ /^\d+$/ || !$cost || $cost > 255;
+    die "$def:$.: Duplicate code $code\n" if $codes{$code}++;
+    die "$def:$.: Duplicate name '$name'\n" if $names{$name}++;
+
+    my @flag_list = $flags eq '-' ? () : map { $flag_names{$_} } split(//, $flags);
+
+    (my $ident = $name) =~ tr/./_/;
+
+    push @opcodes, {
+        code => $code,
+        name => $name,
+        ident => $ident,
+        regs => $count,
+        variable => $variable,
+        operand => "PARAVM_OPERAND_TYPE_$oper",
+        flow => "PARAVM_CONTROL_FLOW_$flow",
+        defs => parse_positions($def, $defs, $count),
+        uses => parse_positions($def, $uses, $count),
+        flags => @flag_list ? join(' | ', @flag_list) : 'PARAVM_OPCODE_FLAG_NONE',
+        cost => $cost,
+    };
+}
+
+close($fh);
+
+die "$def: No opcodes\n" if !@opcodes;
+
+@opcodes = sort { $a->{code} <=> $b->{code} } @opcodes;
+
+print "/* Generated from opcodes.def by opcodes.pl. Do not edit. */\n\n";
+print "#pragma once\n\n";
+
+if ($mode eq 'public')
+{
+    print "#include \"common.h\"\n\n";
+    print "paravm_begin\n\n";
+    print "typedef struct ParaVMOpCode ParaVMOpCode;\n\n";
+    print "typedef enum ParaVMCode ParaVMCode;\n\n";
+    print "/* The byte codes of all opcodes. These are part of the\n";
+    print " * module file format and never change.\n";
+    print " */\n";
+    print "enum ParaVMCode\n{\n";
+
+    for my $op (@opcodes)
+    {
+        print "    PARAVM_CODE_\U$op->{ident}\E = $op->{code}, // The `$op->{name}` opcode.\n";
+    }
+
+    print "};\n\n";
+
+    for my $op (@opcodes)
+    {
+        print "extern const ParaVMOpCode paravm_op_$op->{ident}; // The `$op->{name}` opcode.\n";
+    }
+
+    print "\nparavm_end\n";
+
+    exit;
+}
+
+my $table = build_table(map { $_->{name} } @opcodes);
+my @slots = @{$table->{slots}};
+my @disps = @{$table->{disps}};
+
+print "#include \"internal/hash.h\"\n\n";
+print "#include \"opcodes.h\"\n\n";
+print "#define OPCODE_HASH_BITS $table->{bits}\n";
+print "#define OPCODE_DISPS_MASK " . (@disps - 1) . "\n\n";
+
+for my $op (@opcodes)
+{
+    print "const ParaVMOpCode paravm_op_$op->{ident} =\n{\n";
+    print "    .name = \"$op->{name}\",\n";
+    print "    .code = PARAVM_CODE_\U$op->{ident}\E,\n";
+    print "    .registers = $op->{regs},\n";
+    print "    .variable_registers = $op->{variable},\n";
+    print "    .operand = $op->{operand},\n";
+    print "    .control_flow = $op->{flow},\n";
+    printf "    .defs = 0x%02x,\n", $op->{defs};
+    printf "    .uses = 0x%02x,\n", $op->{uses};
+    print "    .flags = $op->{flags},\n";
+    print "    .cost = $op->{cost},\n";
+    print "};\n\n";
+}
+
+print "static const ParaVMOpCode *const opcode_list[] =\n{\n";
+print "    &paravm_op_$_->{ident},\n" for @opcodes;
+print "    null,\n";
+print "};\n\n";
+
+print "static const ParaVMOpCode *const opcode_codes[256] =\n{\n";
+print "    [PARAVM_CODE_\U$_->{ident}\E] = &paravm_op_$_->{ident},\n" for @opcodes;
+print "};\n\n";
+
+print "static const uint32_t opcode_disps[] =\n{\n";
+print format_array(map { "${_}u" } @disps), "\n";
+print "};\n\n";
+
+# Slots hold the index into `opcode_list` plus one so that
+# zero means empty.
+print "static const uint16_t opcode_slots[] =\n{\n";
+print format_array(map { $_ + 1 } @slots), "\n";
+print "};\n\n";
+
+print "// Looks up the opcode named `name` in the perfect hash table.\n";
+print "static inline const ParaVMOpCode *find_opcode(const char *name)\n{\n";
+print "    size_t length;\n";
+print "    uint32_t hash = hash_string(name, &length);\n";
+print "    uint32_t slot = perfect_hash_slot(hash, opcode_disps, OPCODE_DISPS_MASK, OPCODE_HASH_BITS);\n";
+print "    uint16_t idx = opcode_slots[slot];\n\n";
+print "    if (!idx || strcmp(opcode_list[idx - 1]->name, name))\n";
+print "        return null;\n\n";
+print "    return opcode_list[idx - 1];\n";
+print "}\n";
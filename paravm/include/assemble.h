@@ -26,4 +26,149 @@ paravm_nonnull()
 ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod,
                                    uint32_t *line, uint32_t *column);
 
+/* Assembles a module from the `count` token slices in
+ * `slices`, as produced by `paravm_lex_slices` for `str`.
+ * Token values are only copied out of `str` as they are
+ * needed. Otherwise, this function behaves exactly like
+ * `paravm_assemble_tokens`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull(1, 4, 5, 6)
+ParaVMError paravm_assemble_slices(const char *str, const ParaVMTokenSlice *slices, size_t count,
+                                   const ParaVMModule *mod, uint32_t *line, uint32_t *column);
+
+/* Assembles a module from the `count` token slices in
+ * `slices` like `paravm_assemble_slices`, but splits them
+ * at `.fun` directives and assembles the functions on up
+ * to `threads` threads. If `threads` is `0`, one thread
+ * per processor is used.
+ *
+ * Functions are added to `mod` in source order, and the
+ * error (and its location) that is returned is always the
+ * one that `paravm_assemble_slices` would return.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull(1, 4, 6, 7)
+ParaVMError paravm_assemble_slices_parallel(const char *str, const ParaVMTokenSlice *slices, size_t count,
+                                            const ParaVMModule *mod, uint32_t threads,
+                                            uint32_t *line, uint32_t *column);
+
+/* Assembles a module from the tokens produced by `lexer`,
+ * consuming them as they are lexed. Functions are finished
+ * one at a time, so for a lexer reading from a file, memory
+ * use is bounded by the largest function rather than the
+ * size of the file (not counting the module itself).
+ *
+ * In addition to the errors returned by
+ * `paravm_assemble_tokens`, any error returned by
+ * `paravm_lex_token` is passed on, with `*line` and
+ * `*column` set accordingly. Since tokens are consumed as
+ * they are lexed, an error earlier in the source is reported
+ * even if the lexer would have failed further on.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_assemble_stream(ParaVMLexer *lexer, const ParaVMModule *mod,
+                                   uint32_t *line, uint32_t *column);
+
+/* Translates the tokens produced by `lexer` straight into
+ * the binary PVC format, without building a module. Names
+ * are only resolved within each function, so memory use is
+ * bounded by the size of the output plus the largest
+ * function.
+ *
+ * On success, `*data` points to `*size` bytes which are
+ * exactly what `paravm_write_module` would write for the
+ * module that `paravm_assemble_stream` would produce, and
+ * should be freed with `free`. Errors and their locations
+ * are also the same as for `paravm_assemble_stream`, in
+ * which case `*data` is set to `NULL`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_translate_stream(ParaVMLexer *lexer, void **data, size_t *size,
+                                    uint32_t *line, uint32_t *column);
+
+typedef struct ParaVMAssemblyCache ParaVMAssemblyCache;
+
+/* Holds the encoded functions of previously translated
+ * sections of PVA source code for reuse by
+ * `paravm_translate_incremental`. A section starts at a line
+ * whose first token is `.fun`, and is identified by a
+ * SHA-256 fingerprint of its text.
+ */
+struct ParaVMAssemblyCache
+{
+    void *sections; // Private. Do not use.
+    size_t hits; // The number of sections reused by the last translation.
+    size_t misses; // The number of sections translated by the last translation.
+};
+
+/* Creates a new, empty `ParaVMAssemblyCache`.
+ *
+ * Returns a `ParaVMAssemblyCache` instance.
+ */
+paravm_api
+paravm_nothrow
+ParaVMAssemblyCache *paravm_create_assembly_cache(void);
+
+/* Destroys `cache` if it is not `NULL`.
+ */
+paravm_api
+paravm_nothrow
+void paravm_destroy_assembly_cache(ParaVMAssemblyCache *cache);
+
+/* Loads the sections saved to `path` by
+ * `paravm_save_assembly_cache` into `cache`.
+ *
+ * This function can return the I/O errors listed for
+ * `paravm_read_module`. Additionally, `PARAVM_ERROR_FOURCC`
+ * is returned if the file is not an assembly cache,
+ * `PARAVM_ERROR_VERSION` if it was written for a different
+ * module version, and `PARAVM_ERROR_MALFORMED` if it is
+ * corrupt. In all of these cases, `cache` is left unchanged,
+ * and it is safe to carry on with it.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_load_assembly_cache(ParaVMAssemblyCache *cache, const char *path);
+
+/* Saves the sections in `cache` to `path`. The file is
+ * always overwritten if it exists.
+ *
+ * This function can return the errors listed for
+ * `paravm_write_module`.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_save_assembly_cache(const ParaVMAssemblyCache *cache, const char *path);
+
+/* Translates `str` into the binary PVC format like
+ * `paravm_translate_stream`, but only lexes and translates
+ * the sections of `str` that are not in `cache`. Sections
+ * that are translated are added to `cache`, and when the
+ * function succeeds, sections that are no longer part of
+ * `str` are evicted from it.
+ *
+ * The output, errors, and error locations are exactly those
+ * of `paravm_translate_stream`. If any section fails, the
+ * whole string is translated again to find the error.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_translate_incremental(const char *str, ParaVMAssemblyCache *cache,
+                                         void **data, size_t *size,
+                                         uint32_t *line, uint32_t *column);
+
 paravm_end
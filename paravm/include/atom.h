@@ -1,6 +1,8 @@
 #pragma once
 
 #include "common.h"
+#include "error.h"
+#include "reserved.h"
 
 paravm_begin
 
@@ -9,14 +11,77 @@ typedef struct ParaVMAtomTable ParaVMAtomTable;
 /* Represents an atom table that maps strings to atoms
  * and atoms to strings. Supports recycling of erased
  * atom IDs.
+ *
+ * Strings are stored back to back in an arena, atom IDs
+ * index directly into a dense vector of those strings,
+ * and string lookups go through an open-addressing hash
+ * index.
+ *
+ * Every table contains the reserved atoms described by
+ * `ParaVMReservedAtom`. These always have the same IDs and
+ * are resolved through a static perfect hash table, so
+ * code can refer to them by constant.
+ *
+ * Lookups through `paravm_string_to_atom` are served by
+ * a small cache local to the calling thread whenever
+ * possible, so repeated lookups of the same strings do
+ * not touch the shared table.
+ *
+ * Dynamic atoms can be garbage collected. Each atom has a
+ * reference count, and the table keeps track of whether
+ * each atom has been looked up since the last sweep. A
+ * sweep (see `paravm_sweep_atoms`) reclaims atoms that are
+ * neither referenced nor recently used, and arena memory
+ * is returned once all strings in a chunk are gone.
+ *
+ * A table can be saved to a snapshot file and later start
+ * out from it (see `paravm_load_atom_snapshot`). Snapshot
+ * atoms keep their IDs, are served straight from the
+ * mapped file without locking, and are never reclaimed;
+ * atoms created afterwards are numbered after them.
  */
 struct ParaVMAtomTable
 {
-    void *str_to_atom; // Private. Do not use.
-    void *atom_to_str; // Private. Do not use.
     void *rw_lock; // Private. Do not use.
-    uint64_t next_id; // Private. Do not use.
-    void *reuse_queue; // Private. Do not use.
+    void *arena; // Private. Do not use.
+    void *strings; // Private. Do not use.
+    void *index; // Private. Do not use.
+    void *free_ids; // Private. Do not use.
+    void *infos; // Private. Do not use.
+    void *sweeper; // Private. Do not use.
+    void *base; // Private. Do not use.
+    size_t first_dynamic; // Private. Do not use.
+    uint64_t serial; // Private. Do not use.
+    uint64_t generation; // Private. Do not use.
+    uint64_t cache_hits; // Private. Do not use.
+    uint64_t cache_misses; // Private. Do not use.
+    uint64_t sweeps; // Private. Do not use.
+    uint64_t reclaimed; // Private. Do not use.
+    uint32_t epoch; // Private. Do not use.
+};
+
+typedef struct ParaVMAtomCacheStats ParaVMAtomCacheStats;
+
+/* Describes how well the thread-local lookup caches in
+ * front of an atom table are performing.
+ */
+struct ParaVMAtomCacheStats
+{
+    uint64_t hits; // Lookups served by a thread-local cache.
+    uint64_t misses; // Lookups that had to consult the shared table.
+};
+
+typedef struct ParaVMAtomTableStats ParaVMAtomTableStats;
+
+/* Describes the size of an atom table and the work done
+ * by its garbage collector.
+ */
+struct ParaVMAtomTableStats
+{
+    uint64_t atoms; // Live atoms, including the reserved ones.
+    uint64_t arena_bytes; // Memory held by the string arena.
+    uint64_t sweeps; // Sweeps performed so far.
+    uint64_t reclaimed; // Atoms reclaimed by sweeps so far.
 };
 
 /* Creates an atom table.
@@ -27,7 +92,8 @@ paravm_api
 paravm_nothrow
 ParaVMAtomTable *paravm_create_atom_table(void);
 
-/* Destroys `table` if it is not `NULL`.
+/* Destroys `table` if it is not `NULL`. Stops the
+ * background sweeper if one is running.
  */
 paravm_api
 paravm_nothrow
@@ -44,6 +110,42 @@ paravm_nothrow
 paravm_nonnull()
 size_t paravm_string_to_atom(ParaVMAtomTable *table, const char *str);
 
+/* Gets the atoms associated with the `count` strings in
+ * `strs` in `table` and stores them in the corresponding
+ * elements of `atoms`. Strings that have no entry in
+ * `table` are added, as with `paravm_string_to_atom`.
+ *
+ * This is considerably cheaper than calling
+ * `paravm_string_to_atom` for each string when many of
+ * them are new, since the table is only locked for
+ * writing once.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_strings_to_atoms(ParaVMAtomTable *table, const char *const *strs, size_t count, size_t *atoms);
+
+/* Like `paravm_string_to_atom`, but also adds a reference
+ * to the resulting atom, as with `paravm_retain_atom`.
+ *
+ * Unlike calling the two functions in turn, the atom is
+ * retained while the table is still locked, so a
+ * concurrent `paravm_sweep_atoms` cannot reclaim it in
+ * between.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+size_t paravm_string_to_retained_atom(ParaVMAtomTable *table, const char *str);
+
+/* Like `paravm_strings_to_atoms`, but also retains each
+ * resulting atom, as with `paravm_string_to_retained_atom`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_strings_to_retained_atoms(ParaVMAtomTable *table, const char *const *strs, size_t count, size_t *atoms);
+
 /* Gets the string associated with `atom` in `table`.
  *
  * Returns the string associated with `atom`, or `NULL`
@@ -60,20 +162,133 @@ const char *paravm_atom_to_string(const ParaVMAtomTable *table, size_t atom);
 /* Erases `atom` from `table`. Be careful with this
  * operation as erasing atoms that are in use can
  * result in unpredictable behavior. If `atom` does
- * not exist in the table, no action is taken.
+ * not exist in the table or is a reserved or snapshot
+ * atom, no action is taken.
+ *
+ * The ID of an erased atom is reused. The memory
+ * holding its string is reclaimed once all other
+ * strings in the same arena chunk are gone as well.
  */
 paravm_api
 paravm_nothrow
 paravm_nonnull()
 void paravm_erase_atom(const ParaVMAtomTable *table, size_t atom);
 
-/* Clears `table` of all atoms. Be careful with this
- * operation as erasing atoms that are in use can
- * result in unpredictable behavior.
+/* Clears `table` of all atoms except the reserved ones
+ * and the ones loaded from a snapshot.
+ * Be careful with this operation as erasing atoms that
+ * are in use can result in unpredictable behavior.
  */
 paravm_api
 paravm_nothrow
 paravm_nonnull()
 void paravm_clear_atoms(ParaVMAtomTable *table);
 
+/* Adds a reference to `atom` in `table`, which protects
+ * it from being reclaimed by `paravm_sweep_atoms`. If
+ * `atom` does not exist in the table or is a reserved or
+ * snapshot atom, no action is taken.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_retain_atom(ParaVMAtomTable *table, size_t atom);
+
+/* Removes a reference to `atom` in `table` that was added
+ * with `paravm_retain_atom`. If `atom` does not exist in
+ * the table or is a reserved or snapshot atom, no action
+ * is taken.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_release_atom(ParaVMAtomTable *table, size_t atom);
+
+/* Reclaims all dynamic atoms in `table` that have no
+ * references and that have not been looked up since the
+ * previous sweep. Reclaimed atoms behave as if they had
+ * been erased with `paravm_erase_atom`.
+ *
+ * Returns the number of reclaimed atoms.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+size_t paravm_sweep_atoms(ParaVMAtomTable *table);
+
+/* Starts a background thread that calls `paravm_sweep_atoms`
+ * on `table` every `interval` milliseconds.
+ *
+ * Returns `PARAVM_ERROR_ALREADY_SET` if a sweeper is
+ * already running for `table`. Otherwise, `PARAVM_ERROR_OK`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_start_atom_sweeper(ParaVMAtomTable *table, uint32_t interval);
+
+/* Stops the background sweeper for `table` and waits for
+ * it to exit. If no sweeper is running, no action is taken.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_stop_atom_sweeper(ParaVMAtomTable *table);
+
+/* Saves all atoms in `table` to the snapshot file at `path`,
+ * overwriting it if it exists. The atoms are saved with
+ * their current IDs. Reserved atoms are not saved since
+ * they are the same in every table.
+ *
+ * The file is replaced in one step, so tables that loaded
+ * the previous snapshot at `path` (including `table`) can
+ * keep using it.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ * Otherwise, an I/O-related error code is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_save_atom_snapshot(const ParaVMAtomTable *table, const char *path);
+
+/* Maps the snapshot file at `path` into memory and makes
+ * its atoms the read-only base of `table`. Every atom in
+ * the snapshot gets the ID it had when it was saved. This
+ * must be done before `table` is used by other threads.
+ *
+ * Returns `PARAVM_ERROR_ALREADY_SET` if `table` already has
+ * a snapshot or contains dynamic atoms. Returns
+ * `PARAVM_ERROR_FOURCC` if the file is not a snapshot,
+ * `PARAVM_ERROR_VERSION` if it was saved by an incompatible
+ * version of ParaVM, and `PARAVM_ERROR_MALFORMED` or
+ * `PARAVM_ERROR_EOF` if it is damaged. Otherwise, an
+ * I/O-related error code or `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_load_atom_snapshot(ParaVMAtomTable *table, const char *path);
+
+/* Gets the number of `paravm_string_to_atom` calls on
+ * `table` that were served by thread-local caches and
+ * the number that had to consult the shared table. The
+ * counts are published in batches by each thread, and
+ * when a thread moves on to another table or exits, so
+ * those of other running threads lag slightly behind the
+ * true values.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_get_atom_cache_stats(const ParaVMAtomTable *table, ParaVMAtomCacheStats *stats);
+
+/* Gets the number of atoms in `table`, the memory held
+ * by its strings, and garbage collection statistics.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_get_atom_table_stats(const ParaVMAtomTable *table, ParaVMAtomTableStats *stats);
+
 paravm_end
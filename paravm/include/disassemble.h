@@ -29,4 +29,45 @@ paravm_nothrow
 paravm_nonnull()
 ParaVMError paravm_disassemble_module(const ParaVMModule *mod, const char *path);
 
+/* Writes `mod` to the file descriptor `fd` in the textual
+ * PVA format. Output is buffered and written in large
+ * chunks, so this is also suitable for standard output.
+ * `fd` is not closed.
+ *
+ * This function can return the same errors as
+ * `paravm_disassemble_module`.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_disassemble_module_fd(const ParaVMModule *mod, int fd);
+
+/* Writes `mod` to the file descriptor `fd` like
+ * `paravm_disassemble_module_fd`, but renders its functions
+ * on up to `threads` threads. If `threads` is `0`, one
+ * thread per processor is used. The functions are written
+ * in module order, so the output is the same as that of
+ * `paravm_disassemble_module_fd`.
+ *
+ * This function can return the same errors as
+ * `paravm_disassemble_module`.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_disassemble_module_parallel(const ParaVMModule *mod, int fd, uint32_t threads);
+
+/* Returns `mod` in the textual PVA format as a string that
+ * must be freed with `free`. If `length` is not `null`, the
+ * length of the string is stored in it.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull(1)
+char *paravm_disassemble_module_string(const ParaVMModule *mod, size_t *length);
+
 paravm_end
@@ -32,6 +32,7 @@ enum ParaVMError
     PARAVM_ERROR_NONEXISTENT_NAME = 19, // A name was not mapped to a value.
     PARAVM_ERROR_ALREADY_SET = 20, // A property was already set.
     PARAVM_ERROR_FOURCC = 21, // An invalid 4-character code value was encountered.
+    PARAVM_ERROR_MALFORMED = 22, // The contents of a file were malformed.
 };
 
 /* Gets a static string describing `err`. Returns a `NULL`
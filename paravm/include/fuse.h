@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ir.h"
+
+paravm_begin
+
+/* The largest number of instructions a superinstruction
+ * can expand to.
+ */
+#define PARAVM_MAX_EXPANSION 2
+
+/* Rewrites `mod` so that common sequences of instructions
+ * within a block are replaced by superinstructions (those
+ * with `PARAVM_OPCODE_FLAG_FUSED` set). These perform the
+ * exact same work as the sequences they replace, but need
+ * fewer dispatches when executed.
+ *
+ * The replaced instructions are destroyed, so pointers to
+ * them must not be retained across this call. The module
+ * should be verified before it is fused.
+ *
+ * Returns the number of superinstructions created.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+size_t paravm_fuse_module(const ParaVMModule *mod);
+
+/* Expands `insn` into the sequence of instructions that
+ * it was fused from if it is a superinstruction. The new
+ * instructions are stored in `expansion`, which must have
+ * room for `PARAVM_MAX_EXPANSION` elements. They share
+ * registers and operands with `insn` and must be destroyed
+ * with `paravm_destroy_instruction` before `insn` is.
+ *
+ * Returns the number of instructions stored in `expansion`,
+ * or 0 if `insn` is not a superinstruction.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+size_t paravm_expand_instruction(const ParaVMInstruction *insn, const ParaVMInstruction **expansion);
+
+paravm_end
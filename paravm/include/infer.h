@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ir.h"
+
+paravm_begin
+
+typedef enum ParaVMType ParaVMType;
+
+/* Describes the kinds of values a register can hold. The
+ * values are bits, so a set of possible kinds is expressed
+ * by combining them.
+ */
+enum ParaVMType
+{
+    PARAVM_TYPE_NONE = 0, // No value, e.g. because the register is unassigned.
+    PARAVM_TYPE_NIL = 1 << 0, // The `nil` value.
+    PARAVM_TYPE_INT = 1 << 1, // An integer.
+    PARAVM_TYPE_FLT = 1 << 2, // A floating point number.
+    PARAVM_TYPE_ATOM = 1 << 3, // An atom.
+    PARAVM_TYPE_BIN = 1 << 4, // A binary.
+    PARAVM_TYPE_FUNC = 1 << 5, // A function.
+    PARAVM_TYPE_TUP = 1 << 6, // A tuple.
+    PARAVM_TYPE_LIST = 1 << 7, // A list.
+    PARAVM_TYPE_MAP = 1 << 8, // A map.
+    PARAVM_TYPE_SET = 1 << 9, // A set.
+    PARAVM_TYPE_NUM = PARAVM_TYPE_INT | PARAVM_TYPE_FLT, // Any number.
+    PARAVM_TYPE_ANY = (1 << 10) - 1, // Any value at all.
+};
+
+/* Infers which kinds of values each register of each
+ * instruction in `mod` can hold, and stores the results in
+ * the instructions for `paravm_get_operand_types`.
+ *
+ * The analysis follows values from the instructions that
+ * create them (`load.int`, `tup.make`, and so on) through
+ * branches and exception handlers. Arguments and the
+ * results of calls and container lookups can be anything.
+ * Once an instruction has completed, its operands are
+ * known to be of the kinds it accepts; e.g. both operands
+ * of `num.and` are integers afterwards, as it throws
+ * otherwise. Arithmetic on integers yields integers, and
+ * arithmetic involving a float yields a float, except for
+ * `num.pow`, which can yield either.
+ *
+ * The module should be verified first, as registers read
+ * before being assigned are assumed to hold no value. This
+ * has to be done again after `mod` has been changed (e.g.
+ * by `paravm_fuse_module`); instructions created since the
+ * last call report `PARAVM_TYPE_ANY` for every register,
+ * as do instructions in blocks that can never be reached.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_infer_module_types(const ParaVMModule *mod);
+
+/* Gets the kinds of values that register `idx` of `insn`
+ * can hold when `insn` executes. For registers that `insn`
+ * reads, this is the value on entry; for registers it only
+ * writes, this is the value it stores.
+ *
+ * Returns a combination of `ParaVMType` values, which is
+ * `PARAVM_TYPE_ANY` if types have not been inferred for
+ * `insn`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMType paravm_get_operand_types(const ParaVMInstruction *insn, size_t idx);
+
+paravm_end
@@ -11,6 +11,7 @@
 #define naked_func paravm_attr(naked)
 #define global_ctor paravm_attr(constructor)
 #define global_dtor paravm_attr(destructor)
+#define no_asan paravm_attr(no_sanitize_address)
 
 #define null ((void *)0)
 
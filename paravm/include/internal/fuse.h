@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ir.h"
+
+/* Stores the sequence of plain instructions that `insn`
+ * runs in `seq`, which must have room for
+ * `PARAVM_MAX_EXPANSION` elements: the parts of `insn` if
+ * it is a superinstruction, or `insn` itself otherwise.
+ * This lets analyses see the parts read and write registers
+ * in the order they would on their own.
+ *
+ * Returns the number of instructions stored in `seq` and
+ * sets `*fused` if they have to be destroyed with
+ * `release_sequence`.
+ */
+paravm_nothrow
+paravm_nonnull()
+size_t expand_sequence(const ParaVMInstruction *insn, const ParaVMInstruction **seq, bool *fused);
+
+/* Destroys the `count` instructions in `seq` that were
+ * stored by `expand_sequence` if `fused` is set.
+ */
+paravm_nothrow
+paravm_nonnull()
+void release_sequence(const ParaVMInstruction **seq, size_t count, bool fused);
@@ -0,0 +1,30 @@
+#pragma once
+
+/* Hashes a null-terminated string with 32-bit FNV-1a and
+ * stores its length in `*length`. The generators under
+ * `gen` rely on this exact function, so it must not be
+ * changed without updating `gen/PerfectHash.pm`.
+ */
+static inline uint32_t hash_string(const char *str, size_t *length)
+{
+    uint32_t hash = 2166136261u;
+    const char *p = str;
+
+    for (; *p; p++)
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+
+    *length = (size_t)(p - str);
+
+    return hash;
+}
+
+/* Maps a string hash to a slot in a perfect hash table
+ * with `1 << bits` slots and `disps_mask + 1` displacement
+ * buckets, as produced by `gen/PerfectHash.pm`.
+ */
+static inline uint32_t perfect_hash_slot(uint32_t hash, const uint32_t *disps, uint32_t disps_mask, uint32_t bits)
+{
+    uint32_t mixed = (hash ^ disps[hash & disps_mask]) * 2654435761u;
+
+    return bits ? mixed >> (32 - bits) : 0;
+}
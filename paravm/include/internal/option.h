@@ -7,3 +7,6 @@ extern const char *opt_entry;
 extern const char *opt_hdf;
 extern const char *opt_out;
 extern const char *opt_pid;
+extern int opt_jobs;
+extern const char *opt_manifest;
+extern const char *opt_cache;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <errno.h>
+
+#include "error.h"
+
+/* Maps an `errno` value from a failed file system operation
+ * to the closest `ParaVMError`. Values without a closer match,
+ * including 0 from operations that do not set `errno`, map
+ * to `PARAVM_ERROR_IO`, so that a failure is never reported
+ * as success.
+ */
+static inline ParaVMError errno_to_error(int err)
+{
+    switch (err)
+    {
+        case EROFS:
+            return PARAVM_ERROR_READ_ONLY;
+        case EACCES:
+            return PARAVM_ERROR_ACCESS;
+        case ETXTBSY:
+            return PARAVM_ERROR_BUSY;
+        case EINTR:
+            return PARAVM_ERROR_IO_INTERRUPT;
+        case EISDIR:
+            return PARAVM_ERROR_DIRECTORY;
+        case ELOOP:
+        case EMFILE:
+        case ENFILE:
+        case ENOMEM:
+        case EFBIG:
+            return PARAVM_ERROR_LIMIT;
+        case EOVERFLOW:
+            return PARAVM_ERROR_EOF;
+        case ENAMETOOLONG:
+            return PARAVM_ERROR_PATH_LENGTH;
+        case ENOENT:
+            return PARAVM_ERROR_NONEXISTENT;
+        case ENOSPC:
+            return PARAVM_ERROR_NO_SPACE;
+        case ENOTDIR:
+            return PARAVM_ERROR_NOT_DIRECTORY;
+        default:
+            return PARAVM_ERROR_IO;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "link.h"
+
+paravm_begin
+
+typedef struct ParaVMProgram ParaVMProgram;
+
+/* Describes a module that has been translated for the
+ * interpreter. The program is built from the module's linked
+ * code (see `paravm_link_module`), so that executing it does
+ * not involve the IR at all.
+ */
+struct ParaVMProgram
+{
+    const ParaVMModule *module; // The module the program was created from.
+
+    const void *linked; // Private. Do not use.
+    const void *functions; // Private. Do not use.
+    const void *function_table; // Private. Do not use.
+    size_t module_atom; // Private. Do not use.
+};
+
+typedef enum ParaVMRunResult ParaVMRunResult;
+
+/* Indicates how a run of a program ended.
+ */
+enum ParaVMRunResult
+{
+    PARAVM_RUN_OK = 0, // The entry point returned a value.
+    PARAVM_RUN_EXCEPTION = 1, // The entry point threw an exception that was never caught.
+    PARAVM_RUN_NO_ENTRY = 2, // The entry point does not exist.
+    PARAVM_RUN_BAD_ENTRY = 3, // The entry point takes more than one argument.
+};
+
+/* Translates `mod` into a program for the interpreter. The
+ * module must have been verified, and its atom operands must
+ * have been interned with `paravm_intern_module_atoms`. If
+ * `paravm_fuse_module` has been applied to it, the program
+ * uses the superinstructions, and if its types have been
+ * inferred with `paravm_infer_module_types`, instructions
+ * whose operands are known to be of the right kinds skip the
+ * checks that they would otherwise make.
+ *
+ * `mod` and its atom table must outlive the program. On
+ * success, the program is stored in `*program`.
+ *
+ * This function can return the following errors:
+ *
+ * * `PARAVM_ERROR_OVERFLOW` if an integer operand is too large.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_create_program(const ParaVMModule *mod, const ParaVMProgram **program);
+
+/* Destroys `program` if it is not `NULL`.
+ */
+paravm_api
+paravm_nothrow
+void paravm_destroy_program(const ParaVMProgram *program);
+
+/* Runs the function called `entry` in `program` until it
+ * returns or throws. If the function takes an argument, it
+ * is passed a list holding a binary with the bytes of each
+ * string in the `NULL`-terminated `args` array.
+ *
+ * Integers are 64 bits wide; arithmetic that overflows them
+ * throws `'badarith'`. Operations on values of the wrong
+ * kind throw `'badtype'` (see `paravm_infer_module_types`
+ * for the kinds each opcode accepts). All calls, including
+ * `call.up`, go to the functions of `program`; calls to other
+ * modules throw `'undef'`. The registers that follow the
+ * source of `map.keys`, `map.vals`, `set.size`, and
+ * `set.vals` are reserved and ignored.
+ *
+ * If the function returns or throws, a textual rendering of
+ * the value returned or thrown is stored in `*value`, which
+ * should be freed with `free`; otherwise, `*value` is set
+ * to `NULL`.
+ *
+ * A program can only be run on one thread at a time.
+ *
+ * Returns one of the `ParaVMRunResult` values.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMRunResult paravm_run_program(const ParaVMProgram *program, const char *entry,
+                                   const char *const *args, char **value);
+
+paravm_end
@@ -33,6 +33,25 @@ paravm_nothrow
 paravm_nonnull()
 ParaVMError paravm_write_module(const ParaVMModule *mod, const char *path);
 
+/* Writes the `size` bytes at `data` to `path`. This is
+ * meant for PVC images produced by `paravm_translate_stream`
+ * and can return the same errors as `paravm_write_module`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_write_image(const void *data, size_t size, const char *path);
+
+/* Reads the entire file at `path` into memory. On success,
+ * `*data` points to `*size` bytes that should be freed with
+ * `free`. This function can return the I/O errors listed
+ * for `paravm_read_module`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_read_image(const char *path, void **data, size_t *size);
+
 /* Reads a binary PVC (Parallella Virtual Code) file from
  * `path` and loads it into `mod`.
  *
@@ -68,6 +87,16 @@ paravm_nothrow
 paravm_nonnull()
 ParaVMError paravm_read_module(const char *path, const ParaVMModule *mod);
 
+/* Loads the `size` bytes of PVC image at `data` into `mod`,
+ * as if they had been read from a file by
+ * `paravm_read_module`. This can return the same errors,
+ * except for those that only occur when opening a file.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull(3)
+ParaVMError paravm_read_module_image(const void *data, size_t size, const ParaVMModule *mod);
+
 /* Extracts the module name from `path`. For instance, a
  * path such as `/foo/bar/baz.pvc` would have the module
  * name `baz`. The returned pointer should be freed with
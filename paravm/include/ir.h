@@ -1,5 +1,6 @@
 #pragma once
 
+#include "atom.h"
 #include "error.h"
 #include "opcode.h"
 
@@ -13,6 +14,7 @@ typedef struct ParaVMModule ParaVMModule;
 struct ParaVMModule
 {
     const char *name; // The name of the module, e.g. `foo` for `/bar/foo.pvc`.
+    const ParaVMAtomTable *atom_table; // Table that atom operands have been interned into, or `NULL`.
 
     const void *function_table; // Private. Do not use.
     const void *function_list; // Private. Do not use.
@@ -95,8 +97,10 @@ struct ParaVMInstruction
     const ParaVMOpCode *opcode; // The opcode the instruction executes.
     ParaVMOperand operand; // The operand of the instruction.
     bool own_operand; // Whether the operand's lifetime is managed by this instruction.
+    size_t atom; // The interned atom operand, or `SIZE_MAX` if not interned.
 
     const void *registers; // Private. Do not use.
+    const void *types; // Private. Do not use.
 };
 
 /* Creates a new `ParaVMRegister` with the given values.
@@ -429,4 +433,25 @@ paravm_nothrow
 paravm_nonnull()
 size_t paravm_get_function_count(const ParaVMModule *mod);
 
+/* Interns the atom operands of all instructions in `mod`
+ * into `table` in a single batch. Afterwards, the `atom`
+ * field of each instruction with an atom operand holds
+ * the operand's atom, and `mod->atom_table` is set to
+ * `table`, so later passes can compare atoms instead of
+ * strings. The operand strings are left untouched.
+ *
+ * This should be done once a module has been fully loaded
+ * or assembled. Instructions added to `mod` afterwards are
+ * not interned unless this is called again with the same
+ * `table`.
+ *
+ * Each interned atom is retained (see `paravm_retain_atom`)
+ * and is released again when `mod` is destroyed, so `table`
+ * must outlive `mod`.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+void paravm_intern_module_atoms(const ParaVMModule *mod, ParaVMAtomTable *table);
+
 paravm_end
@@ -81,4 +81,120 @@ paravm_nonnull()
 ParaVMError paravm_lex_string(const char *str, ParaVMToken ***tokens,
                               uint32_t *line, uint32_t *column);
 
+typedef struct ParaVMTokenSlice ParaVMTokenSlice;
+
+/* Defines a token as produced by `paravm_lex_slices`. Rather
+ * than holding a copy of its value, a slice refers to the
+ * location of the value in the lexed source code.
+ */
+struct ParaVMTokenSlice
+{
+    ParaVMTokenType type; // The type of the token.
+    bool escaped; // Whether the value contains escape sequences.
+    uint32_t offset; // The byte offset of the value (excluding quotes for strings and atoms).
+    uint32_t length; // The byte length of the value.
+    uint32_t line; // The line this token is on.
+    uint32_t column; // The column this token is at.
+};
+
+/* Gets the value of `slice` as lexed from `str`, with any
+ * escape sequences processed. The returned string should be
+ * freed with `free`.
+ *
+ * Returns the value of the token.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+char *paravm_get_slice_value(const char *str, const ParaVMTokenSlice *slice);
+
+/* Attempts to lex `str` as PVA source code, in the same way
+ * as `paravm_lex_string`. Instead of allocating each token
+ * separately, `*slices` is set to a single array of `*count`
+ * token slices referring into `str`, so `str` must be kept
+ * alive for as long as the slices are used.
+ *
+ * The array should be freed with `free`.
+ *
+ * Returns `PARAVM_ERROR_BAD_UTF8` if the input is malformed,
+ * `PARAVM_ERROR_SYNTAX` if there's a syntax error,
+ * `PARAVM_ERROR_OVERFLOW` if a floating point value was too
+ * large or `str` is larger than 4 GB, or `PARAVM_ERROR_OK` if
+ * lexing the string was successful.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_lex_slices(const char *str, ParaVMTokenSlice **slices, size_t *count,
+                              uint32_t *line, uint32_t *column);
+
+typedef struct ParaVMLexer ParaVMLexer;
+
+/* Lexes PVA source code incrementally, one token at a
+ * time. A lexer created from a file only keeps a window
+ * of the file in memory, which grows only as needed to
+ * hold the longest token or comment.
+ */
+struct ParaVMLexer
+{
+    void *file; // Private. Do not use.
+    void *buffer; // Private. Do not use.
+    void *value; // Private. Do not use.
+    size_t position; // Private. Do not use.
+    size_t length; // Private. Do not use.
+    size_t capacity; // Private. Do not use.
+    uint32_t line; // Private. Do not use.
+    uint32_t column; // Private. Do not use.
+    bool eof; // Private. Do not use.
+};
+
+/* Creates a new `ParaVMLexer` that lexes `str`. The string
+ * is not copied, so it must outlive the lexer.
+ *
+ * Returns a `ParaVMLexer` instance.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMLexer *paravm_create_lexer(const char *str);
+
+/* Creates a new `ParaVMLexer` that lexes the contents of
+ * the file at `path`, and sets `*lexer` to it.
+ *
+ * This function can return any of the errors listed for
+ * `paravm_read_module`, except for those concerning the
+ * module format.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_open_lexer(const char *path, ParaVMLexer **lexer);
+
+/* Destroys `lexer` if it is not `NULL`. Any file that it
+ * was reading from is closed.
+ */
+paravm_api
+paravm_nothrow
+void paravm_destroy_lexer(ParaVMLexer *lexer);
+
+/* Lexes the next token from `lexer` into `*tok`. The value
+ * of the token is owned by the lexer and is only valid
+ * until the next call to this function. At the end of the
+ * input, `tok->value` is set to `NULL`. In the case of an
+ * error, `tok->line` and `tok->column` are set to the
+ * location where the error approximately occurred, and the
+ * lexer should not be used any further.
+ *
+ * Returns the same errors as `paravm_lex_string`, as well
+ * as any I/O errors that occur while reading the file, or
+ * `PARAVM_ERROR_OK` if a token was lexed or the end of the
+ * input was reached.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_lex_token(ParaVMLexer *lexer, ParaVMToken *tok);
+
 paravm_end
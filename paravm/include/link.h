@@ -0,0 +1,121 @@
+#pragma once
+
+#include "infer.h"
+#include "ir.h"
+
+paravm_begin
+
+/* Marks the absence of an instruction index, a register slot,
+ * or a function index in linked code.
+ */
+#define PARAVM_LINK_NONE UINT32_MAX
+
+typedef struct ParaVMLinkedBinary ParaVMLinkedBinary;
+
+/* Describes a binary literal in linked code.
+ */
+struct ParaVMLinkedBinary
+{
+    const uint8_t *data; // The bits, most significant bit of each byte first.
+    size_t size; // The number of bits.
+};
+
+typedef union ParaVMLinkedOperand ParaVMLinkedOperand;
+
+/* Describes the decoded operand of a linked instruction.
+ * Accessing fields that do not correspond to the opcode's
+ * operand kind is undefined.
+ */
+union ParaVMLinkedOperand
+{
+    int64_t integer; // An integer literal.
+    double real; // A floating point literal.
+    size_t atom; // An atom literal; the interned atom, or `SIZE_MAX` if not interned.
+    ParaVMLinkedBinary binary; // A binary literal.
+    uint32_t targets[2]; // Indices of the instructions that one or two basic blocks start at.
+};
+
+typedef struct ParaVMLinkedInstruction ParaVMLinkedInstruction;
+
+/* Describes an instruction of a linked function. Everything
+ * an engine needs to execute the instruction is resolved
+ * up front, so that the IR does not have to be consulted.
+ */
+struct ParaVMLinkedInstruction
+{
+    const ParaVMOpCode *opcode; // The opcode the instruction executes.
+    ParaVMLinkedOperand operand; // The decoded operand of the instruction.
+    uint32_t register_count; // The number of registers, including additional ones.
+    const uint32_t *registers; // The slot index of each register.
+    const ParaVMType *types; // The kinds of values each register can hold (see `paravm_get_operand_types`).
+    uint32_t handler; // Index of the instruction to go to if this one throws, or `PARAVM_LINK_NONE`.
+    uint32_t exception; // Slot to store thrown values in when going to `handler`, or `PARAVM_LINK_NONE`.
+    uint32_t function; // Index of the function called by `load.func`, `call.rem`, or `call.up`, or `PARAVM_LINK_NONE`.
+};
+
+typedef struct ParaVMLinkedFunction ParaVMLinkedFunction;
+
+/* Describes a function lowered into a flat array of
+ * instructions. The first instruction of the first block
+ * is at index 0, and each block follows the previous one.
+ */
+struct ParaVMLinkedFunction
+{
+    const ParaVMFunction *function; // The function that was linked.
+    uint32_t arguments; // The number of arguments, which occupy the first slots.
+    uint32_t slots; // The number of register slots.
+    const ParaVMLinkedInstruction *code; // The instructions of the function.
+    size_t length; // The number of instructions, which is 0 if the function has no blocks.
+};
+
+typedef struct ParaVMLinkedModule ParaVMLinkedModule;
+
+/* Describes a module lowered for execution.
+ */
+struct ParaVMLinkedModule
+{
+    const ParaVMModule *module; // The module that was linked.
+    const ParaVMLinkedFunction *functions; // The linked functions, in module order.
+    size_t function_count; // The number of functions.
+
+    const void *storage; // Private. Do not use.
+    const void *atoms; // Private. Do not use.
+};
+
+/* Lowers every function in `mod` into a flat array of
+ * instructions that engines can execute directly:
+ *
+ * * Registers are replaced by slot indices.
+ * * Branch targets and exception handlers are replaced by
+ *   instruction indices.
+ * * Integer, float, and binary literals are decoded.
+ * * `load.func`, `call.rem`, and `call.up` instructions
+ *   whose module and function registers are always loaded
+ *   with atoms naming a function in `mod` earlier in the
+ *   same block refer to that function by index.
+ *
+ * The module must have been verified. If its atom operands
+ * have been interned or its types inferred, the linked code
+ * includes them; calls are only linked to functions when the
+ * atoms have been interned. `mod` must outlive the linked
+ * module, which is stored in `*linked` on success.
+ *
+ * This function can return the following errors:
+ *
+ * * `PARAVM_ERROR_OVERFLOW` if an integer literal does not fit
+ *   in 64 bits or a float literal is not finite.
+ *
+ * If the function succeeds, `PARAVM_ERROR_OK` is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_link_module(const ParaVMModule *mod, const ParaVMLinkedModule **linked);
+
+/* Destroys `linked` if it is not `NULL`.
+ */
+paravm_api
+paravm_nothrow
+void paravm_destroy_linked_module(const ParaVMLinkedModule *linked);
+
+paravm_end
@@ -14,6 +14,11 @@ enum ParaVMVerifierResult
     PARAVM_VERIFIER_NO_TERMINATOR = 1, // A basic block did not have a terminator.
     PARAVM_VERIFIER_MULTIPLE_TERMINATORS = 2, // A basic block contained multiple terminators.
     PARAVM_VERIFIER_BAD_ENDIANNESS = 3, // An endianness atom was not `'little'`, `'big'` or `'native'`.
+    PARAVM_VERIFIER_BAD_REGISTER_COUNT = 4, // An instruction had the wrong number of registers for its opcode.
+    PARAVM_VERIFIER_FOREIGN_REGISTER = 5, // An instruction used a register of another function.
+    PARAVM_VERIFIER_BAD_TARGET = 6, // A branch target was missing or in another function.
+    PARAVM_VERIFIER_BAD_HANDLER = 7, // An exception handler or register was missing or in another function.
+    PARAVM_VERIFIER_UNASSIGNED_REGISTER = 8, // A register could be read before being assigned.
 };
 
 /* Verifies that `mod` contains sensible code for execution.
@@ -27,17 +32,30 @@ enum ParaVMVerifierResult
  * offending instruction if one is relevant to the error;
  * otherwise, it will be `NULL`.
  *
- * This function returns as soon as any error is found, so
- * after fixing an error that this function reports, it
- * should be executed again to see if a module is error-free.
+ * This function returns as soon as any error is found. Use
+ * `paravm_verify_module_all` to find every error at once.
  *
- * Note that this function assumes that instructions are
+ * Besides checking terminators and endianness atoms, the
+ * verifier checks that every instruction has as many
+ * registers as its opcode takes, that registers, branch
+ * targets, and exception handlers belong to the function
+ * they are used in, and that no register can be read
+ * before it is assigned on some path from the first block
+ * of its function. A block's exception register counts as
+ * assigned in its handler. The last check is only done for
+ * functions that pass all the others.
+ *
+ * Note that this function assumes that operands are
  * well-formed; that is, if an instruction takes an atom
  * operand, this function expects the instruction's operand
  * to actually be an atom, and so on. It is assumed that
  * whatever code loaded a module into memory made sure that
  * such invariants are upheld.
  *
+ * If the atom operands of `mod` have been interned with
+ * `paravm_intern_module_atoms`, they are checked by atom
+ * rather than by string.
+ *
  * Returns one of the `ParaVMVerifierResult` values to
  * indicate the result of the verification operation. If the
  * returned value is `PARAVM_VERIFIER_OK`, the module is
@@ -51,4 +69,102 @@ ParaVMVerifierResult paravm_verify_module(const ParaVMModule *mod,
                                           const ParaVMBlock **offender_blk,
                                           const ParaVMInstruction **offender_insn);
 
+typedef struct ParaVMDiagnostic ParaVMDiagnostic;
+
+/* Describes a single error found by the verifier.
+ */
+struct ParaVMDiagnostic
+{
+    ParaVMVerifierResult result; // The kind of error.
+    const ParaVMFunction *function; // Function that the error is in.
+    const ParaVMBlock *block; // Block that the error is in.
+    const ParaVMInstruction *instruction; // Offending instruction, or `NULL` if none is relevant.
+    const ParaVMRegister *reg; // Offending register, or `NULL` if none is relevant.
+};
+
+/* Verifies `mod` like `paravm_verify_module`, but does not
+ * stop at the first error. Every error is recorded in a
+ * newly allocated array of diagnostics in module order,
+ * which is stored in `*diagnostics` and must be freed with
+ * `free`. The number of diagnostics is stored in `*count`;
+ * if it is zero, `*diagnostics` is set to `NULL`.
+ *
+ * The first diagnostic is always the error that
+ * `paravm_verify_module` would report.
+ *
+ * Returns the result of the first diagnostic, or
+ * `PARAVM_VERIFIER_OK` if there are none.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMVerifierResult paravm_verify_module_all(const ParaVMModule *mod,
+                                              ParaVMDiagnostic **diagnostics,
+                                              size_t *count);
+
+/* Verifies `mod` like `paravm_verify_module_all`, but checks
+ * its functions on up to `threads` threads. If `threads` is
+ * `0`, one thread per processor is used. The diagnostics are
+ * the same, and in the same order, as those that
+ * `paravm_verify_module_all` produces.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMVerifierResult paravm_verify_module_parallel(const ParaVMModule *mod, uint32_t threads,
+                                                   ParaVMDiagnostic **diagnostics, size_t *count);
+
+/* The version of the checks that the verifier performs. It
+ * changes whenever a check is added or altered, which makes
+ * records written by `paravm_record_module_verified` for
+ * earlier versions stale.
+ */
+extern const uint32_t paravm_verifier_version;
+
+/* The size of a module image digest, in bytes.
+ */
+#define PARAVM_VERIFIER_DIGEST_SIZE 32
+
+/* Computes the digest that identifies the `size` bytes of
+ * PVC image at `data` in verification records, and stores
+ * it in `digest`, which must have room for
+ * `PARAVM_VERIFIER_DIGEST_SIZE` bytes. This is a SHA-256
+ * hash of the image.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull(3)
+void paravm_digest_module_image(const void *data, size_t size, uint8_t *digest);
+
+/* Checks whether a record shows that a module image with
+ * the given `digest` has passed verification by this
+ * version of the verifier (and of ParaVM), so that a module
+ * loaded from the image does not have to be verified again.
+ *
+ * Records are looked up in the directory `dir`, which can
+ * be shared by any number of modules, and are named after
+ * the digest. A missing or unreadable record is treated as
+ * no record at all.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+bool paravm_is_module_verified(const char *dir, const uint8_t *digest);
+
+/* Records in the directory `dir` that a module image with
+ * the given `digest` has passed verification. Only modules
+ * that have been verified with no errors should be
+ * recorded. The record is replaced atomically, so other
+ * processes never see a partial record.
+ *
+ * Recording is best effort: if the record cannot be written
+ * for any reason, no partial file is left behind and
+ * `PARAVM_ERROR_IO` is returned. Otherwise, `PARAVM_ERROR_OK`
+ * is returned.
+ */
+paravm_api
+paravm_nothrow
+paravm_nonnull()
+ParaVMError paravm_record_module_verified(const char *dir, const uint8_t *digest);
+
 paravm_end
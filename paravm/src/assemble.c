@@ -1,15 +1,12 @@
+#include <endian.h>
+#include <string.h>
+
 #include <glib.h>
 
 #include "assemble.h"
+#include "io.h"
 #include "opcode.h"
 
-static void free_hash_table(void *ht)
-{
-    assert(ht);
-
-    g_hash_table_destroy(ht);
-}
-
 static void free_ptr_array(void *arr)
 {
     assert(arr);
@@ -24,87 +21,190 @@ static void free_instruction(void *insn)
     paravm_destroy_instruction(insn);
 }
 
-ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod,
-                                   uint32_t *line, uint32_t *column)
+// Resolves the block names referred to by the instructions
+// and handlers of `func` now that all of its blocks are known,
+// and adds the instructions to their blocks.
+static ParaVMError finish_function(const ParaVMFunction *func, GHashTable *insns, GHashTable *handlers)
 {
-    assert(tokens);
-    assert(mod);
-    assert(line);
-    assert(column);
+    ParaVMError result = PARAVM_ERROR_OK;
 
-    *line = 1;
-    *column = 0;
+    GHashTableIter block_iter;
+    g_hash_table_iter_init(&block_iter, insns);
 
-    __block ParaVMToken **ltokens = tokens;
+    const ParaVMBlock *key_block;
+    GPtrArray *value_insns;
 
-    ParaVMToken *(^ peek_token)(void) = ^(void)
+    while (g_hash_table_iter_next(&block_iter, (gpointer *)&key_block, (gpointer *)&value_insns))
     {
-        return *ltokens;
-    };
+        for (uint32_t i = 0; i < value_insns->len; i++)
+        {
+            const ParaVMInstruction *orig_insn = g_ptr_array_index(value_insns, i);
+
+            ParaVMOperand oper;
+            bool own = false;
+
+            switch (orig_insn->opcode->operand)
+            {
+                case PARAVM_OPERAND_TYPE_NONE:
+                case PARAVM_OPERAND_TYPE_INTEGER:
+                case PARAVM_OPERAND_TYPE_FLOAT:
+                case PARAVM_OPERAND_TYPE_ATOM:
+                case PARAVM_OPERAND_TYPE_BINARY:
+                    oper.string = orig_insn->operand.string;
+                    own = true;
+
+                    break;
+                case PARAVM_OPERAND_TYPE_BLOCK:
+                    oper.block = paravm_get_block(func, orig_insn->operand.string);
+
+                    if (!oper.block)
+                        result = PARAVM_ERROR_ASSEMBLY;
+
+                    break;
+                case PARAVM_OPERAND_TYPE_BLOCKS:
+                    oper.blocks[0] = paravm_get_block(func, (const char *)orig_insn->operand.blocks[0]);
+                    oper.blocks[1] = paravm_get_block(func, (const char *)orig_insn->operand.blocks[1]);
+
+                    if (!oper.blocks[0] || !oper.blocks[1])
+                        result = PARAVM_ERROR_ASSEMBLY;
+
+                    break;
+                default:
+                    assert_unreachable();
+                    break;
+            }
+
+            if (result != PARAVM_ERROR_OK)
+                return result;
+
+            const ParaVMRegister *const *regs = paravm_get_instruction_registers(orig_insn);
+            const ParaVMInstruction *insn = paravm_create_instruction(orig_insn->opcode,
+                                                                      oper,
+                                                                      own,
+                                                                      regs);
+
+            paravm_append_instruction(key_block, insn);
+        }
+    }
+
+    g_hash_table_iter_init(&block_iter, handlers);
+
+    const char *value_str;
+
+    while (g_hash_table_iter_next(&block_iter, (gpointer *)&key_block, (gpointer *)&value_str))
+    {
+        const ParaVMBlock *handler = paravm_get_block(func, value_str);
+
+        if (!handler)
+            return PARAVM_ERROR_ASSEMBLY;
+
+        if (paravm_set_handler_block(key_block, handler) != PARAVM_ERROR_OK)
+            return PARAVM_ERROR_ASSEMBLY;
+    }
+
+    return result;
+}
+
+// Assembles the tokens produced by `source_next`, passing
+// each function to `add_function` as soon as it is created.
+// `add_function` should return `false` if the name is taken.
+// `source_peek` reports the type of the next token without
+// consuming it. A token value only needs to remain valid
+// until the next call to either block; anything that has to
+// be kept around is copied.
+//
+// Each function is finished as soon as the next one starts,
+// so the memory used here is bounded by the largest function
+// rather than the whole module.
+static ParaVMError assemble(bool (^ source_peek)(ParaVMTokenType *type),
+                            bool (^ source_next)(ParaVMToken *tok),
+                            bool (^ add_function)(const ParaVMFunction *func),
+                            uint32_t *line, uint32_t *column)
+{
+    *line = 1;
+    *column = 0;
 
     __block uint32_t lline = 1;
     __block uint32_t lcolumn = 0;
 
-    ParaVMToken *(^ next_token)(void) = ^(void)
+    bool (^ next_token)(ParaVMToken *) = ^ bool (ParaVMToken *tok)
     {
-        if (!*ltokens)
-            return (ParaVMToken *)null;
-
-        ParaVMToken *tok = *ltokens++;
+        if (!source_next(tok))
+            return false;
 
         lline = tok->line;
         lcolumn = tok->column;
 
-        return tok;
+        return true;
     };
 
 #define NEXT_TOKEN(VAR, TYPE) \
-    ParaVMToken *VAR = next_token(); \
+    ParaVMToken VAR; \
     \
-    if (!VAR || VAR->type != PARAVM_TOKEN_TYPE_ ## TYPE) \
+    if (!next_token(&VAR) || VAR.type != PARAVM_TOKEN_TYPE_ ## TYPE) \
     { \
         result = PARAVM_ERROR_SYNTAX; \
         break; \
     }
 
-    GHashTable *insns = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, null, &free_hash_table);
-    GHashTable *handlers = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, null, &free_hash_table);
+    // These only ever hold the state of the current function.
+    GHashTable *insns = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, null, &free_ptr_array);
+    GHashTable *handlers = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+    GStringChunk *names = g_string_chunk_new(4096);
 
     const ParaVMFunction *func = null;
+    uint32_t func_line = 0;
+    uint32_t func_column = 0;
     const ParaVMBlock *block = null;
     bool have_regs = false;
     bool have_insns = false;
 
     ParaVMError result = PARAVM_ERROR_OK;
-    ParaVMToken *t;
+    ParaVMToken t;
 
-    while ((t = next_token()))
+    while (next_token(&t))
     {
         GPtrArray *insn_regs = null;
 
-        switch (t->type)
+        switch (t.type)
         {
             case PARAVM_TOKEN_TYPE_FUN:
             {
-                NEXT_TOKEN(name, STRING);
-
-                if (paravm_get_function(mod, name->value))
+                if (func)
                 {
-                    result = PARAVM_ERROR_ASSEMBLY;
-                    break;
+                    result = finish_function(func, insns, handlers);
+
+                    g_hash_table_remove_all(insns);
+                    g_hash_table_remove_all(handlers);
+                    g_string_chunk_clear(names);
+
+                    if (result != PARAVM_ERROR_OK)
+                    {
+                        // Blame the function that failed, not the
+                        // one that follows it.
+                        t.line = func_line;
+                        t.column = func_column;
+
+                        break;
+                    }
                 }
 
-                func = paravm_create_function(name->value);
+                NEXT_TOKEN(name, STRING);
+
+                func = paravm_create_function(name.value);
+                func_line = t.line;
+                func_column = t.column;
                 block = null;
                 have_regs = false;
 
-                paravm_add_function(mod, func);
-
-                GHashTable *tab = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, null, &free_ptr_array);
-                g_hash_table_insert(insns, (ParaVMFunction *)func, tab);
+                if (!add_function(func))
+                {
+                    paravm_destroy_function(func);
+                    func = null;
 
-                tab = g_hash_table_new(&g_direct_hash, &g_direct_equal);
-                g_hash_table_insert(handlers, (ParaVMFunction *)func, tab);
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
 
                 break;
             }
@@ -118,13 +218,13 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
 
                 NEXT_TOKEN(name, STRING);
 
-                if (paravm_get_argument(func, name->value))
+                if (paravm_get_argument(func, name.value))
                 {
                     result = PARAVM_ERROR_ASSEMBLY;
                     break;
                 }
 
-                paravm_add_register(func, paravm_create_register(name->value, true));
+                paravm_add_register(func, paravm_create_register(name.value, true));
 
                 break;
             }
@@ -138,7 +238,7 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
 
                 NEXT_TOKEN(name, STRING);
 
-                if (paravm_get_register(func, name->value))
+                if (paravm_get_register(func, name.value))
                 {
                     result = PARAVM_ERROR_ASSEMBLY;
                     break;
@@ -146,7 +246,7 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
 
                 have_regs = true;
 
-                paravm_add_register(func, paravm_create_register(name->value, false));
+                paravm_add_register(func, paravm_create_register(name.value, false));
 
                 break;
             }
@@ -160,20 +260,19 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
 
                 NEXT_TOKEN(name, STRING);
 
-                if (paravm_get_block(func, name->value))
+                if (paravm_get_block(func, name.value))
                 {
                     result = PARAVM_ERROR_ASSEMBLY;
                     break;
                 }
 
-                block = paravm_create_block(name->value);
+                block = paravm_create_block(name.value);
                 have_insns = false;
 
                 paravm_add_block(func, block);
 
-                GHashTable *tab = g_hash_table_lookup(insns, func);
                 GPtrArray *arr = g_ptr_array_new_with_free_func(&free_instruction);
-                g_hash_table_insert(tab, (ParaVMBlock *)block, arr);
+                g_hash_table_insert(insns, (ParaVMBlock *)block, arr);
 
                 break;
             }
@@ -186,9 +285,12 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                 }
 
                 NEXT_TOKEN(name, STRING);
+
+                const char *handler = g_string_chunk_insert(names, name.value);
+
                 NEXT_TOKEN(reg_name, STRING);
 
-                const ParaVMRegister *reg = paravm_get_register(func, reg_name->value);
+                const ParaVMRegister *reg = paravm_get_register(func, reg_name.value);
 
                 if (!reg)
                 {
@@ -202,8 +304,7 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                     break;
                 }
 
-                GHashTable *tab = g_hash_table_lookup(handlers, func);
-                g_hash_table_insert(tab, (ParaVMBlock *)block, name->value);
+                g_hash_table_insert(handlers, (ParaVMBlock *)block, (char *)handler);
 
                 break;
             }
@@ -215,17 +316,17 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                     break;
                 }
 
-                const ParaVMOpCode *opc = paravm_get_opcode_by_name(t->value);
+                const ParaVMOpCode *opc = paravm_get_opcode_by_name(t.value);
                 have_insns = true;
 
                 insn_regs = g_ptr_array_new();
-                ParaVMToken *t2;
+                ParaVMTokenType next_type;
 
-                while ((t2 = peek_token()) && t2->type == PARAVM_TOKEN_TYPE_STRING)
+                while (source_peek(&next_type) && next_type == PARAVM_TOKEN_TYPE_STRING)
                 {
                     NEXT_TOKEN(reg_tok, STRING);
 
-                    const ParaVMRegister *reg = paravm_get_register(func, reg_tok->value);
+                    const ParaVMRegister *reg = paravm_get_register(func, reg_tok.value);
 
                     if (!reg)
                     {
@@ -244,7 +345,7 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                 if (result != PARAVM_ERROR_OK)
                     break;
 
-                ParaVMOperand operand;
+                ParaVMOperand operand = { .string = null };
 
                 if (opc->operand != PARAVM_OPERAND_TYPE_NONE)
                 {
@@ -255,45 +356,45 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                         case PARAVM_OPERAND_TYPE_INTEGER:
                         {
                             NEXT_TOKEN(oper, INTEGER);
-                            operand.string = oper->value;
+                            operand.string = g_string_chunk_insert(names, oper.value);
 
                             break;
                         }
                         case PARAVM_OPERAND_TYPE_FLOAT:
                         {
                             NEXT_TOKEN(oper, FLOAT);
-                            operand.string = oper->value;
+                            operand.string = g_string_chunk_insert(names, oper.value);
 
                             break;
                         }
                         case PARAVM_OPERAND_TYPE_ATOM:
                         {
                             NEXT_TOKEN(oper, ATOM);
-                            operand.string = oper->value;
+                            operand.string = g_string_chunk_insert(names, oper.value);
 
                             break;
                         }
                         case PARAVM_OPERAND_TYPE_BINARY:
                         {
                             NEXT_TOKEN(oper, BINARY);
-                            operand.string = oper->value;
+                            operand.string = g_string_chunk_insert(names, oper.value);
 
                             break;
                         }
                         case PARAVM_OPERAND_TYPE_BLOCK:
                         {
                             NEXT_TOKEN(oper, STRING);
-                            operand.string = oper->value;
+                            operand.string = g_string_chunk_insert(names, oper.value);
 
                             break;
                         }
                         case PARAVM_OPERAND_TYPE_BLOCKS:
                         {
                             NEXT_TOKEN(oper1, STRING);
-                            operand.blocks[0] = (const ParaVMBlock *)oper1->value;
+                            operand.blocks[0] = (const ParaVMBlock *)g_string_chunk_insert(names, oper1.value);
 
                             NEXT_TOKEN(oper2, STRING);
-                            operand.blocks[1] = (const ParaVMBlock *)oper2->value;
+                            operand.blocks[1] = (const ParaVMBlock *)g_string_chunk_insert(names, oper2.value);
 
                             break;
                         }
@@ -305,11 +406,13 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
                     NEXT_TOKEN(rpar, PAREN_CLOSE);
                 }
 
+                // The register list has to be terminated.
+                g_ptr_array_add(insn_regs, null);
+
                 const ParaVMRegister *const *regs = (const ParaVMRegister *const *)insn_regs->pdata;
                 const ParaVMInstruction *insn = paravm_create_instruction(opc, operand, false, regs);
 
-                GHashTable *tab = g_hash_table_lookup(insns, func);
-                GPtrArray *arr = g_hash_table_lookup(tab, block);
+                GPtrArray *arr = g_hash_table_lookup(insns, block);
                 g_ptr_array_add(arr, (ParaVMInstruction *)insn);
 
                 break;
@@ -325,129 +428,1328 @@ ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod
         if (result != PARAVM_ERROR_OK)
         {
             // Try to give the actual location of the error.
-            *line = t->line;
-            *column = t->column;
+            *line = t.line;
+            *column = t.column;
 
             break;
         }
     }
 
+    if (result == PARAVM_ERROR_OK && func && (result = finish_function(func, insns, handlers)) != PARAVM_ERROR_OK)
+    {
+        *line = func_line;
+        *column = func_column;
+    }
+
     if (result == PARAVM_ERROR_OK)
     {
-        GHashTableIter func_iter;
-        g_hash_table_iter_init(&func_iter, insns);
+        *line = lline;
+        *column = lcolumn;
+    }
 
-        const ParaVMFunction *key_func;
-        GHashTable *value_blocks;
+    g_hash_table_destroy(insns);
+    g_hash_table_destroy(handlers);
+    g_string_chunk_free(names);
 
-        while (g_hash_table_iter_next(&func_iter, (gpointer *)&key_func, (gpointer *)&value_blocks))
-        {
-            GHashTableIter block_iter;
-            g_hash_table_iter_init(&block_iter, value_blocks);
+    return result;
+}
 
-            const ParaVMBlock *key_block;
-            GPtrArray *value_insns;
+ParaVMError paravm_assemble_tokens(ParaVMToken **tokens, const ParaVMModule *mod,
+                                   uint32_t *line, uint32_t *column)
+{
+    assert(tokens);
+    assert(mod);
+    assert(line);
+    assert(column);
 
-            while (g_hash_table_iter_next(&block_iter, (gpointer *)&key_block, (gpointer *)&value_insns))
-            {
-                for (uint32_t i = 0; i < value_insns->len; i++)
-                {
-                    const ParaVMInstruction *orig_insn = g_ptr_array_index(value_insns, i);
+    __block ParaVMToken **ltokens = tokens;
 
-                    ParaVMOperand oper;
-                    bool own = false;
+    bool (^ peek_token)(ParaVMTokenType *) = ^ bool (ParaVMTokenType *type)
+    {
+        if (!*ltokens)
+            return false;
 
-                    switch (orig_insn->opcode->operand)
-                    {
-                        case PARAVM_OPERAND_TYPE_NONE:
-                        case PARAVM_OPERAND_TYPE_INTEGER:
-                        case PARAVM_OPERAND_TYPE_FLOAT:
-                        case PARAVM_OPERAND_TYPE_ATOM:
-                        case PARAVM_OPERAND_TYPE_BINARY:
-                            oper.string = orig_insn->operand.string;
-                            own = true;
+        *type = (*ltokens)->type;
 
-                            break;
-                        case PARAVM_OPERAND_TYPE_BLOCK:
-                            oper.block = paravm_get_block(key_func, orig_insn->operand.string);
+        return true;
+    };
 
-                            if (!oper.block)
-                                result = PARAVM_ERROR_ASSEMBLY;
+    bool (^ next_token)(ParaVMToken *) = ^ bool (ParaVMToken *tok)
+    {
+        if (!*ltokens)
+            return false;
 
-                            break;
-                        case PARAVM_OPERAND_TYPE_BLOCKS:
-                            oper.blocks[0] = paravm_get_block(key_func, (const char *)orig_insn->operand.blocks[0]);
-                            oper.blocks[1] = paravm_get_block(key_func, (const char *)orig_insn->operand.blocks[1]);
+        *tok = **ltokens++;
 
-                            if (!oper.blocks[0] || !oper.blocks[1])
-                                result = PARAVM_ERROR_ASSEMBLY;
+        return true;
+    };
 
-                            break;
-                        default:
-                            assert_unreachable();
-                            break;
-                    }
+    bool (^ add_function)(const ParaVMFunction *) = ^ bool (const ParaVMFunction *func)
+    {
+        return paravm_add_function(mod, func) == PARAVM_ERROR_OK;
+    };
 
-                    if (result != PARAVM_ERROR_OK)
-                        break;
+    return assemble(peek_token, next_token, add_function, line, column);
+}
 
-                    const ParaVMRegister *const *regs = paravm_get_instruction_registers(orig_insn);
-                    const ParaVMInstruction *insn = paravm_create_instruction(orig_insn->opcode,
-                                                                              oper,
-                                                                              own,
-                                                                              regs);
+// Assembles the `count` slices at `slices`, which refer into
+// `str`.
+static ParaVMError assemble_slices(const char *str, const ParaVMTokenSlice *slices, size_t count,
+                                   bool (^ add_function)(const ParaVMFunction *func),
+                                   uint32_t *line, uint32_t *column)
+{
+    __block size_t idx = 0;
 
-                    paravm_append_instruction(key_block, insn);
-                }
+    // Values are only copied out of the source once the
+    // assembler actually asks for them, and then only into a
+    // single scratch buffer.
+    GString *value = g_string_new(null);
 
-                if (result != PARAVM_ERROR_OK)
-                    break;
-            }
+    bool (^ peek_token)(ParaVMTokenType *) = ^ bool (ParaVMTokenType *type)
+    {
+        if (idx == count)
+            return false;
 
-            if (result != PARAVM_ERROR_OK)
-                break;
-        }
+        *type = slices[idx].type;
+
+        return true;
+    };
+
+    bool (^ next_token)(ParaVMToken *) = ^ bool (ParaVMToken *tok)
+    {
+        if (idx == count)
+            return false;
 
-        g_hash_table_iter_init(&func_iter, handlers);
+        const ParaVMTokenSlice *slice = &slices[idx++];
 
-        while (g_hash_table_iter_next(&func_iter, (gpointer *)&key_func, (gpointer *)&value_blocks))
+        if (!slice->escaped)
+        {
+            g_string_truncate(value, 0);
+            g_string_append_len(value, str + slice->offset, slice->length);
+        }
+        else
         {
-            GHashTableIter block_iter;
-            g_hash_table_iter_init(&block_iter, value_blocks);
+            char *unescaped = paravm_get_slice_value(str, slice);
 
-            const ParaVMBlock *key_block;
-            const char *value_str;
+            g_string_assign(value, unescaped);
+            g_free(unescaped);
+        }
 
-            while (g_hash_table_iter_next(&block_iter, (gpointer *)&key_block, (gpointer *)&value_str))
-            {
-                const ParaVMBlock *handler = paravm_get_block(key_func, value_str);
+        tok->type = slice->type;
+        tok->value = value->str;
+        tok->line = slice->line;
+        tok->column = slice->column;
 
-                if (!handler)
-                {
-                    result = PARAVM_ERROR_ASSEMBLY;
-                    break;
-                }
+        return true;
+    };
 
-                if (paravm_set_handler_block(key_block, handler) != PARAVM_ERROR_OK)
-                {
-                    result = PARAVM_ERROR_ASSEMBLY;
-                    break;
-                }
-            }
+    ParaVMError result = assemble(peek_token, next_token, add_function, line, column);
 
-            if (result != PARAVM_ERROR_OK)
-                break;
+    g_string_free(value, true);
+
+    return result;
+}
+
+ParaVMError paravm_assemble_slices(const char *str, const ParaVMTokenSlice *slices, size_t count,
+                                   const ParaVMModule *mod, uint32_t *line, uint32_t *column)
+{
+    assert(str);
+    assert(!count || slices);
+    assert(mod);
+    assert(line);
+    assert(column);
+
+    bool (^ add_function)(const ParaVMFunction *) = ^ bool (const ParaVMFunction *func)
+    {
+        return paravm_add_function(mod, func) == PARAVM_ERROR_OK;
+    };
+
+    return assemble_slices(str, slices, count, add_function, line, column);
+}
+
+// A run of slices starting at a `.fun` directive (except
+// possibly the first one), assembled on its own.
+typedef struct
+{
+    const char *str;
+    const ParaVMTokenSlice *slices;
+    size_t count;
+    const ParaVMFunction *func;
+    ParaVMError result;
+    uint32_t line;
+    uint32_t column;
+} FunctionJob;
+
+static void assemble_job(void *data, var_unused void *user_data)
+{
+    assert(data);
+
+    FunctionJob *job = data;
+
+    // Name clashes are checked for when the functions are
+    // merged into the module.
+    bool (^ add_function)(const ParaVMFunction *) = ^ bool (const ParaVMFunction *func)
+    {
+        job->func = func;
+
+        return true;
+    };
+
+    job->result = assemble_slices(job->str, job->slices, job->count, add_function, &job->line, &job->column);
+}
+
+ParaVMError paravm_assemble_slices_parallel(const char *str, const ParaVMTokenSlice *slices, size_t count,
+                                            const ParaVMModule *mod, uint32_t threads,
+                                            uint32_t *line, uint32_t *column)
+{
+    assert(str);
+    assert(!count || slices);
+    assert(mod);
+    assert(line);
+    assert(column);
+
+    *line = 1;
+    *column = 0;
+
+    GArray *jobs = g_array_new(false, false, sizeof(FunctionJob));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Anything before the first `.fun` gets a job of its
+        // own so that it fails the same way it normally would.
+        if (i && slices[i].type != PARAVM_TOKEN_TYPE_FUN)
+            continue;
+
+        FunctionJob job = {
+            .str = str,
+            .slices = &slices[i],
+            .count = 0,
+            .func = null,
+            .result = PARAVM_ERROR_OK,
+        };
+
+        g_array_append_val(jobs, job);
+    }
+
+    for (size_t i = 0; i < jobs->len; i++)
+    {
+        FunctionJob *job = &g_array_index(jobs, FunctionJob, i);
+        const ParaVMTokenSlice *end = i + 1 < jobs->len ? g_array_index(jobs, FunctionJob, i + 1).slices :
+                                                          &slices[count];
+
+        job->count = (size_t)(end - job->slices);
+    }
+
+    if (!threads)
+        threads = g_get_num_processors();
+
+    if (threads > jobs->len)
+        threads = jobs->len;
+
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < jobs->len; i++)
+            assemble_job(&g_array_index(jobs, FunctionJob, i), null);
+    }
+    else
+    {
+        GThreadPool *pool = g_thread_pool_new(&assemble_job, null, (gint)threads, true, null);
+
+        for (size_t i = 0; i < jobs->len; i++)
+            g_thread_pool_push(pool, &g_array_index(jobs, FunctionJob, i), null);
+
+        g_thread_pool_free(pool, false, true);
+    }
+
+    // Merge the functions in source order, stopping at the
+    // first error just like the sequential assembler would.
+    ParaVMError result = PARAVM_ERROR_OK;
+
+    for (size_t i = 0; i < jobs->len; i++)
+    {
+        FunctionJob *job = &g_array_index(jobs, FunctionJob, i);
+
+        if (result != PARAVM_ERROR_OK)
+        {
+            paravm_destroy_function(job->func);
+            continue;
+        }
+
+        if (job->func && paravm_add_function(mod, job->func) != PARAVM_ERROR_OK)
+        {
+            paravm_destroy_function(job->func);
+
+            result = PARAVM_ERROR_ASSEMBLY;
+            *line = job->slices[0].line;
+            *column = job->slices[0].column;
+
+            continue;
         }
 
-        if (result == PARAVM_ERROR_OK)
+        if (job->result != PARAVM_ERROR_OK)
         {
-            *line = lline;
-            *column = lcolumn;
+            result = job->result;
+            *line = job->line;
+            *column = job->column;
         }
     }
 
-    g_hash_table_destroy(insns);
-    g_hash_table_destroy(handlers);
+    if (result == PARAVM_ERROR_OK && count)
+    {
+        *line = slices[count - 1].line;
+        *column = slices[count - 1].column;
+    }
+
+    g_array_free(jobs, true);
+
+    return result;
+}
+
+// Runs `run` with a token source that lexes from `lexer` on
+// demand, keeping one token of lookahead.
+static ParaVMError with_lexer(ParaVMLexer *lexer,
+                              ParaVMError (^ run)(bool (^ source_peek)(ParaVMTokenType *type),
+                                                  bool (^ source_next)(ParaVMToken *tok)),
+                              uint32_t *line, uint32_t *column)
+{
+    // Holds the token that has been lexed but not consumed yet,
+    // if any, so that it can be peeked at.
+    __block ParaVMToken ahead;
+    __block bool have_ahead = false;
+    __block ParaVMError lex_err = PARAVM_ERROR_OK;
+
+    bool (^ lex_ahead)(void) = ^ bool (void)
+    {
+        if (have_ahead || lex_err != PARAVM_ERROR_OK)
+            return have_ahead;
+
+        if ((lex_err = paravm_lex_token(lexer, &ahead)) == PARAVM_ERROR_OK)
+            have_ahead = ahead.value != null;
+
+        return have_ahead;
+    };
+
+    bool (^ peek_token)(ParaVMTokenType *) = ^ bool (ParaVMTokenType *type)
+    {
+        if (!lex_ahead())
+            return false;
+
+        *type = ahead.type;
+
+        return true;
+    };
+
+    bool (^ next_token)(ParaVMToken *) = ^ bool (ParaVMToken *tok)
+    {
+        if (!lex_ahead())
+            return false;
+
+        *tok = ahead;
+        have_ahead = false;
+
+        return true;
+    };
+
+    ParaVMError result = run(peek_token, next_token);
+
+    // The assembler just sees the end of the input if lexing
+    // failed, so report the actual problem.
+    if (lex_err != PARAVM_ERROR_OK)
+    {
+        *line = ahead.line;
+        *column = ahead.column;
+
+        return lex_err;
+    }
 
     return result;
 }
+
+ParaVMError paravm_assemble_stream(ParaVMLexer *lexer, const ParaVMModule *mod,
+                                   uint32_t *line, uint32_t *column)
+{
+    assert(lexer);
+    assert(mod);
+    assert(line);
+    assert(column);
+
+    bool (^ add_function)(const ParaVMFunction *) = ^ bool (const ParaVMFunction *func)
+    {
+        return paravm_add_function(mod, func) == PARAVM_ERROR_OK;
+    };
+
+    ParaVMError (^ run)(bool (^)(ParaVMTokenType *), bool (^)(ParaVMToken *)) =
+        ^ ParaVMError (bool (^ source_peek)(ParaVMTokenType *), bool (^ source_next)(ParaVMToken *))
+    {
+        return assemble(source_peek, source_next, add_function, line, column);
+    };
+
+    return with_lexer(lexer, run, line, column);
+}
+
+static void put_u8(GByteArray *out, uint8_t value)
+{
+    assert(out);
+
+    g_byte_array_append(out, &value, sizeof(uint8_t));
+}
+
+static void put_u32(GByteArray *out, uint32_t value)
+{
+    assert(out);
+
+    uint32_t nvalue = htole32(value);
+
+    g_byte_array_append(out, (const uint8_t *)&nvalue, sizeof(uint32_t));
+}
+
+static void put_str(GByteArray *out, const char *value)
+{
+    assert(out);
+    assert(value);
+
+    uint32_t len = (uint32_t)strlen(value);
+
+    put_u32(out, len);
+    g_byte_array_append(out, (const uint8_t *)value, len);
+}
+
+// The state of a basic block that is being translated. Its
+// instructions are encoded as they are assembled, since
+// registers are always declared before the first block.
+typedef struct
+{
+    const char *name;
+    const char *handler;
+    const char *exception;
+    uint32_t count;
+    GByteArray *code;
+} BlockCode;
+
+static void free_block_code(void *data)
+{
+    assert(data);
+
+    BlockCode *blk = data;
+
+    g_byte_array_free(blk->code, true);
+    g_free(blk);
+}
+
+// The state of a function that is being translated. Only
+// names are ever looked up, so these tables are all that is
+// needed in place of a `ParaVMFunction`.
+typedef struct
+{
+    const char *name;
+    uint32_t count; // The number of registers.
+    GByteArray *regs;
+    GHashTable *reg_table;
+    GPtrArray *blocks;
+    GHashTable *block_table;
+    GPtrArray *targets; // Block names referred to by instructions.
+    GStringChunk *names;
+} FunctionCode;
+
+static void reset_function_code(FunctionCode *fc)
+{
+    assert(fc);
+
+    fc->name = null;
+    fc->count = 0;
+
+    g_byte_array_set_size(fc->regs, 0);
+    g_hash_table_remove_all(fc->reg_table);
+    g_ptr_array_set_size(fc->blocks, 0);
+    g_hash_table_remove_all(fc->block_table);
+    g_ptr_array_set_size(fc->targets, 0);
+    g_string_chunk_clear(fc->names);
+}
+
+// Checks that all block names referred to in `fc` exist and
+// appends the encoded function to `out`. This is the same
+// check that `finish_function` does.
+static ParaVMError emit_function(const FunctionCode *fc, GByteArray *out)
+{
+    assert(fc);
+    assert(out);
+
+    for (uint32_t i = 0; i < fc->targets->len; i++)
+        if (!g_hash_table_lookup(fc->block_table, g_ptr_array_index(fc->targets, i)))
+            return PARAVM_ERROR_ASSEMBLY;
+
+    for (uint32_t i = 0; i < fc->blocks->len; i++)
+    {
+        const BlockCode *blk = g_ptr_array_index(fc->blocks, i);
+
+        if (blk->handler && !g_hash_table_lookup(fc->block_table, blk->handler))
+            return PARAVM_ERROR_ASSEMBLY;
+    }
+
+    put_str(out, fc->name);
+    put_u32(out, fc->count);
+    g_byte_array_append(out, fc->regs->data, fc->regs->len);
+    put_u32(out, fc->blocks->len);
+
+    for (uint32_t i = 0; i < fc->blocks->len; i++)
+        put_str(out, ((const BlockCode *)g_ptr_array_index(fc->blocks, i))->name);
+
+    for (uint32_t i = 0; i < fc->blocks->len; i++)
+    {
+        const BlockCode *blk = g_ptr_array_index(fc->blocks, i);
+
+        put_str(out, blk->name);
+        put_u8(out, !!blk->handler);
+
+        if (blk->handler)
+            put_str(out, blk->handler);
+
+        put_u8(out, !!blk->exception);
+
+        if (blk->exception)
+            put_str(out, blk->exception);
+
+        put_u32(out, blk->count);
+        g_byte_array_append(out, blk->code->data, blk->code->len);
+    }
+
+    return PARAVM_ERROR_OK;
+}
+
+// Translates the tokens produced by `source_next` straight
+// into the PVC format, appending the encoded functions to
+// `out` and their names to `func_table`. This mirrors
+// `assemble` statement for statement so that it accepts and
+// rejects exactly the same input at the same locations, and
+// produces what `paravm_write_module` would have written for
+// the resulting module.
+static ParaVMError translate(bool (^ source_peek)(ParaVMTokenType *type),
+                             bool (^ source_next)(ParaVMToken *tok),
+                             GHashTable *func_table, GByteArray *out,
+                             uint32_t *line, uint32_t *column)
+{
+    *line = 1;
+    *column = 0;
+
+    __block uint32_t lline = 1;
+    __block uint32_t lcolumn = 0;
+
+    bool (^ next_token)(ParaVMToken *) = ^ bool (ParaVMToken *tok)
+    {
+        if (!source_next(tok))
+            return false;
+
+        lline = tok->line;
+        lcolumn = tok->column;
+
+        return true;
+    };
+
+    FunctionCode fc = {
+        .regs = g_byte_array_new(),
+        .reg_table = g_hash_table_new(&g_str_hash, &g_str_equal),
+        .blocks = g_ptr_array_new_with_free_func(&free_block_code),
+        .block_table = g_hash_table_new(&g_str_hash, &g_str_equal),
+        .targets = g_ptr_array_new(),
+        .names = g_string_chunk_new(4096),
+    };
+
+    reset_function_code(&fc);
+
+    uint32_t func_line = 0;
+    uint32_t func_column = 0;
+    BlockCode *block = null;
+    bool have_regs = false;
+    bool have_insns = false;
+
+    ParaVMError result = PARAVM_ERROR_OK;
+    ParaVMToken t;
+
+    while (next_token(&t))
+    {
+        switch (t.type)
+        {
+            case PARAVM_TOKEN_TYPE_FUN:
+            {
+                if (fc.name)
+                {
+                    result = emit_function(&fc, out);
+
+                    reset_function_code(&fc);
+
+                    if (result != PARAVM_ERROR_OK)
+                    {
+                        t.line = func_line;
+                        t.column = func_column;
+
+                        break;
+                    }
+                }
+
+                NEXT_TOKEN(name, STRING);
+
+                func_line = t.line;
+                func_column = t.column;
+                block = null;
+                have_regs = false;
+
+                if (g_hash_table_lookup(func_table, name.value))
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                g_hash_table_insert(func_table, g_strdup(name.value), func_table);
+                fc.name = g_string_chunk_insert(fc.names, name.value);
+
+                break;
+            }
+            case PARAVM_TOKEN_TYPE_ARG:
+            case PARAVM_TOKEN_TYPE_REG:
+            {
+                bool arg = t.type == PARAVM_TOKEN_TYPE_ARG;
+
+                if (!fc.name || (arg && have_regs) || block)
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                NEXT_TOKEN(name, STRING);
+
+                // Arguments always precede other registers, so
+                // one table covers both kinds of clashes.
+                if (g_hash_table_lookup(fc.reg_table, name.value))
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                if (!arg)
+                    have_regs = true;
+
+                const char *reg = g_string_chunk_insert(fc.names, name.value);
+
+                g_hash_table_insert(fc.reg_table, (char *)reg, (char *)reg);
+                put_str(fc.regs, reg);
+                put_u8(fc.regs, arg);
+                fc.count++;
+
+                break;
+            }
+            case PARAVM_TOKEN_TYPE_BLK:
+            {
+                if (!fc.name)
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                NEXT_TOKEN(name, STRING);
+
+                if (g_hash_table_lookup(fc.block_table, name.value))
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                block = g_new0(BlockCode, 1);
+                block->name = g_string_chunk_insert(fc.names, name.value);
+                block->code = g_byte_array_new();
+                have_insns = false;
+
+                g_ptr_array_add(fc.blocks, block);
+                g_hash_table_insert(fc.block_table, (char *)block->name, block);
+
+                break;
+            }
+            case PARAVM_TOKEN_TYPE_UNW:
+            {
+                if (!block || have_insns)
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                NEXT_TOKEN(name, STRING);
+
+                const char *handler = g_string_chunk_insert(fc.names, name.value);
+
+                NEXT_TOKEN(reg_name, STRING);
+
+                const char *reg = g_hash_table_lookup(fc.reg_table, reg_name.value);
+
+                if (!reg || block->exception)
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                block->handler = handler;
+                block->exception = reg;
+
+                break;
+            }
+            case PARAVM_TOKEN_TYPE_OPCODE:
+            {
+                if (!block)
+                {
+                    result = PARAVM_ERROR_ASSEMBLY;
+                    break;
+                }
+
+                const ParaVMOpCode *opc = paravm_get_opcode_by_name(t.value);
+                have_insns = true;
+
+                GByteArray *code = block->code;
+                uint32_t code_start = code->len;
+                uint32_t reg_count = 0;
+
+                put_u8(code, opc->code);
+                put_u32(code, 0);
+
+                ParaVMTokenType next_type;
+
+                while (source_peek(&next_type) && next_type == PARAVM_TOKEN_TYPE_STRING)
+                {
+                    NEXT_TOKEN(reg_tok, STRING);
+
+                    if (!g_hash_table_lookup(fc.reg_table, reg_tok.value))
+                    {
+                        result = PARAVM_ERROR_ASSEMBLY;
+                        break;
+                    }
+
+                    put_str(code, reg_tok.value);
+                    reg_count++;
+                }
+
+                if (reg_count < opc->registers)
+                    result = PARAVM_ERROR_ASSEMBLY;
+
+                if (result != PARAVM_ERROR_OK)
+                    break;
+
+                uint32_t nreg_count = htole32(reg_count);
+
+                memcpy(code->data + code_start + sizeof(uint8_t), &nreg_count, sizeof(uint32_t));
+
+                if (opc->operand != PARAVM_OPERAND_TYPE_NONE)
+                {
+                    NEXT_TOKEN(lpar, PAREN_OPEN);
+
+                    switch (opc->operand)
+                    {
+                        case PARAVM_OPERAND_TYPE_INTEGER:
+                        {
+                            NEXT_TOKEN(oper, INTEGER);
+                            put_str(code, oper.value);
+
+                            break;
+                        }
+                        case PARAVM_OPERAND_TYPE_FLOAT:
+                        {
+                            NEXT_TOKEN(oper, FLOAT);
+                            put_str(code, oper.value);
+
+                            break;
+                        }
+                        case PARAVM_OPERAND_TYPE_ATOM:
+                        {
+                            NEXT_TOKEN(oper, ATOM);
+                            put_str(code, oper.value);
+
+                            break;
+                        }
+                        case PARAVM_OPERAND_TYPE_BINARY:
+                        {
+                            NEXT_TOKEN(oper, BINARY);
+                            put_str(code, oper.value);
+
+                            break;
+                        }
+                        case PARAVM_OPERAND_TYPE_BLOCK:
+                        {
+                            NEXT_TOKEN(oper, STRING);
+                            put_str(code, oper.value);
+                            g_ptr_array_add(fc.targets, g_string_chunk_insert(fc.names, oper.value));
+
+                            break;
+                        }
+                        case PARAVM_OPERAND_TYPE_BLOCKS:
+                        {
+                            NEXT_TOKEN(oper1, STRING);
+                            put_str(code, oper1.value);
+                            g_ptr_array_add(fc.targets, g_string_chunk_insert(fc.names, oper1.value));
+
+                            NEXT_TOKEN(oper2, STRING);
+                            put_str(code, oper2.value);
+                            g_ptr_array_add(fc.targets, g_string_chunk_insert(fc.names, oper2.value));
+
+                            break;
+                        }
+                        default:
+                            assert_unreachable();
+                            break;
+                    }
+
+                    NEXT_TOKEN(rpar, PAREN_CLOSE);
+                }
+
+                block->count++;
+
+                break;
+            }
+            default:
+                result = PARAVM_ERROR_SYNTAX;
+                break;
+        }
+
+        if (result != PARAVM_ERROR_OK)
+        {
+            *line = t.line;
+            *column = t.column;
+
+            break;
+        }
+    }
+
+    if (result == PARAVM_ERROR_OK && fc.name && (result = emit_function(&fc, out)) != PARAVM_ERROR_OK)
+    {
+        *line = func_line;
+        *column = func_column;
+    }
+
+    if (result == PARAVM_ERROR_OK)
+    {
+        *line = lline;
+        *column = lcolumn;
+    }
+
+    g_byte_array_free(fc.regs, true);
+    g_hash_table_destroy(fc.reg_table);
+    g_ptr_array_free(fc.blocks, true);
+    g_hash_table_destroy(fc.block_table);
+    g_ptr_array_free(fc.targets, true);
+    g_string_chunk_free(fc.names);
+
+    return result;
+}
+
+// Writes a PVC header for `count` functions to `out`.
+static void put_header(GByteArray *out, uint32_t count)
+{
+    assert(out);
+
+    put_u32(out, paravm_fourcc);
+    put_u32(out, paravm_version);
+    put_u32(out, count);
+}
+
+ParaVMError paravm_translate_stream(ParaVMLexer *lexer, void **data, size_t *size,
+                                    uint32_t *line, uint32_t *column)
+{
+    assert(lexer);
+    assert(data);
+    assert(size);
+    assert(line);
+    assert(column);
+
+    GByteArray *out = g_byte_array_new();
+    GHashTable *func_table = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, null);
+
+    // The function count is filled in at the end.
+    put_header(out, 0);
+
+    ParaVMError (^ run)(bool (^)(ParaVMTokenType *), bool (^)(ParaVMToken *)) =
+        ^ ParaVMError (bool (^ source_peek)(ParaVMTokenType *), bool (^ source_next)(ParaVMToken *))
+    {
+        return translate(source_peek, source_next, func_table, out, line, column);
+    };
+
+    ParaVMError result = with_lexer(lexer, run, line, column);
+    uint32_t count = g_hash_table_size(func_table);
+
+    g_hash_table_destroy(func_table);
+
+    if (result != PARAVM_ERROR_OK)
+    {
+        g_byte_array_free(out, true);
+
+        *data = null;
+        *size = 0;
+
+        return result;
+    }
+
+    uint32_t ncount = htole32(count);
+
+    memcpy(out->data + sizeof(uint32_t) * 2, &ncount, sizeof(uint32_t));
+
+    *size = out->len;
+    *data = g_byte_array_free(out, false);
+
+    return PARAVM_ERROR_OK;
+}
+
+static const uint32_t cache_fourcc = 0x41565000;
+
+#define DIGEST_SIZE 32
+
+// A translated section of source code. `line` and `column`
+// give the location of its last token relative to the start
+// of the section, with a column of `0` meaning that it has
+// no tokens at all.
+typedef struct
+{
+    uint8_t digest[DIGEST_SIZE];
+    uint32_t line;
+    uint32_t column;
+    char **names;
+    GByteArray *code;
+    bool used;
+} SectionCode;
+
+static void free_section_code(void *data)
+{
+    assert(data);
+
+    SectionCode *sec = data;
+
+    g_strfreev(sec->names);
+    g_byte_array_free(sec->code, true);
+    g_free(sec);
+}
+
+// Digests are uniformly distributed, so any part of them
+// makes for a good hash.
+static guint digest_hash(const void *key)
+{
+    assert(key);
+
+    uint32_t hash;
+
+    memcpy(&hash, key, sizeof(uint32_t));
+
+    return hash;
+}
+
+static gboolean digest_equal(const void *a, const void *b)
+{
+    assert(a);
+    assert(b);
+
+    return !memcmp(a, b, DIGEST_SIZE);
+}
+
+ParaVMAssemblyCache *paravm_create_assembly_cache(void)
+{
+    ParaVMAssemblyCache *cache = g_new(ParaVMAssemblyCache, 1);
+
+    cache->sections = g_hash_table_new_full(&digest_hash, &digest_equal, null, &free_section_code);
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+void paravm_destroy_assembly_cache(ParaVMAssemblyCache *cache)
+{
+    if (cache)
+        g_hash_table_destroy(cache->sections);
+
+    g_free(cache);
+}
+
+static bool take_u32(const uint8_t **pos, const uint8_t *end, uint32_t *value)
+{
+    assert(pos);
+    assert(value);
+
+    if ((size_t)(end - *pos) < sizeof(uint32_t))
+        return false;
+
+    memcpy(value, *pos, sizeof(uint32_t));
+    *value = le32toh(*value);
+    *pos += sizeof(uint32_t);
+
+    return true;
+}
+
+static bool take_bytes(const uint8_t **pos, const uint8_t *end, size_t size, const uint8_t **bytes)
+{
+    assert(pos);
+    assert(bytes);
+
+    if ((size_t)(end - *pos) < size)
+        return false;
+
+    *bytes = *pos;
+    *pos += size;
+
+    return true;
+}
+
+// Parses the sections in `data` into `sections`. Returns
+// `false` if the data is truncated or otherwise corrupt.
+static bool parse_sections(const uint8_t *data, const uint8_t *end, uint32_t count, GPtrArray *sections)
+{
+    assert(data);
+    assert(end);
+    assert(sections);
+
+    const uint8_t *pos = data;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        SectionCode *sec = g_new0(SectionCode, 1);
+
+        sec->code = g_byte_array_new();
+        g_ptr_array_add(sections, sec);
+
+        const uint8_t *digest;
+        uint32_t name_count;
+
+        if (!take_bytes(&pos, end, DIGEST_SIZE, &digest) ||
+            !take_u32(&pos, end, &sec->line) ||
+            !take_u32(&pos, end, &sec->column) ||
+            !take_u32(&pos, end, &name_count) ||
+            name_count > (size_t)(end - pos) / sizeof(uint32_t))
+            return false;
+
+        memcpy(sec->digest, digest, DIGEST_SIZE);
+        sec->names = g_new0(char *, name_count + 1);
+
+        for (uint32_t j = 0; j < name_count; j++)
+        {
+            uint32_t len;
+            const uint8_t *name;
+
+            if (!take_u32(&pos, end, &len) || !take_bytes(&pos, end, len, &name))
+                return false;
+
+            sec->names[j] = g_strndup((const char *)name, len);
+        }
+
+        uint32_t size;
+        const uint8_t *code;
+
+        if (!take_u32(&pos, end, &size) || !take_bytes(&pos, end, size, &code))
+            return false;
+
+        g_byte_array_append(sec->code, code, size);
+    }
+
+    return pos == end;
+}
+
+ParaVMError paravm_load_assembly_cache(ParaVMAssemblyCache *cache, const char *path)
+{
+    assert(cache);
+    assert(path);
+
+    void *data;
+    size_t size;
+    ParaVMError err = paravm_read_image(path, &data, &size);
+
+    if (err != PARAVM_ERROR_OK)
+        return err;
+
+    const uint8_t *pos = data;
+    const uint8_t *end = pos + size;
+    uint32_t fourcc;
+    uint32_t version;
+    uint32_t count;
+
+    if (!take_u32(&pos, end, &fourcc) || fourcc != cache_fourcc)
+        err = PARAVM_ERROR_FOURCC;
+    else if (!take_u32(&pos, end, &version) || version != paravm_version)
+        err = PARAVM_ERROR_VERSION;
+    else if (!take_u32(&pos, end, &count))
+        err = PARAVM_ERROR_MALFORMED;
+
+    if (err == PARAVM_ERROR_OK)
+    {
+        GPtrArray *sections = g_ptr_array_new_with_free_func(&free_section_code);
+
+        if (parse_sections(pos, end, count, sections))
+        {
+            // Ownership moves to the cache.
+            for (guint i = 0; i < sections->len; i++)
+            {
+                SectionCode *sec = g_ptr_array_index(sections, i);
+
+                g_hash_table_replace(cache->sections, sec->digest, sec);
+            }
+
+            g_free(g_ptr_array_free(sections, false));
+        }
+        else
+        {
+            g_ptr_array_free(sections, true);
+
+            err = PARAVM_ERROR_MALFORMED;
+        }
+    }
+
+    g_free(data);
+
+    return err;
+}
+
+ParaVMError paravm_save_assembly_cache(const ParaVMAssemblyCache *cache, const char *path)
+{
+    assert(cache);
+    assert(path);
+
+    GByteArray *out = g_byte_array_new();
+
+    put_u32(out, cache_fourcc);
+    put_u32(out, paravm_version);
+    put_u32(out, g_hash_table_size(cache->sections));
+
+    GHashTableIter iter;
+    g_hash_table_iter_init(&iter, cache->sections);
+
+    SectionCode *sec;
+
+    while (g_hash_table_iter_next(&iter, null, (gpointer *)&sec))
+    {
+        g_byte_array_append(out, sec->digest, DIGEST_SIZE);
+        put_u32(out, sec->line);
+        put_u32(out, sec->column);
+        put_u32(out, g_strv_length(sec->names));
+
+        for (char **name = sec->names; *name; name++)
+            put_str(out, *name);
+
+        put_u32(out, sec->code->len);
+        g_byte_array_append(out, sec->code->data, sec->code->len);
+    }
+
+    ParaVMError err = paravm_write_image(out->data, out->len, path);
+
+    g_byte_array_free(out, true);
+
+    return err;
+}
+
+// Finds the start of the next section after `str`, which is
+// the next line whose first token is `.fun`, and advances
+// `*line` past the lines in between. Tokens never span
+// lines, so this is always a token boundary.
+static const char *next_section(const char *str, uint32_t *line)
+{
+    assert(str);
+    assert(line);
+
+    for (const char *p = str; *p; p++)
+    {
+        if (*p != '\n')
+            continue;
+
+        (*line)++;
+
+        const char *start = p + 1;
+        const char *tok = start;
+
+        while (*tok == ' ' || *tok == '\t')
+            tok++;
+
+        // The directive has to end where the lexer would end
+        // the word.
+        if (!strncmp(tok, ".fun", 4) && tok[4] != '.' &&
+            !g_unichar_isalpha(g_utf8_get_char_validated(tok + 4, -1)))
+            return start;
+    }
+
+    return null;
+}
+
+// Translates the `len` bytes at `str` as a section of their
+// own. Returns `null` if that fails.
+static SectionCode *translate_section(const char *str, size_t len, const uint8_t *digest)
+{
+    assert(str);
+    assert(digest);
+
+    char *text = g_strndup(str, len);
+    ParaVMLexer *lexer = paravm_create_lexer(text);
+    GHashTable *func_table = g_hash_table_new(&g_str_hash, &g_str_equal);
+    GByteArray *code = g_byte_array_new();
+    uint32_t line;
+    uint32_t column;
+
+    ParaVMError (^ run)(bool (^)(ParaVMTokenType *), bool (^)(ParaVMToken *)) =
+        ^ ParaVMError (bool (^ source_peek)(ParaVMTokenType *), bool (^ source_next)(ParaVMToken *))
+    {
+        return translate(source_peek, source_next, func_table, code, &line, &column);
+    };
+
+    ParaVMError err = with_lexer(lexer, run, &line, &column);
+    GPtrArray *names = g_ptr_array_sized_new(g_hash_table_size(func_table) + 1);
+
+    GHashTableIter iter;
+    g_hash_table_iter_init(&iter, func_table);
+
+    char *name;
+
+    while (g_hash_table_iter_next(&iter, (gpointer *)&name, null))
+        g_ptr_array_add(names, name);
+
+    g_ptr_array_add(names, null);
+    g_hash_table_destroy(func_table);
+
+    SectionCode *sec = null;
+
+    if (err == PARAVM_ERROR_OK)
+    {
+        sec = g_new0(SectionCode, 1);
+
+        memcpy(sec->digest, digest, DIGEST_SIZE);
+        sec->line = line;
+        sec->column = column;
+        sec->names = (char **)g_ptr_array_free(names, false);
+        sec->code = code;
+    }
+    else
+    {
+        g_strfreev((char **)g_ptr_array_free(names, false));
+        g_byte_array_free(code, true);
+    }
+
+    paravm_destroy_lexer(lexer);
+    g_free(text);
+
+    return sec;
+}
+
+static void reset_used(var_unused void *key, void *value, var_unused void *user_data)
+{
+    assert(value);
+
+    ((SectionCode *)value)->used = false;
+}
+
+static gboolean remove_unused(var_unused void *key, void *value, var_unused void *user_data)
+{
+    assert(value);
+
+    SectionCode *sec = value;
+
+    if (!sec->used)
+        return true;
+
+    sec->used = false;
+
+    return false;
+}
+
+ParaVMError paravm_translate_incremental(const char *str, ParaVMAssemblyCache *cache,
+                                         void **data, size_t *size,
+                                         uint32_t *line, uint32_t *column)
+{
+    assert(str);
+    assert(cache);
+    assert(data);
+    assert(size);
+    assert(line);
+    assert(column);
+
+    cache->hits = 0;
+    cache->misses = 0;
+
+    GByteArray *out = g_byte_array_new();
+    GHashTable *func_table = g_hash_table_new(&g_str_hash, &g_str_equal);
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+    // The function count is filled in at the end.
+    put_header(out, 0);
+
+    *line = 1;
+    *column = 0;
+
+    bool ok = true;
+    uint32_t sec_line = 1;
+
+    for (const char *start = str; start && ok; )
+    {
+        uint32_t next_line = sec_line;
+        const char *end = next_section(start, &next_line);
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+
+        uint8_t digest[DIGEST_SIZE];
+        gsize digest_len = DIGEST_SIZE;
+
+        g_checksum_reset(checksum);
+        g_checksum_update(checksum, (const guchar *)start, (gssize)len);
+        g_checksum_get_digest(checksum, digest, &digest_len);
+
+        SectionCode *sec = g_hash_table_lookup(cache->sections, digest);
+
+        if (sec)
+            cache->hits++;
+        else if ((sec = translate_section(start, len, digest)))
+        {
+            g_hash_table_replace(cache->sections, sec->digest, sec);
+            cache->misses++;
+        }
+
+        if (!sec)
+        {
+            ok = false;
+            break;
+        }
+
+        // A function defined in another section as well.
+        for (char **name = sec->names; *name && ok; name++)
+        {
+            if (g_hash_table_lookup(func_table, *name))
+                ok = false;
+            else
+                g_hash_table_insert(func_table, *name, *name);
+        }
+
+        sec->used = true;
+        g_byte_array_append(out, sec->code->data, sec->code->len);
+
+        if (sec->column)
+        {
+            *line = sec_line + sec->line - 1;
+            *column = sec->column;
+        }
+
+        start = end;
+        sec_line = next_line;
+    }
+
+    uint32_t count = g_hash_table_size(func_table);
+
+    g_checksum_free(checksum);
+    g_hash_table_destroy(func_table);
+
+    if (!ok)
+    {
+        g_hash_table_foreach(cache->sections, &reset_used, null);
+        g_byte_array_free(out, true);
+
+        // Let the regular path find and report the error.
+        ParaVMLexer *lexer = paravm_create_lexer(str);
+        ParaVMError err = paravm_translate_stream(lexer, data, size, line, column);
+
+        paravm_destroy_lexer(lexer);
+
+        return err;
+    }
+
+    g_hash_table_foreach_remove(cache->sections, &remove_unused, null);
+
+    uint32_t ncount = htole32(count);
+
+    memcpy(out->data + sizeof(uint32_t) * 2, &ncount, sizeof(uint32_t));
+
+    *size = out->len;
+    *data = g_byte_array_free(out, false);
+
+    return PARAVM_ERROR_OK;
+}
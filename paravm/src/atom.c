@@ -1,29 +1,503 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <glib.h>
 
+#include "internal/atomic.h"
+#include "internal/hash.h"
+#include "internal/reserved.h"
+#include "internal/syserror.h"
+
 #include "atom.h"
 
-static void str_free(void *str)
+// Number of entries in each thread's lookup cache. Must be a
+// power of two.
+#define CACHE_SIZE 256
+
+// Longest string (excluding the null terminator) that fits
+// in a cache entry. Longer strings always go to the table.
+#define CACHE_KEY_SIZE 35
+
+// Number of lookups a thread performs before publishing its
+// hit and miss counts to the table.
+#define CACHE_FLUSH_INTERVAL 1024
+
+// Size of each string arena chunk. Strings larger than a
+// quarter of this get a chunk of their own.
+#define ARENA_CHUNK_SIZE 16384
+
+// Initial number of slots in the hash index. Must be a power
+// of two.
+#define INDEX_INITIAL_CAPACITY 64
+
+// Index slot value marking an erased entry.
+#define INDEX_TOMBSTONE UINT32_MAX
+
+// Identifies atom table snapshot files ("\0PAT" on disk).
+#define SNAPSHOT_FOURCC 0x54415000
+
+// Current version of the snapshot format.
+#define SNAPSHOT_VERSION 1
+
+// Number of 32-bit words in a snapshot header: FourCC,
+// version, reserved atom count, ID count, live atom count,
+// index capacity, and string data size.
+#define SNAPSHOT_HEADER_WORDS 7
+
+typedef struct
+{
+    size_t size; // Size of `data`.
+    size_t live; // Number of live strings stored in `data`.
+    char data[];
+} ArenaChunk;
+
+typedef struct
+{
+    GPtrArray *chunks; // Freed chunks are left as `NULL` entries.
+    GArray *free_slots; // Indexes of the `NULL` entries in `chunks`.
+    uint32_t current; // Index of the chunk being filled, or `UINT32_MAX`.
+    char *cursor;
+    size_t remaining;
+    size_t bytes; // Total size of all chunks.
+} AtomArena;
+
+typedef struct
+{
+    uint32_t chunk; // Arena chunk holding the string.
+    uint32_t refs; // Number of outstanding references.
+    uint32_t epoch; // Sweep epoch in which the atom was last looked up.
+} AtomInfo;
+
+typedef struct
+{
+    GThread *thread;
+    GMutex mutex;
+    GCond cond;
+    bool stop;
+    int64_t interval; // In microseconds.
+    ParaVMAtomTable *table;
+} AtomSweeper;
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t entry; // The string vector index plus one; 0 if the slot is empty.
+} IndexSlot;
+
+typedef struct
+{
+    IndexSlot *slots;
+    size_t capacity;
+    size_t used; // Number of live entries.
+    size_t tombstones;
+} AtomIndex;
+
+// A snapshot mapped into memory. All words are stored in
+// little endian. The strings of IDs with equal consecutive
+// offsets are holes left by erased atoms.
+typedef struct
+{
+    void *map;
+    size_t size;
+    uint32_t count; // Number of IDs, including holes.
+    uint32_t live;
+    uint32_t index_mask;
+    const uint32_t *offsets; // `count + 1` offsets into `strings`.
+    const IndexSlot *index; // Never contains tombstones.
+    const char *strings;
+} AtomBase;
+
+typedef struct
+{
+    uint64_t generation; // Generation of the table the entry belongs to; 0 if empty.
+    size_t atom;
+    uint32_t hash;
+    uint32_t length;
+    uint32_t epoch; // Sweep epoch in which the atom was last stamped through this entry.
+    char key[CACHE_KEY_SIZE + 1];
+} CacheEntry;
+
+typedef struct
+{
+    CacheEntry entries[CACHE_SIZE];
+
+    uint64_t stats_serial; // Serial number of the table that the pending counts belong to; 0 if none.
+    uint64_t pending_hits;
+    uint64_t pending_misses;
+} AtomCache;
+
+// Every table gets a globally unique serial number, and every
+// erasure or clearing of a table gives it a new, globally unique
+// generation. Cache entries are tagged with the generation they
+// were filled under, which both separates tables from each other
+// and invalidates stale entries.
+static uint64_t next_serial = 1;
+
+// Maps the serial numbers of live tables to the tables, so
+// that pending counts can be published to a table that a
+// thread stopped using without it having to outlive the
+// thread.
+static GMutex live_tables_mutex;
+static GHashTable *live_tables;
+
+static thread_local AtomCache *atom_cache;
+
+static void flush_cache_stats(AtomCache *cache)
+{
+    assert(cache);
+
+    if (cache->stats_serial && (cache->pending_hits || cache->pending_misses))
+    {
+        g_mutex_lock(&live_tables_mutex);
+
+        ParaVMAtomTable *tab = live_tables ? g_hash_table_lookup(live_tables, &cache->stats_serial) : null;
+
+        // The counts of a table that is gone are dropped.
+        if (tab)
+        {
+            atomic_add_fetch(&tab->cache_hits, cache->pending_hits);
+            atomic_add_fetch(&tab->cache_misses, cache->pending_misses);
+        }
+
+        g_mutex_unlock(&live_tables_mutex);
+    }
+
+    cache->pending_hits = 0;
+    cache->pending_misses = 0;
+}
+
+static void free_atom_cache(void *cache)
+{
+    flush_cache_stats(cache);
+    g_free(cache);
+}
+
+static GPrivate atom_cache_private = G_PRIVATE_INIT(&free_atom_cache);
+
+static AtomCache *get_atom_cache(void)
+{
+    AtomCache *cache = atom_cache;
+
+    if (expect(!!cache))
+        return cache;
+
+    cache = g_new0(AtomCache, 1);
+
+    // Registering the cache with GLib ensures that it is freed
+    // when the thread exits.
+    g_private_set(&atom_cache_private, cache);
+    atom_cache = cache;
+
+    return cache;
+}
+
+static void count_lookup(AtomCache *cache, const ParaVMAtomTable *table, bool hit)
 {
-    g_free(str);
+    assert(cache);
+    assert(table);
+
+    // If the thread switched tables, publish the counts for the
+    // previous one before counting for the new one.
+    if (cache->stats_serial != table->serial)
+    {
+        flush_cache_stats(cache);
+
+        cache->stats_serial = table->serial;
+    }
+
+    if (hit)
+        cache->pending_hits++;
+    else
+        cache->pending_misses++;
+
+    if (cache->pending_hits + cache->pending_misses >= CACHE_FLUSH_INTERVAL)
+        flush_cache_stats(cache);
 }
 
-static void int64_free(void *val)
+static void new_generation(ParaVMAtomTable *table)
 {
-    g_free(val);
+    assert(table);
+
+    atomic_store(&table->generation, atomic_fetch_add(&next_serial, 1));
+}
+
+static AtomArena *create_arena(void)
+{
+    AtomArena *arena = g_new(AtomArena, 1);
+
+    arena->chunks = g_ptr_array_new_with_free_func(&g_free);
+    arena->free_slots = g_array_new(false, false, sizeof(uint32_t));
+    arena->current = UINT32_MAX;
+    arena->cursor = null;
+    arena->remaining = 0;
+    arena->bytes = 0;
+
+    return arena;
+}
+
+static void destroy_arena(AtomArena *arena)
+{
+    assert(arena);
+
+    g_ptr_array_free(arena->chunks, true);
+    g_array_free(arena->free_slots, true);
+    g_free(arena);
+}
+
+static void arena_free_chunk(AtomArena *arena, uint32_t index)
+{
+    assert(arena);
+
+    ArenaChunk *chunk = g_ptr_array_index(arena->chunks, index);
+
+    arena->bytes -= chunk->size;
+
+    g_free(chunk);
+    g_ptr_array_index(arena->chunks, index) = null;
+    g_array_append_val(arena->free_slots, index);
+}
+
+static uint32_t arena_new_chunk(AtomArena *arena, size_t size)
+{
+    assert(arena);
+
+    ArenaChunk *chunk = g_malloc(sizeof(ArenaChunk) + size);
+
+    chunk->size = size;
+    chunk->live = 0;
+
+    arena->bytes += size;
+
+    GArray *free_slots = arena->free_slots;
+
+    // Reuse slots of freed chunks so that `chunks` does not
+    // keep growing as atoms come and go.
+    if (free_slots->len)
+    {
+        uint32_t index = g_array_index(free_slots, uint32_t, free_slots->len - 1);
+
+        g_array_set_size(free_slots, free_slots->len - 1);
+        g_ptr_array_index(arena->chunks, index) = chunk;
+
+        return index;
+    }
+
+    g_ptr_array_add(arena->chunks, chunk);
+
+    return arena->chunks->len - 1;
+}
+
+static const char *arena_copy(AtomArena *arena, const char *str, size_t length, uint32_t *chunk_index)
+{
+    assert(arena);
+    assert(str);
+    assert(chunk_index);
+
+    size_t size = length + 1;
+    char *dst;
+
+    if (size > ARENA_CHUNK_SIZE / 4)
+    {
+        // Big strings get a dedicated chunk so that they do not
+        // waste the rest of the current one.
+        *chunk_index = arena_new_chunk(arena, size);
+        dst = ((ArenaChunk *)g_ptr_array_index(arena->chunks, *chunk_index))->data;
+    }
+    else
+    {
+        if (size > arena->remaining)
+        {
+            uint32_t old = arena->current;
+
+            arena->current = arena_new_chunk(arena, ARENA_CHUNK_SIZE);
+            arena->cursor = ((ArenaChunk *)g_ptr_array_index(arena->chunks, arena->current))->data;
+            arena->remaining = ARENA_CHUNK_SIZE;
+
+            // The previous chunk was kept alive only because it
+            // was being filled.
+            if (old != UINT32_MAX && !((ArenaChunk *)g_ptr_array_index(arena->chunks, old))->live)
+                arena_free_chunk(arena, old);
+        }
+
+        *chunk_index = arena->current;
+        dst = arena->cursor;
+
+        arena->cursor += size;
+        arena->remaining -= size;
+    }
+
+    ((ArenaChunk *)g_ptr_array_index(arena->chunks, *chunk_index))->live++;
+
+    memcpy(dst, str, size);
+
+    return dst;
+}
+
+static void arena_release(AtomArena *arena, uint32_t index)
+{
+    assert(arena);
+
+    ArenaChunk *chunk = g_ptr_array_index(arena->chunks, index);
+
+    assert(chunk);
+    assert(chunk->live);
+
+    if (!--chunk->live && index != arena->current)
+        arena_free_chunk(arena, index);
+}
+
+static void clear_arena(AtomArena *arena)
+{
+    assert(arena);
+
+    g_ptr_array_set_size(arena->chunks, 0);
+    g_array_set_size(arena->free_slots, 0);
+
+    arena->current = UINT32_MAX;
+    arena->cursor = null;
+    arena->remaining = 0;
+    arena->bytes = 0;
+}
+
+static AtomIndex *create_index(void)
+{
+    AtomIndex *index = g_new(AtomIndex, 1);
+
+    index->slots = g_new0(IndexSlot, INDEX_INITIAL_CAPACITY);
+    index->capacity = INDEX_INITIAL_CAPACITY;
+    index->used = 0;
+    index->tombstones = 0;
+
+    return index;
+}
+
+static void destroy_index(AtomIndex *index)
+{
+    assert(index);
+
+    g_free(index->slots);
+    g_free(index);
+}
+
+static void clear_index(AtomIndex *index)
+{
+    assert(index);
+
+    memset(index->slots, 0, sizeof(IndexSlot) * index->capacity);
+
+    index->used = 0;
+    index->tombstones = 0;
+}
+
+// Finds the slot holding `str`, or `NULL` if it isn't indexed.
+static IndexSlot *index_find(const AtomIndex *index, const GArray *strings, const char *str, uint32_t hash)
+{
+    assert(index);
+    assert(strings);
+    assert(str);
+
+    size_t mask = index->capacity - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask)
+    {
+        IndexSlot *slot = &index->slots[i];
+
+        if (!slot->entry)
+            return null;
+
+        if (slot->entry != INDEX_TOMBSTONE &&
+            slot->hash == hash &&
+            !strcmp(g_array_index(strings, const char *, slot->entry - 1), str))
+            return slot;
+    }
+}
+
+static void index_place(AtomIndex *index, uint32_t hash, uint32_t entry)
+{
+    assert(index);
+
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+
+    // Reuse the first tombstone or empty slot in the probe sequence.
+    while (index->slots[i].entry && index->slots[i].entry != INDEX_TOMBSTONE)
+        i = (i + 1) & mask;
+
+    if (index->slots[i].entry == INDEX_TOMBSTONE)
+        index->tombstones--;
+
+    index->slots[i].hash = hash;
+    index->slots[i].entry = entry + 1;
+    index->used++;
+}
+
+static void index_insert(AtomIndex *index, uint32_t hash, uint32_t entry)
+{
+    assert(index);
+
+    // Keep the load factor (counting tombstones) below 3/4.
+    if ((index->used + index->tombstones + 1) * 4 > index->capacity * 3)
+    {
+        IndexSlot *old = index->slots;
+        size_t old_cap = index->capacity;
+
+        // Only grow if live entries warrant it; otherwise, the
+        // rehash just gets rid of the tombstones.
+        size_t cap = (index->used + 1) * 2 > old_cap ? old_cap * 2 : old_cap;
+
+        index->slots = g_new0(IndexSlot, cap);
+        index->capacity = cap;
+        index->used = 0;
+        index->tombstones = 0;
+
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].entry && old[i].entry != INDEX_TOMBSTONE)
+                index_place(index, old[i].hash, old[i].entry - 1);
+
+        g_free(old);
+    }
+
+    index_place(index, hash, entry);
 }
 
 ParaVMAtomTable *paravm_create_atom_table(void)
 {
     ParaVMAtomTable *tab = g_new(ParaVMAtomTable, 1);
 
-    tab->str_to_atom = g_hash_table_new_full(&g_str_hash, &g_str_equal, &str_free, &int64_free);
-    tab->atom_to_str = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &int64_free, &str_free);
-
     tab->rw_lock = g_new(GRWLock, 1);
     g_rw_lock_init(tab->rw_lock);
 
-    tab->next_id = 0;
-    tab->reuse_queue = g_queue_new();
+    tab->arena = create_arena();
+    tab->strings = g_array_new(false, false, sizeof(const char *));
+    tab->infos = g_array_new(false, false, sizeof(AtomInfo));
+    tab->index = create_index();
+    tab->free_ids = g_array_new(false, false, sizeof(uint32_t));
+    tab->sweeper = null;
+    tab->base = null;
+    tab->first_dynamic = PARAVM_ATOM_RESERVED_COUNT;
+
+    tab->serial = atomic_fetch_add(&next_serial, 1);
+    tab->cache_hits = 0;
+    tab->cache_misses = 0;
+    tab->epoch = 0;
+    tab->sweeps = 0;
+    tab->reclaimed = 0;
+
+    new_generation(tab);
+
+    g_mutex_lock(&live_tables_mutex);
+
+    if (!live_tables)
+        live_tables = g_hash_table_new(&g_int64_hash, &g_int64_equal);
+
+    g_hash_table_insert(live_tables, &tab->serial, tab);
+
+    g_mutex_unlock(&live_tables_mutex);
 
     return tab;
 }
@@ -34,81 +508,437 @@ void paravm_destroy_atom_table(ParaVMAtomTable *table)
 
     if (table)
     {
-        g_hash_table_destroy(table->str_to_atom);
-        g_hash_table_destroy(table->atom_to_str);
+        // Threads must not publish counts to the table once it
+        // is gone.
+        g_mutex_lock(&live_tables_mutex);
+        g_hash_table_remove(live_tables, &table->serial);
+        g_mutex_unlock(&live_tables_mutex);
+
+        paravm_stop_atom_sweeper(table);
 
         g_rw_lock_clear(table->rw_lock);
         g_free(table->rw_lock);
 
-        g_queue_free_full(table->reuse_queue, &int64_free);
+        destroy_arena(table->arena);
+        g_array_free(table->strings, true);
+        g_array_free(table->infos, true);
+        destroy_index(table->index);
+        g_array_free(table->free_ids, true);
+
+        AtomBase *base = table->base;
+
+        if (base)
+        {
+            munmap(base->map, base->size);
+            g_free(base);
+        }
     }
 
     g_free((ParaVMAtomTable *)table);
 }
 
+// Converts between dynamic atoms and string vector indexes.
+// Dynamic atoms are numbered after the reserved atoms and the
+// atoms of the loaded snapshot, if any.
+#define ENTRY_TO_ATOM(T, E) ((size_t)(E) + (T)->first_dynamic)
+#define ATOM_TO_ENTRY(T, A) ((A) - (T)->first_dynamic)
+
+// Gets the string of the snapshot atom at index `idx`, or
+// `NULL` if the ID is a hole.
+static const char *base_string(const AtomBase *base, size_t idx)
+{
+    assert(base);
+    assert(idx < base->count);
+
+    uint32_t start = le32toh(base->offsets[idx]);
+
+    return start == le32toh(base->offsets[idx + 1]) ? null : base->strings + start;
+}
+
+// Finds `str` in the snapshot. The snapshot is immutable, so
+// no lock is needed.
+static size_t find_base_atom(const AtomBase *base, const char *str, uint32_t hash)
+{
+    assert(str);
+
+    if (!base)
+        return SIZE_MAX;
+
+    for (size_t i = hash & base->index_mask; ; i = (i + 1) & base->index_mask)
+    {
+        const IndexSlot *slot = &base->index[i];
+        uint32_t entry = le32toh(slot->entry);
+
+        if (!entry)
+            return SIZE_MAX;
+
+        if (le32toh(slot->hash) == hash && !strcmp(base_string(base, entry - 1), str))
+            return PARAVM_ATOM_RESERVED_COUNT + entry - 1;
+    }
+}
+
+// Records that the atom at string vector index `idx` was
+// looked up in the current sweep epoch. The caller must hold
+// the lock in either mode.
+static void stamp_entry(const ParaVMAtomTable *table, size_t idx)
+{
+    assert(table);
+
+    AtomInfo *info = &g_array_index((GArray *)table->infos, AtomInfo, idx);
+
+    if (atomic_load(&info->epoch) != table->epoch)
+        atomic_store(&info->epoch, table->epoch);
+}
+
+// Looks up `str`, adding it if it isn't present. The caller
+// must hold the writer lock.
+static size_t intern_locked(ParaVMAtomTable *table, const char *str, size_t length, uint32_t hash)
+{
+    assert(table);
+    assert(str);
+
+    // Another thread may have inserted the string while we
+    // were waiting for the writer lock.
+    IndexSlot *slot = index_find(table->index, table->strings, str, hash);
+
+    if (slot)
+    {
+        stamp_entry(table, slot->entry - 1);
+
+        return ENTRY_TO_ATOM(table, slot->entry - 1);
+    }
+
+    GArray *strings = table->strings;
+    GArray *infos = table->infos;
+    GArray *free_ids = table->free_ids;
+
+    AtomInfo info = {
+        .refs = 0,
+        .epoch = table->epoch,
+    };
+
+    const char *copy = arena_copy(table->arena, str, length, &info.chunk);
+    uint32_t entry;
+
+    if (free_ids->len)
+    {
+        entry = g_array_index(free_ids, uint32_t, free_ids->len - 1);
+        g_array_set_size(free_ids, free_ids->len - 1);
+
+        g_array_index(strings, const char *, entry) = copy;
+        g_array_index(infos, AtomInfo, entry) = info;
+    }
+    else
+    {
+        entry = strings->len;
+        g_array_append_val(strings, copy);
+        g_array_append_val(infos, info);
+    }
+
+    index_insert(table->index, hash, entry);
+
+    return ENTRY_TO_ATOM(table, entry);
+}
+
+// Removes the atom at string vector index `idx`. The caller
+// must hold the writer lock and start a new generation
+// afterwards.
+static void erase_locked(ParaVMAtomTable *table, size_t idx)
+{
+    assert(table);
+
+    GArray *strings = table->strings;
+    const char *str = g_array_index(strings, const char *, idx);
+
+    assert(str);
+
+    size_t length;
+    uint32_t hash = hash_string(str, &length);
+
+    IndexSlot *slot = index_find(table->index, strings, str, hash);
+    AtomIndex *index = table->index;
+
+    assert(slot);
+
+    slot->entry = INDEX_TOMBSTONE;
+    index->used--;
+    index->tombstones++;
+
+    g_array_index(strings, const char *, idx) = null;
+    arena_release(table->arena, g_array_index((GArray *)table->infos, AtomInfo, idx).chunk);
+
+    uint32_t id = (uint32_t)idx;
+    g_array_append_val((GArray *)table->free_ids, id);
+}
+
 size_t paravm_string_to_atom(ParaVMAtomTable *table, const char *str)
 {
     assert(table);
     assert(str);
 
+    size_t length;
+    uint32_t hash = hash_string(str, &length);
+    size_t atom = find_reserved_atom(str, hash);
+
+    // Reserved and snapshot atoms are resolved without touching
+    // the table or the cache at all.
+    if (atom != SIZE_MAX || (atom = find_base_atom(table->base, str, hash)) != SIZE_MAX)
+        return atom;
+
+    AtomCache *cache = get_atom_cache();
+    uint64_t generation = atomic_load(&table->generation);
+
+    CacheEntry *entry = &cache->entries[hash & (CACHE_SIZE - 1)];
+
+    // An entry that was last stamped in an earlier sweep epoch
+    // goes through the table so that the atom is marked as used
+    // in the current one.
+    if (entry->generation == generation &&
+        entry->epoch == atomic_load(&table->epoch) &&
+        entry->hash == hash &&
+        entry->length == length &&
+        !memcmp(entry->key, str, length))
+    {
+        count_lookup(cache, table, true);
+
+        return entry->atom;
+    }
+
     g_rw_lock_reader_lock(table->rw_lock);
 
-    size_t *existing = g_hash_table_lookup(table->str_to_atom, str);
+    // Re-read the generation while holding the lock so that
+    // an entry filled below can never outlive an erasure.
+    generation = table->generation;
 
-    if (existing)
+    uint32_t epoch = table->epoch;
+    IndexSlot *slot = index_find(table->index, table->strings, str, hash);
+
+    if (slot)
     {
+        atom = ENTRY_TO_ATOM(table, slot->entry - 1);
+        stamp_entry(table, slot->entry - 1);
+
         g_rw_lock_reader_unlock(table->rw_lock);
-        return *existing;
     }
+    else
+    {
+        g_rw_lock_reader_unlock(table->rw_lock);
+        g_rw_lock_writer_lock(table->rw_lock);
 
-    g_rw_lock_writer_lock(table->rw_lock);
+        generation = table->generation;
+        epoch = table->epoch;
+        atom = intern_locked(table, str, length, hash);
 
-    size_t *slot = g_queue_pop_head(table->reuse_queue);
+        g_rw_lock_writer_unlock(table->rw_lock);
+    }
 
-    if (!slot)
+    if (length <= CACHE_KEY_SIZE)
     {
-        slot = g_new(size_t, 1);
-        *slot = table->next_id++;
+        entry->generation = generation;
+        entry->atom = atom;
+        entry->hash = hash;
+        entry->length = (uint32_t)length;
+        entry->epoch = epoch;
+
+        memcpy(entry->key, str, length + 1);
     }
 
-    g_hash_table_insert(table->str_to_atom, g_strdup(str), slot);
-    g_hash_table_insert(table->atom_to_str, g_memdup(slot, sizeof(size_t)), g_strdup(str));
+    count_lookup(cache, table, false);
 
-    g_rw_lock_writer_unlock(table->rw_lock);
+    return atom;
+}
 
-    return 0;
+// Gets the bookkeeping for `atom`, or `NULL` if it is not a
+// live dynamic atom. The caller must hold the lock in either
+// mode.
+static AtomInfo *get_info(const ParaVMAtomTable *table, size_t atom)
+{
+    assert(table);
+
+    if (atom < table->first_dynamic)
+        return null;
+
+    GArray *strings = table->strings;
+    size_t idx = ATOM_TO_ENTRY(table, atom);
+
+    if (idx >= strings->len || !g_array_index(strings, const char *, idx))
+        return null;
+
+    return &g_array_index((GArray *)table->infos, AtomInfo, idx);
+}
+
+// Adds a reference to `atom` if it is a live dynamic atom.
+// The caller must hold the lock in either mode.
+static void retain_locked(ParaVMAtomTable *table, size_t atom)
+{
+    assert(table);
+
+    AtomInfo *info = get_info(table, atom);
+
+    if (info)
+        atomic_add_fetch(&info->refs, 1);
+}
+
+// Implements `paravm_strings_to_atoms`. If `retain` is true,
+// every atom is retained before the lock is dropped, so that a
+// concurrent sweep can never reclaim it in between.
+static void strings_to_atoms(ParaVMAtomTable *table, const char *const *strs, size_t count, size_t *atoms, bool retain)
+{
+    assert(table);
+    assert(strs);
+    assert(atoms);
+
+    uint32_t *hashes = g_new(uint32_t, count);
+    size_t *lengths = g_new(size_t, count);
+    size_t misses = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        hashes[i] = hash_string(strs[i], &lengths[i]);
+        atoms[i] = find_reserved_atom(strs[i], hashes[i]);
+
+        if (atoms[i] == SIZE_MAX)
+            atoms[i] = find_base_atom(table->base, strs[i], hashes[i]);
+    }
+
+    g_rw_lock_reader_lock(table->rw_lock);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (atoms[i] != SIZE_MAX)
+            continue;
+
+        IndexSlot *slot = index_find(table->index, table->strings, strs[i], hashes[i]);
+
+        if (slot)
+        {
+            atoms[i] = ENTRY_TO_ATOM(table, slot->entry - 1);
+            stamp_entry(table, slot->entry - 1);
+
+            if (retain)
+                retain_locked(table, atoms[i]);
+        }
+        else
+            misses++;
+    }
+
+    g_rw_lock_reader_unlock(table->rw_lock);
+
+    if (misses)
+    {
+        g_rw_lock_writer_lock(table->rw_lock);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (atoms[i] != SIZE_MAX)
+                continue;
+
+            atoms[i] = intern_locked(table, strs[i], lengths[i], hashes[i]);
+
+            if (retain)
+                retain_locked(table, atoms[i]);
+        }
+
+        g_rw_lock_writer_unlock(table->rw_lock);
+    }
+
+    g_free(hashes);
+    g_free(lengths);
+}
+
+void paravm_strings_to_atoms(ParaVMAtomTable *table, const char *const *strs, size_t count, size_t *atoms)
+{
+    strings_to_atoms(table, strs, count, atoms, false);
+}
+
+void paravm_strings_to_retained_atoms(ParaVMAtomTable *table, const char *const *strs, size_t count, size_t *atoms)
+{
+    strings_to_atoms(table, strs, count, atoms, true);
+}
+
+size_t paravm_string_to_retained_atom(ParaVMAtomTable *table, const char *str)
+{
+    size_t atom;
+
+    strings_to_atoms(table, &str, 1, &atom, true);
+
+    return atom;
 }
 
 const char *paravm_atom_to_string(const ParaVMAtomTable *table, size_t atom)
 {
     assert(table);
 
+    if (atom < PARAVM_ATOM_RESERVED_COUNT)
+        return reserved_names[atom];
+
+    if (atom < table->first_dynamic)
+        return base_string(table->base, atom - PARAVM_ATOM_RESERVED_COUNT);
+
     g_rw_lock_reader_lock(table->rw_lock);
 
-    const char *str = g_hash_table_lookup(table->atom_to_str, &atom);
+    GArray *strings = table->strings;
+    size_t idx = ATOM_TO_ENTRY(table, atom);
+    const char *str = idx < strings->len ? g_array_index(strings, const char *, idx) : null;
 
     g_rw_lock_reader_unlock(table->rw_lock);
 
     return str;
 }
 
-void paravm_erase_atom(const ParaVMAtomTable *table, size_t atom)
+void paravm_retain_atom(ParaVMAtomTable *table, size_t atom)
 {
     assert(table);
 
-    g_rw_lock_writer_lock(table->rw_lock);
+    // Reserved and snapshot atoms live forever, so there's no
+    // need to take the lock for them.
+    if (atom < table->first_dynamic)
+        return;
+
+    g_rw_lock_reader_lock(table->rw_lock);
 
-    const char *str = g_hash_table_lookup(table->atom_to_str, &atom);
+    retain_locked(table, atom);
 
-    if (str)
+    g_rw_lock_reader_unlock(table->rw_lock);
+}
+
+void paravm_release_atom(ParaVMAtomTable *table, size_t atom)
+{
+    assert(table);
+
+    if (atom < table->first_dynamic)
+        return;
+
+    g_rw_lock_reader_lock(table->rw_lock);
+
+    AtomInfo *info = get_info(table, atom);
+
+    if (info)
     {
-        g_hash_table_remove(table->str_to_atom, str);
-        g_hash_table_remove(table->atom_to_str, &atom);
+        assert(atomic_load(&info->refs));
+
+        atomic_sub_fetch(&info->refs, 1);
+    }
+
+    g_rw_lock_reader_unlock(table->rw_lock);
+}
 
-        size_t *slot = g_new(size_t, 1);
-        *slot = atom;
+void paravm_erase_atom(const ParaVMAtomTable *table, size_t atom)
+{
+    assert(table);
+
+    // Reserved and snapshot atoms live forever.
+    if (atom < table->first_dynamic)
+        return;
+
+    g_rw_lock_writer_lock(table->rw_lock);
+
+    if (get_info(table, atom))
+    {
+        erase_locked((ParaVMAtomTable *)table, ATOM_TO_ENTRY(table, atom));
 
-        g_queue_push_tail(table->reuse_queue, slot);
+        // Invalidate all cached lookups for this table.
+        new_generation((ParaVMAtomTable *)table);
     }
 
     g_rw_lock_writer_unlock(table->rw_lock);
@@ -120,11 +950,454 @@ void paravm_clear_atoms(ParaVMAtomTable *table)
 
     g_rw_lock_writer_lock(table->rw_lock);
 
-    g_hash_table_remove_all(table->atom_to_str);
-    g_hash_table_remove_all(table->str_to_atom);
+    clear_arena(table->arena);
+    g_array_set_size(table->strings, 0);
+    g_array_set_size(table->infos, 0);
+    clear_index(table->index);
+    g_array_set_size(table->free_ids, 0);
+
+    new_generation(table);
+
+    g_rw_lock_writer_unlock(table->rw_lock);
+}
+
+size_t paravm_sweep_atoms(ParaVMAtomTable *table)
+{
+    assert(table);
+
+    g_rw_lock_writer_lock(table->rw_lock);
+
+    GArray *strings = table->strings;
+    GArray *infos = table->infos;
+    uint32_t epoch = table->epoch;
+    size_t reclaimed = 0;
+
+    // An atom is garbage if nothing holds a reference to it
+    // and it hasn't been looked up since the previous sweep
+    // (i.e. in the current epoch).
+    for (size_t i = 0; i < strings->len; i++)
+    {
+        AtomInfo *info = &g_array_index(infos, AtomInfo, i);
+
+        if (!g_array_index(strings, const char *, i) || info->refs || info->epoch == epoch)
+            continue;
+
+        erase_locked(table, i);
+        reclaimed++;
+    }
+
+    if (reclaimed)
+        new_generation(table);
 
-    table->next_id = 0;
-    g_queue_clear(table->reuse_queue);
+    atomic_store(&table->epoch, epoch + 1);
+
+    table->sweeps++;
+    table->reclaimed += reclaimed;
 
     g_rw_lock_writer_unlock(table->rw_lock);
+
+    return reclaimed;
+}
+
+static void *sweeper_main(void *data)
+{
+    AtomSweeper *sw = data;
+
+    g_mutex_lock(&sw->mutex);
+
+    while (!sw->stop)
+    {
+        int64_t deadline = g_get_monotonic_time() + sw->interval;
+
+        // Spurious wakeups just resume waiting for the deadline.
+        while (!sw->stop && g_cond_wait_until(&sw->cond, &sw->mutex, deadline))
+            ;
+
+        if (sw->stop)
+            break;
+
+        g_mutex_unlock(&sw->mutex);
+
+        paravm_sweep_atoms(sw->table);
+
+        g_mutex_lock(&sw->mutex);
+    }
+
+    g_mutex_unlock(&sw->mutex);
+
+    return null;
+}
+
+ParaVMError paravm_start_atom_sweeper(ParaVMAtomTable *table, uint32_t interval)
+{
+    assert(table);
+    assert(interval);
+
+    if (table->sweeper)
+        return PARAVM_ERROR_ALREADY_SET;
+
+    AtomSweeper *sw = g_new(AtomSweeper, 1);
+
+    g_mutex_init(&sw->mutex);
+    g_cond_init(&sw->cond);
+
+    sw->stop = false;
+    sw->interval = (int64_t)interval * 1000;
+    sw->table = table;
+    sw->thread = g_thread_new("paravm-atom-sweeper", &sweeper_main, sw);
+
+    table->sweeper = sw;
+
+    return PARAVM_ERROR_OK;
+}
+
+void paravm_stop_atom_sweeper(ParaVMAtomTable *table)
+{
+    assert(table);
+
+    AtomSweeper *sw = table->sweeper;
+
+    if (!sw)
+        return;
+
+    g_mutex_lock(&sw->mutex);
+
+    sw->stop = true;
+    g_cond_signal(&sw->cond);
+
+    g_mutex_unlock(&sw->mutex);
+
+    g_thread_join(sw->thread);
+
+    g_cond_clear(&sw->cond);
+    g_mutex_clear(&sw->mutex);
+    g_free(sw);
+
+    table->sweeper = null;
+}
+
+static bool write_words(FILE *f, const void *data, size_t size)
+{
+    assert(f);
+
+    return !size || fwrite(data, size, 1, f);
+}
+
+ParaVMError paravm_save_atom_snapshot(const ParaVMAtomTable *table, const char *path)
+{
+    assert(table);
+    assert(path);
+
+    g_rw_lock_reader_lock(table->rw_lock);
+
+    const AtomBase *base = table->base;
+    GArray *strings = table->strings;
+    size_t base_count = base ? base->count : 0;
+    size_t count = base_count + strings->len;
+
+    if (count >= UINT32_MAX)
+    {
+        g_rw_lock_reader_unlock(table->rw_lock);
+        return PARAVM_ERROR_OVERFLOW;
+    }
+
+    // IDs are written out as they are, holes included, so that
+    // every atom keeps its ID when the snapshot is loaded.
+    uint32_t *offsets = g_new(uint32_t, count + 1);
+    GByteArray *data = g_byte_array_new();
+    size_t live = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *str = i < base_count ? base_string(base, i) :
+                          g_array_index(strings, const char *, i - base_count);
+
+        offsets[i] = htole32((uint32_t)data->len);
+
+        if (str)
+        {
+            g_byte_array_append(data, (const uint8_t *)str, (guint)strlen(str) + 1);
+            live++;
+        }
+    }
+
+    g_rw_lock_reader_unlock(table->rw_lock);
+
+    offsets[count] = htole32((uint32_t)data->len);
+
+    // Keep the index at most half full so probe sequences stay
+    // short and always end at an empty slot.
+    size_t capacity = 1;
+
+    while (capacity < live * 2)
+        capacity *= 2;
+
+    IndexSlot *index = g_new0(IndexSlot, capacity);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t start = le32toh(offsets[i]);
+
+        if (start == le32toh(offsets[i + 1]))
+            continue;
+
+        size_t length;
+        uint32_t hash = hash_string((const char *)data->data + start, &length);
+        size_t j = hash & (capacity - 1);
+
+        while (index[j].entry)
+            j = (j + 1) & (capacity - 1);
+
+        index[j].hash = htole32(hash);
+        index[j].entry = htole32((uint32_t)i + 1);
+    }
+
+    uint32_t header[SNAPSHOT_HEADER_WORDS] = {
+        htole32(SNAPSHOT_FOURCC),
+        htole32(SNAPSHOT_VERSION),
+        htole32(PARAVM_ATOM_RESERVED_COUNT),
+        htole32((uint32_t)count),
+        htole32((uint32_t)live),
+        htole32((uint32_t)capacity),
+        htole32((uint32_t)data->len),
+    };
+
+    // The snapshot is written to a file of its own and then
+    // moved into place, since tables (including this one) may
+    // have the old snapshot at `path` mapped into memory, and
+    // truncating it would pull the pages out from under them.
+    char *tmp_path = g_strdup_printf("%s.XXXXXX", path);
+    ParaVMError err = PARAVM_ERROR_OK;
+    int fd = g_mkstemp_full(tmp_path, O_RDWR | O_CLOEXEC, 0666);
+    FILE *f = fd != -1 ? fdopen(fd, "w") : null;
+
+    if (!f)
+    {
+        err = errno_to_error(errno);
+
+        if (fd != -1)
+            close(fd);
+    }
+    else
+    {
+        if (!write_words(f, header, sizeof(header)) ||
+            !write_words(f, offsets, sizeof(uint32_t) * (count + 1)) ||
+            !write_words(f, index, sizeof(IndexSlot) * capacity) ||
+            !write_words(f, data->data, data->len))
+            err = errno_to_error(errno);
+
+        if (fclose(f) && !err)
+            err = errno_to_error(errno);
+
+        if (!err && rename(tmp_path, path))
+            err = errno_to_error(errno);
+    }
+
+    if (err && fd != -1)
+        unlink(tmp_path);
+
+    g_free(tmp_path);
+    g_free(offsets);
+    g_free(index);
+    g_byte_array_free(data, true);
+
+    return err;
+}
+
+// Checks that the mapped snapshot is well-formed and fills in
+// `base` accordingly. Validation is linear in the number of
+// IDs, but does not touch the string data beyond terminators.
+static ParaVMError parse_snapshot(void *map, size_t size, AtomBase *base)
+{
+    assert(map);
+    assert(base);
+
+    const uint32_t *header = map;
+
+    if (size < sizeof(uint32_t) * SNAPSHOT_HEADER_WORDS)
+        return PARAVM_ERROR_EOF;
+
+    if (le32toh(header[0]) != SNAPSHOT_FOURCC)
+        return PARAVM_ERROR_FOURCC;
+
+    // A snapshot taken with a different set of reserved atoms
+    // would shift every ID, so it is treated as incompatible.
+    if (le32toh(header[1]) > SNAPSHOT_VERSION || le32toh(header[2]) != PARAVM_ATOM_RESERVED_COUNT)
+        return PARAVM_ERROR_VERSION;
+
+    uint32_t count = le32toh(header[3]);
+    uint32_t live = le32toh(header[4]);
+    uint32_t capacity = le32toh(header[5]);
+    uint32_t data_size = le32toh(header[6]);
+
+    if (count == UINT32_MAX || !capacity || capacity & (capacity - 1))
+        return PARAVM_ERROR_MALFORMED;
+
+    uint64_t expected = sizeof(uint32_t) * SNAPSHOT_HEADER_WORDS +
+                        sizeof(uint32_t) * ((uint64_t)count + 1) +
+                        sizeof(IndexSlot) * (uint64_t)capacity +
+                        data_size;
+
+    if (size < expected)
+        return PARAVM_ERROR_EOF;
+
+    if (size > expected)
+        return PARAVM_ERROR_MALFORMED;
+
+    base->map = map;
+    base->size = size;
+    base->count = count;
+    base->live = live;
+    base->index_mask = capacity - 1;
+    base->offsets = header + SNAPSHOT_HEADER_WORDS;
+    base->index = (const IndexSlot *)(base->offsets + count + 1);
+    base->strings = (const char *)(base->index + capacity);
+
+    if (le32toh(base->offsets[0]) || le32toh(base->offsets[count]) != data_size)
+        return PARAVM_ERROR_MALFORMED;
+
+    uint32_t strs = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t start = le32toh(base->offsets[i]);
+        uint32_t end = le32toh(base->offsets[i + 1]);
+
+        if (end < start)
+            return PARAVM_ERROR_MALFORMED;
+
+        if (end == start)
+            continue;
+
+        if (base->strings[end - 1])
+            return PARAVM_ERROR_MALFORMED;
+
+        strs++;
+    }
+
+    uint32_t used = 0;
+
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        uint32_t entry = le32toh(base->index[i].entry);
+
+        if (!entry)
+            continue;
+
+        if (entry > count || !base_string(base, entry - 1))
+            return PARAVM_ERROR_MALFORMED;
+
+        used++;
+    }
+
+    // Lookups rely on every probe sequence ending at an empty
+    // slot.
+    if (strs != live || used != live || used == capacity)
+        return PARAVM_ERROR_MALFORMED;
+
+    return PARAVM_ERROR_OK;
+}
+
+ParaVMError paravm_load_atom_snapshot(ParaVMAtomTable *table, const char *path)
+{
+    assert(table);
+    assert(path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return errno_to_error(errno);
+
+    struct stat st;
+
+    if (fstat(fd, &st))
+    {
+        int err = errno;
+
+        close(fd);
+        return errno_to_error(err);
+    }
+
+    if (!S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return S_ISDIR(st.st_mode) ? PARAVM_ERROR_DIRECTORY : PARAVM_ERROR_IO;
+    }
+
+    size_t size = (size_t)st.st_size;
+
+    if (!size)
+    {
+        close(fd);
+        return PARAVM_ERROR_EOF;
+    }
+
+    void *map = mmap(null, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int map_err = errno;
+
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return errno_to_error(map_err);
+
+    AtomBase *base = g_new(AtomBase, 1);
+    ParaVMError err = parse_snapshot(map, size, base);
+
+    if (!err)
+    {
+        g_rw_lock_writer_lock(table->rw_lock);
+
+        if (table->base || ((GArray *)table->strings)->len)
+            err = PARAVM_ERROR_ALREADY_SET;
+        else
+        {
+            table->base = base;
+            table->first_dynamic = PARAVM_ATOM_RESERVED_COUNT + base->count;
+
+            new_generation(table);
+        }
+
+        g_rw_lock_writer_unlock(table->rw_lock);
+    }
+
+    if (err)
+    {
+        munmap(map, size);
+        g_free(base);
+    }
+
+    return err;
+}
+
+void paravm_get_atom_cache_stats(const ParaVMAtomTable *table, ParaVMAtomCacheStats *stats)
+{
+    assert(table);
+    assert(stats);
+
+    AtomCache *cache = atom_cache;
+
+    // Include the counts that the calling thread has not
+    // published yet.
+    if (cache && cache->stats_serial == table->serial)
+        flush_cache_stats(cache);
+
+    stats->hits = atomic_load(&table->cache_hits);
+    stats->misses = atomic_load(&table->cache_misses);
+}
+
+void paravm_get_atom_table_stats(const ParaVMAtomTable *table, ParaVMAtomTableStats *stats)
+{
+    assert(table);
+    assert(stats);
+
+    g_rw_lock_reader_lock(table->rw_lock);
+
+    const AtomBase *base = table->base;
+
+    stats->atoms = PARAVM_ATOM_RESERVED_COUNT + (base ? base->live : 0) + ((AtomIndex *)table->index)->used;
+    stats->arena_bytes = ((AtomArena *)table->arena)->bytes;
+    stats->sweeps = table->sweeps;
+    stats->reclaimed = table->reclaimed;
+
+    g_rw_lock_reader_unlock(table->rw_lock);
 }
@@ -1,217 +1,460 @@
 #include <errno.h>
-#include <setjmp.h>
-#include <stdio.h>
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 
+#include "internal/syserror.h"
+
 #include "disassemble.h"
+#include "fuse.h"
+
+// Output is gathered in a buffer of this size and handed to
+// the sink in chunks rather than written piece by piece.
+#define OUTPUT_SIZE 65536
 
-static ParaVMError errno_to_error(int err)
+typedef struct
+{
+    char data[OUTPUT_SIZE];
+    size_t length;
+    int fd; // Destination file descriptor, unless `str` is set.
+    GString *str; // Destination string.
+    int err; // First `errno` value from a failed write.
+} Output;
+
+// The characters that have to be escaped in quoted names
+// and atoms. Everything else is written as is.
+static const bool escape_table[256] =
 {
-    assert(err);
+    ['\\'] = true,
+    ['\''] = true,
+    ['"'] = true,
+};
+
+// Writes all of `data` to `fd`. Returns `0` or the `errno`
+// value of the write that failed.
+static int write_all(int fd, const char *data, size_t length)
+{
+    assert(data);
 
-    switch (err)
+    while (length)
     {
-        case EROFS:
-            return PARAVM_ERROR_READ_ONLY;
-        case EACCES:
-            return PARAVM_ERROR_ACCESS;
-        case ETXTBSY:
-            return PARAVM_ERROR_BUSY;
-        case EINTR:
-            return PARAVM_ERROR_IO_INTERRUPT;
-        case EISDIR:
-            return PARAVM_ERROR_DIRECTORY;
-        case ELOOP:
-        case EMFILE:
-        case ENFILE:
-        case ENOMEM:
-        case EFBIG:
-            return PARAVM_ERROR_LIMIT;
-        case EOVERFLOW:
-            return PARAVM_ERROR_EOF;
-        case ENAMETOOLONG:
-            return PARAVM_ERROR_PATH_LENGTH;
-        case ENOENT:
-            return PARAVM_ERROR_NONEXISTENT;
-        case ENOSPC:
-            return PARAVM_ERROR_NO_SPACE;
-        case ENOTDIR:
-            return PARAVM_ERROR_NOT_DIRECTORY;
-        case EIO:
-            return PARAVM_ERROR_IO;
-        default:
-            assert_unreachable();
-            return PARAVM_ERROR_OK;
+        ssize_t len = write(fd, data, length);
+
+        if (len < 0)
+        {
+            if (errno != EINTR)
+                return errno;
+
+            continue;
+        }
+
+        data += len;
+        length -= (size_t)len;
     }
+
+    return 0;
 }
 
-static void write(jmp_buf *sjlj, FILE *f, const char *value)
+static void flush(Output *out)
 {
-    assert(sjlj);
-    assert(f);
-    assert(value);
+    assert(out);
+
+    size_t length = out->length;
 
-    if (!fwrite(value, strlen(value), 1, f))
-        longjmp(*sjlj, 1);
+    out->length = 0;
+
+    if (out->str)
+        g_string_append_len(out->str, out->data, (gssize)length);
+    else if (!out->err)
+    {
+        // Once a write has failed, the rest of the output is
+        // dropped and the error is reported at the end.
+        out->err = write_all(out->fd, out->data, length);
+    }
 }
 
-static void write_str(jmp_buf *sjlj, FILE *f, const gchar *exc, const char *del, const char *value)
+static void put(Output *out, const char *data, size_t length)
 {
-    assert(sjlj);
-    assert(f);
-    assert(del);
-    assert(value);
+    assert(out);
+    assert(data);
 
-    write(sjlj, f, del);
+    while (length)
+    {
+        size_t len = MIN(length, OUTPUT_SIZE - out->length);
 
-    gchar *esc = g_strescape(value, exc);
+        memcpy(out->data + out->length, data, len);
 
-    // Do this manually so we can clean up.
-    if (!fwrite(esc, strlen(esc), 1, f))
-    {
-        g_free(esc);
-        longjmp(*sjlj, 1);
+        out->length += len;
+        data += len;
+        length -= len;
+
+        if (out->length == OUTPUT_SIZE)
+            flush(out);
     }
+}
 
-    g_free(esc);
+static void put_char(Output *out, char c)
+{
+    assert(out);
 
-    write(sjlj, f, del);
+    if (out->length == OUTPUT_SIZE)
+        flush(out);
+
+    out->data[out->length++] = c;
 }
 
-ParaVMError paravm_disassemble_module(const ParaVMModule *mod, const char *path)
+static void put_str(Output *out, const char *value)
 {
-    assert(mod);
-    assert(path);
+    assert(out);
+    assert(value);
 
-    FILE *f = fopen(path, "w");
+    put(out, value, strlen(value));
+}
 
-    if (!f)
-        return errno_to_error(errno);
+#define PUT_LITERAL(out, str) put(out, "" str "", sizeof(str) - 1)
+
+static void put_quoted(Output *out, char del, const char *value)
+{
+    assert(out);
+    assert(value);
 
-    jmp_buf sjlj;
+    put_char(out, del);
 
-    if (setjmp(sjlj))
+    const char *run = value;
+
+    // Most names need no escaping at all, in which case the
+    // whole name is copied at once.
+    for (const char *p = value; *p; p++)
     {
-        int err = errno;
+        if (!escape_table[(uint8_t)*p])
+            continue;
+
+        put(out, run, (size_t)(p - run));
+        put_char(out, '\\');
+        put_char(out, *p);
 
-        fclose(f);
-        return errno_to_error(err);
+        run = p + 1;
     }
 
-    // Make all characters except `\`, `'`, and `"` exceptions.
-    gchar *exc = g_new(gchar, 252 + 1);
-    guchar c = 1;
-    uint8_t i = 0;
+    put_str(out, run);
+    put_char(out, del);
+}
+
+static void put_insn(Output *out, const ParaVMInstruction *insn)
+{
+    assert(out);
+    assert(insn);
+
+    put_str(out, insn->opcode->name);
+
+    for (const ParaVMRegister *const *reg = paravm_get_instruction_registers(insn); *reg; reg++)
+    {
+        put_char(out, ' ');
+        put_quoted(out, '"', (*reg)->name);
+    }
 
-    while (i < 252)
+    if (insn->opcode->operand != PARAVM_OPERAND_TYPE_NONE)
     {
-        if (c != '\\' && c != '\'' && c != '"')
-            exc[i++] = (gchar)c;
+        PUT_LITERAL(out, " (");
 
-        c++;
+        switch (insn->opcode->operand)
+        {
+            case PARAVM_OPERAND_TYPE_INTEGER:
+            case PARAVM_OPERAND_TYPE_FLOAT:
+                put_str(out, insn->operand.string);
+
+                break;
+            case PARAVM_OPERAND_TYPE_ATOM:
+                put_quoted(out, '\'', insn->operand.string);
+
+                break;
+            case PARAVM_OPERAND_TYPE_BINARY:
+                // Binaries only consist of bits, so there is
+                // nothing to escape.
+                put_char(out, ':');
+                put_str(out, insn->operand.string);
+                put_char(out, ':');
+
+                break;
+            case PARAVM_OPERAND_TYPE_BLOCK:
+                put_quoted(out, '"', insn->operand.block->name);
+
+                break;
+            case PARAVM_OPERAND_TYPE_BLOCKS:
+                put_quoted(out, '"', insn->operand.blocks[0]->name);
+                put_char(out, ' ');
+                put_quoted(out, '"', insn->operand.blocks[1]->name);
+
+                break;
+            default:
+                assert_unreachable();
+                break;
+        }
+
+        put_char(out, ')');
     }
 
-    exc[252] = '\0';
+    put_char(out, '\n');
+}
+
+static void put_function(Output *out, const ParaVMFunction *fun, bool first)
+{
+    assert(out);
+    assert(fun);
 
-    const char *del_a = "'";
-    const char *del_s = "\"";
-    const char *del_b = ":";
+    // Functions are separated by an empty line.
+    if (!first)
+        put_char(out, '\n');
 
-    for (const ParaVMFunction *const *fun = paravm_get_functions(mod); *fun; fun++)
+    PUT_LITERAL(out, ".fun ");
+    put_quoted(out, '"', fun->name);
+    put_char(out, '\n');
+
+    for (const ParaVMRegister *const *arg = paravm_get_arguments(fun); *arg; arg++)
     {
-        write(&sjlj, f, ".fun ");
-        write_str(&sjlj, f, exc, del_s, (*fun)->name);
-        write(&sjlj, f, "\n");
+        PUT_LITERAL(out, ".arg ");
+        put_quoted(out, '"', (*arg)->name);
+        put_char(out, '\n');
+    }
 
-        for (const ParaVMRegister *const *arg = paravm_get_arguments(*fun); *arg; arg++)
-        {
-            write(&sjlj, f, ".arg ");
-            write_str(&sjlj, f, exc, del_s, (*arg)->name);
-            write(&sjlj, f, "\n");
-        }
+    for (const ParaVMRegister *const *reg = paravm_get_registers(fun); *reg; reg++)
+    {
+        if ((*reg)->argument)
+            continue;
 
-        for (const ParaVMRegister *const *reg = paravm_get_registers(*fun); *reg; reg++)
-        {
-            if ((*reg)->argument)
-                continue;
+        PUT_LITERAL(out, ".reg ");
+        put_quoted(out, '"', (*reg)->name);
+        put_char(out, '\n');
+    }
 
-            write(&sjlj, f, ".reg ");
-            write_str(&sjlj, f, exc, del_s, (*reg)->name);
-            write(&sjlj, f, "\n");
+    for (const ParaVMBlock *const *blk = paravm_get_blocks(fun); *blk; blk++)
+    {
+        PUT_LITERAL(out, ".blk ");
+        put_quoted(out, '"', (*blk)->name);
+        put_char(out, '\n');
+
+        if ((*blk)->handler)
+        {
+            PUT_LITERAL(out, ".unw ");
+            put_quoted(out, '"', (*blk)->handler->name);
+            put_char(out, ' ');
+            put_quoted(out, '"', (*blk)->exception->name);
+            put_char(out, '\n');
         }
 
-        for (const ParaVMBlock *const *blk = paravm_get_blocks(*fun); *blk; blk++)
+        for (const ParaVMInstruction *const *ins = paravm_get_instructions(*blk); *ins; ins++)
         {
-            write(&sjlj, f, ".blk ");
-            write_str(&sjlj, f, exc, del_s, (*blk)->name);
-            write(&sjlj, f, "\n");
+            // Superinstructions are shown as the instructions
+            // they were fused from so the output can be
+            // assembled again.
+            const ParaVMInstruction *exp[PARAVM_MAX_EXPANSION];
+            size_t count = paravm_expand_instruction(*ins, exp);
 
-            if ((*blk)->handler)
+            if (!count)
             {
-                write(&sjlj, f, ".unw ");
-                write_str(&sjlj, f, exc, del_s, (*blk)->handler->name);
-                write(&sjlj, f, "\n");
+                put_insn(out, *ins);
+                continue;
             }
 
-            for (const ParaVMInstruction *const *ins = paravm_get_instructions(*blk); *ins; ins++)
+            for (size_t e = 0; e < count; e++)
             {
-                write(&sjlj, f, (*ins)->opcode->name);
-
-                for (const ParaVMRegister *const *reg = (*ins)->registers; *reg; reg++)
-                {
-                    write_str(&sjlj, f, exc, del_s, (*reg)->name);
-
-                    if (*(reg + 1))
-                        write(&sjlj, f, " ");
-                }
-
-                if ((*ins)->opcode->operand != PARAVM_OPERAND_TYPE_NONE)
-                {
-                    write(&sjlj, f, " (");
-
-                    switch ((*ins)->opcode->operand)
-                    {
-                        case PARAVM_OPERAND_TYPE_INTEGER:
-                        case PARAVM_OPERAND_TYPE_FLOAT:
-                            write(&sjlj, f, (*ins)->operand.string);
-
-                            break;
-                        case PARAVM_OPERAND_TYPE_ATOM:
-                            write_str(&sjlj, f, exc, del_a, (*ins)->operand.string);
-
-                            break;
-                        case PARAVM_OPERAND_TYPE_BINARY:
-                            write_str(&sjlj, f, null, del_b, (*ins)->operand.string);
-
-                            break;
-                        case PARAVM_OPERAND_TYPE_BLOCK:
-                            write_str(&sjlj, f, exc, del_s, (*ins)->operand.block->name);
-
-                            break;
-                        case PARAVM_OPERAND_TYPE_BLOCKS:
-                            write_str(&sjlj, f, exc, del_s, (*ins)->operand.blocks[0]->name);
-                            write(&sjlj, f, " ");
-                            write_str(&sjlj, f, exc, del_s, (*ins)->operand.blocks[1]->name);
-
-                            break;
-                        default:
-                            assert_unreachable();
-                            break;
-                    }
-
-                    write(&sjlj, f, ")");
-                }
-
-                write(&sjlj, f, "\n");
+                put_insn(out, exp[e]);
+                paravm_destroy_instruction(exp[e]);
             }
         }
+    }
+}
 
-        if (*(fun + 1))
-            write(&sjlj, f, "\n");
+static void disassemble(const ParaVMModule *mod, Output *out)
+{
+    assert(mod);
+    assert(out);
+
+    for (const ParaVMFunction *const *fun = paravm_get_functions(mod); *fun; fun++)
+        put_function(out, *fun, fun == paravm_get_functions(mod));
+
+    flush(out);
+}
+
+ParaVMError paravm_disassemble_module(const ParaVMModule *mod, const char *path)
+{
+    assert(mod);
+    assert(path);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (fd == -1)
+        return errno_to_error(errno);
+
+    ParaVMError err = paravm_disassemble_module_fd(mod, fd);
+
+    if (close(fd) && err == PARAVM_ERROR_OK && errno != EINTR)
+        err = errno_to_error(errno);
+
+    return err;
+}
+
+ParaVMError paravm_disassemble_module_fd(const ParaVMModule *mod, int fd)
+{
+    assert(mod);
+    assert(fd >= 0);
+
+    Output *out = g_new(Output, 1);
+
+    out->length = 0;
+    out->fd = fd;
+    out->str = null;
+    out->err = 0;
+
+    disassemble(mod, out);
+
+    int err = out->err;
+
+    g_free(out);
+
+    return err ? errno_to_error(err) : PARAVM_ERROR_OK;
+}
+
+char *paravm_disassemble_module_string(const ParaVMModule *mod, size_t *length)
+{
+    assert(mod);
+
+    Output *out = g_new(Output, 1);
+
+    out->length = 0;
+    out->fd = -1;
+    out->str = g_string_sized_new(OUTPUT_SIZE);
+    out->err = 0;
+
+    disassemble(mod, out);
+
+    if (length)
+        *length = out->str->len;
+
+    char *str = g_string_free(out->str, false);
+
+    g_free(out);
+
+    return str;
+}
+
+// Functions are handed to threads in runs of this many so
+// that each job is large enough to be worth scheduling.
+#define FUNCTIONS_PER_JOB 64
+
+typedef struct
+{
+    const ParaVMFunction *const *funcs;
+    size_t count;
+    bool first; // Whether `funcs` starts at the first function.
+    GString *text;
+    bool done;
+} FunctionJob;
+
+typedef struct
+{
+    GMutex lock;
+    GCond cond;
+} JobQueue;
+
+static void disassemble_job(void *data, void *user_data)
+{
+    assert(data);
+    assert(user_data);
+
+    FunctionJob *job = data;
+    JobQueue *queue = user_data;
+    Output *out = g_new(Output, 1);
+
+    out->length = 0;
+    out->fd = -1;
+    out->str = g_string_sized_new(OUTPUT_SIZE);
+    out->err = 0;
+
+    for (size_t i = 0; i < job->count; i++)
+        put_function(out, job->funcs[i], job->first && !i);
+
+    flush(out);
+
+    g_mutex_lock(&queue->lock);
+
+    job->text = out->str;
+    job->done = true;
+
+    g_cond_broadcast(&queue->cond);
+    g_mutex_unlock(&queue->lock);
+
+    g_free(out);
+}
+
+ParaVMError paravm_disassemble_module_parallel(const ParaVMModule *mod, int fd, uint32_t threads)
+{
+    assert(mod);
+    assert(fd >= 0);
+
+    const ParaVMFunction *const *funcs = paravm_get_functions(mod);
+    size_t count = paravm_get_function_count(mod);
+    size_t job_count = (count + FUNCTIONS_PER_JOB - 1) / FUNCTIONS_PER_JOB;
+
+    if (!threads)
+        threads = g_get_num_processors();
+
+    if (threads > job_count)
+        threads = (uint32_t)job_count;
+
+    if (threads <= 1)
+        return paravm_disassemble_module_fd(mod, fd);
+
+    FunctionJob *jobs = g_new(FunctionJob, job_count);
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        jobs[i] = (FunctionJob) {
+            .funcs = &funcs[i * FUNCTIONS_PER_JOB],
+            .count = MIN(FUNCTIONS_PER_JOB, count - i * FUNCTIONS_PER_JOB),
+            .first = !i,
+            .text = null,
+            .done = false,
+        };
     }
 
-    fclose(f);
-    return PARAVM_ERROR_OK;
+    JobQueue queue;
+
+    g_mutex_init(&queue.lock);
+    g_cond_init(&queue.cond);
+
+    GThreadPool *pool = g_thread_pool_new(&disassemble_job, &queue, (gint)threads, true, null);
+
+    for (size_t i = 0; i < job_count; i++)
+        g_thread_pool_push(pool, &jobs[i], null);
+
+    // Write the text of each job out as soon as it and all
+    // jobs before it are done, so that writing overlaps with
+    // rendering and the output is in module order.
+    int err = 0;
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        g_mutex_lock(&queue.lock);
+
+        while (!jobs[i].done)
+            g_cond_wait(&queue.cond, &queue.lock);
+
+        g_mutex_unlock(&queue.lock);
+
+        if (!err)
+            err = write_all(fd, jobs[i].text->str, jobs[i].text->len);
+
+        g_string_free(jobs[i].text, true);
+    }
+
+    g_thread_pool_free(pool, false, true);
+
+    g_cond_clear(&queue.cond);
+    g_mutex_clear(&queue.lock);
+    g_free(jobs);
+
+    return err ? errno_to_error(err) : PARAVM_ERROR_OK;
 }
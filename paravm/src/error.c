@@ -48,6 +48,8 @@ const char *paravm_error_to_string(ParaVMError err)
             return "Property was already set";
         case PARAVM_ERROR_FOURCC:
             return "Invalid 4-character code value encountered";
+        case PARAVM_ERROR_MALFORMED:
+            return "File contents are malformed";
         default:
             assert_unreachable();
             return null;
@@ -0,0 +1,250 @@
+#include <glib.h>
+
+#include "internal/fuse.h"
+
+#include "fuse.h"
+
+// The largest number of registers any superinstruction has.
+#define MAX_FUSED_REGISTERS 6
+
+typedef enum
+{
+    // `cmp.* a b c` and `jump.cond a (t f)` become
+    // `cmp.*.jump a b c (t f)`.
+    SHAPE_BRANCH,
+    // `load.int c (n)` and `num.add a b c` become
+    // `num.add.int a b c (n)`.
+    SHAPE_IMMEDIATE,
+    // `x a b c` and `y d e f` become `x.y a b c d e f`.
+    SHAPE_CONCAT,
+} FusionShape;
+
+typedef struct
+{
+    const ParaVMOpCode *first;
+    const ParaVMOpCode *second;
+    const ParaVMOpCode *fused;
+    FusionShape shape;
+} FusionRule;
+
+static const FusionRule rules[] =
+{
+    { &paravm_op_cmp_lt, &paravm_op_jump_cond, &paravm_op_cmp_lt_jump, SHAPE_BRANCH },
+    { &paravm_op_cmp_gt, &paravm_op_jump_cond, &paravm_op_cmp_gt_jump, SHAPE_BRANCH },
+    { &paravm_op_cmp_eq, &paravm_op_jump_cond, &paravm_op_cmp_eq_jump, SHAPE_BRANCH },
+    { &paravm_op_cmp_neq, &paravm_op_jump_cond, &paravm_op_cmp_neq_jump, SHAPE_BRANCH },
+    { &paravm_op_cmp_lteq, &paravm_op_jump_cond, &paravm_op_cmp_lteq_jump, SHAPE_BRANCH },
+    { &paravm_op_cmp_gteq, &paravm_op_jump_cond, &paravm_op_cmp_gteq_jump, SHAPE_BRANCH },
+    { &paravm_op_load_int, &paravm_op_num_add, &paravm_op_num_add_int, SHAPE_IMMEDIATE },
+    { &paravm_op_tup_get, &paravm_op_tup_get, &paravm_op_tup_get_get, SHAPE_CONCAT },
+};
+
+static const ParaVMOperand no_operand = { .string = null };
+
+static const FusionRule *find_rule(const ParaVMOpCode *first, const ParaVMOpCode *second)
+{
+    assert(first);
+    assert(second);
+
+    for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++)
+        if (rules[i].first == first && rules[i].second == second)
+            return &rules[i];
+
+    return null;
+}
+
+static const FusionRule *find_fused_rule(const ParaVMOpCode *fused)
+{
+    assert(fused);
+
+    if (!(fused->flags & PARAVM_OPCODE_FLAG_FUSED))
+        return null;
+
+    for (size_t i = 0; i < sizeof(rules) / sizeof(rules[0]); i++)
+        if (rules[i].fused == fused)
+            return &rules[i];
+
+    return null;
+}
+
+// Creates the superinstruction for `a` followed by `b`, or
+// returns `NULL` if their registers do not fit `rule`.
+static const ParaVMInstruction *fuse_pair(const FusionRule *rule, const ParaVMInstruction *a, const ParaVMInstruction *b)
+{
+    assert(rule);
+    assert(a);
+    assert(b);
+
+    // None of the fused opcodes take variable registers, so
+    // anything else is malformed and best left alone.
+    if (paravm_get_instruction_register_count(a) != a->opcode->registers ||
+        paravm_get_instruction_register_count(b) != b->opcode->registers)
+        return null;
+
+    const ParaVMRegister *const *ra = paravm_get_instruction_registers(a);
+    const ParaVMRegister *const *rb = paravm_get_instruction_registers(b);
+
+    switch (rule->shape)
+    {
+        case SHAPE_BRANCH:
+            if (rb[0] != ra[0])
+                return null;
+
+            return paravm_create_instruction(rule->fused, b->operand, false, ra);
+        case SHAPE_IMMEDIATE:
+            if (rb[2] != ra[0])
+                return null;
+
+            return paravm_create_instruction(rule->fused, a->operand, a->own_operand, rb);
+        case SHAPE_CONCAT:
+        {
+            const ParaVMRegister *regs[MAX_FUSED_REGISTERS + 1];
+            size_t n = 0;
+
+            for (const ParaVMRegister *const *reg = ra; *reg; reg++)
+                regs[n++] = *reg;
+
+            for (const ParaVMRegister *const *reg = rb; *reg; reg++)
+                regs[n++] = *reg;
+
+            regs[n] = null;
+
+            return paravm_create_instruction(rule->fused, no_operand, false, regs);
+        }
+        default:
+            assert_unreachable();
+            return null;
+    }
+}
+
+size_t paravm_fuse_module(const ParaVMModule *mod)
+{
+    assert(mod);
+
+    size_t fused = 0;
+
+    for (const ParaVMFunction *const *f = paravm_get_functions(mod); *f; f++)
+    {
+        for (const ParaVMBlock *const *b = paravm_get_blocks(*f); *b; b++)
+        {
+            GArray *arr = (GArray *)(*b)->instruction_list;
+            guint w = 0;
+
+            // Compact the instruction list in place, replacing
+            // fusable pairs as we go.
+            for (guint r = 0; r < arr->len; r++)
+            {
+                const ParaVMInstruction *insn = g_array_index(arr, const ParaVMInstruction *, r);
+
+                if (r + 1 < arr->len)
+                {
+                    const ParaVMInstruction *next = g_array_index(arr, const ParaVMInstruction *, r + 1);
+                    const FusionRule *rule = find_rule(insn->opcode, next->opcode);
+                    const ParaVMInstruction *sup = rule ? fuse_pair(rule, insn, next) : null;
+
+                    if (sup)
+                    {
+                        ((ParaVMInstruction *)sup)->block = *b;
+
+                        paravm_destroy_instruction(insn);
+                        paravm_destroy_instruction(next);
+
+                        insn = sup;
+                        r++;
+                        fused++;
+                    }
+                }
+
+                g_array_index(arr, const ParaVMInstruction *, w++) = insn;
+            }
+
+            g_array_set_size(arr, w);
+        }
+    }
+
+    return fused;
+}
+
+size_t paravm_expand_instruction(const ParaVMInstruction *insn, const ParaVMInstruction **expansion)
+{
+    assert(insn);
+    assert(expansion);
+
+    const FusionRule *rule = find_fused_rule(insn->opcode);
+
+    if (!rule)
+        return 0;
+
+    const ParaVMRegister *const *regs = paravm_get_instruction_registers(insn);
+
+    switch (rule->shape)
+    {
+        case SHAPE_BRANCH:
+        {
+            const ParaVMRegister *cond[] = { regs[0], null };
+
+            expansion[0] = paravm_create_instruction(rule->first, no_operand, false, regs);
+            expansion[1] = paravm_create_instruction(rule->second, insn->operand, false, cond);
+
+            break;
+        }
+        case SHAPE_IMMEDIATE:
+        {
+            const ParaVMRegister *load[] = { regs[2], null };
+
+            expansion[0] = paravm_create_instruction(rule->first, insn->operand, false, load);
+            expansion[1] = paravm_create_instruction(rule->second, no_operand, false, regs);
+
+            break;
+        }
+        case SHAPE_CONCAT:
+        {
+            const ParaVMRegister *first[MAX_FUSED_REGISTERS + 1] = { null };
+            uint8_t n = rule->first->registers;
+
+            for (uint8_t i = 0; i < n; i++)
+                first[i] = regs[i];
+
+            expansion[0] = paravm_create_instruction(rule->first, no_operand, false, first);
+            expansion[1] = paravm_create_instruction(rule->second, no_operand, false, regs + n);
+
+            break;
+        }
+        default:
+            assert_unreachable();
+            return 0;
+    }
+
+    ((ParaVMInstruction *)expansion[0])->block = insn->block;
+    ((ParaVMInstruction *)expansion[1])->block = insn->block;
+
+    return 2;
+}
+
+size_t expand_sequence(const ParaVMInstruction *insn, const ParaVMInstruction **seq, bool *fused)
+{
+    assert(insn);
+    assert(seq);
+    assert(fused);
+
+    size_t count = paravm_expand_instruction(insn, seq);
+
+    *fused = count != 0;
+
+    if (!count)
+    {
+        seq[0] = insn;
+        count = 1;
+    }
+
+    return count;
+}
+
+void release_sequence(const ParaVMInstruction **seq, size_t count, bool fused)
+{
+    assert(seq);
+
+    if (fused)
+        for (size_t i = 0; i < count; i++)
+            paravm_destroy_instruction(seq[i]);
+}
@@ -0,0 +1,404 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "internal/fuse.h"
+
+#include "fuse.h"
+#include "infer.h"
+
+// The most registers an opcode that is described in `rules`
+// can take.
+#define MAX_RULE_REGISTERS 5
+
+typedef enum
+{
+    RESULT_ANY = 0, // Register 0 can receive any value.
+    RESULT_FIXED, // Register 0 receives `result`.
+    RESULT_COPY, // Register 0 receives the value of register 1.
+    RESULT_ARITH, // Register 0 receives the kind of number the operands produce.
+} ResultKind;
+
+typedef struct
+{
+    ResultKind kind;
+    uint16_t result;
+    // The kinds each register must hold for the instruction to
+    // complete rather than throw, or 0 if anything goes.
+    uint16_t accepts[MAX_RULE_REGISTERS];
+} TypeRule;
+
+// Superinstructions are not described here; they are handled
+// as the instructions they were fused from.
+static const TypeRule rules[256] =
+{
+    [PARAVM_CODE_COPY] = { RESULT_COPY, 0, { 0 } },
+    [PARAVM_CODE_TYPE] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_LOAD_NIL] = { RESULT_FIXED, PARAVM_TYPE_NIL, { 0 } },
+    [PARAVM_CODE_LOAD_INT] = { RESULT_FIXED, PARAVM_TYPE_INT, { 0 } },
+    [PARAVM_CODE_LOAD_FLT] = { RESULT_FIXED, PARAVM_TYPE_FLT, { 0 } },
+    [PARAVM_CODE_LOAD_ATOM] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_LOAD_BIN] = { RESULT_FIXED, PARAVM_TYPE_BIN, { 0 } },
+    [PARAVM_CODE_LOAD_FUNC] = { RESULT_FIXED, PARAVM_TYPE_FUNC, { 0 } },
+    [PARAVM_CODE_NUM_ADD] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_SUB] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_MUL] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_DIV] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_REM] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_POW] = { RESULT_FIXED, PARAVM_TYPE_NUM, { [1] = PARAVM_TYPE_NUM, [2] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_NEG] = { RESULT_ARITH, 0, { [1] = PARAVM_TYPE_NUM } },
+    [PARAVM_CODE_NUM_AND] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_NUM_OR] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_NUM_XOR] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_NUM_NOT] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_NUM_SHL] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_NUM_SHR] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_INT, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_CMP_LT] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_CMP_GT] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_CMP_EQ] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_CMP_NEQ] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_CMP_LTEQ] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_CMP_GTEQ] = { RESULT_FIXED, PARAVM_TYPE_ATOM, { 0 } },
+    [PARAVM_CODE_TUP_MAKE] = { RESULT_FIXED, PARAVM_TYPE_TUP, { 0 } },
+    [PARAVM_CODE_TUP_GET] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_TUP, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_TUP_SET] = { RESULT_FIXED, PARAVM_TYPE_TUP, { [1] = PARAVM_TYPE_TUP, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_TUP_DEL] = { RESULT_FIXED, PARAVM_TYPE_TUP, { [1] = PARAVM_TYPE_TUP, [2] = PARAVM_TYPE_INT } },
+    [PARAVM_CODE_TUP_SIZE] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_TUP } },
+    [PARAVM_CODE_LIST_MAKE] = { RESULT_FIXED, PARAVM_TYPE_LIST, { 0 } },
+    [PARAVM_CODE_LIST_HEAD] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_LIST } },
+    [PARAVM_CODE_LIST_TAIL] = { RESULT_FIXED, PARAVM_TYPE_LIST, { [1] = PARAVM_TYPE_LIST } },
+    [PARAVM_CODE_LIST_CONS] = { RESULT_FIXED, PARAVM_TYPE_LIST, { 0 } },
+    [PARAVM_CODE_MAP_MAKE] = { RESULT_FIXED, PARAVM_TYPE_MAP, { 0 } },
+    [PARAVM_CODE_MAP_ADD] = { RESULT_FIXED, PARAVM_TYPE_MAP, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_MAP_GET] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_MAP_DEL] = { RESULT_FIXED, PARAVM_TYPE_MAP, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_MAP_SIZE] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_MAP_KEYS] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_MAP_VALS] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_MAP } },
+    [PARAVM_CODE_SET_MAKE] = { RESULT_FIXED, PARAVM_TYPE_SET, { 0 } },
+    [PARAVM_CODE_SET_ADD] = { RESULT_FIXED, PARAVM_TYPE_SET, { [1] = PARAVM_TYPE_SET } },
+    [PARAVM_CODE_SET_FIND] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_SET } },
+    [PARAVM_CODE_SET_DEL] = { RESULT_FIXED, PARAVM_TYPE_SET, { [1] = PARAVM_TYPE_SET } },
+    [PARAVM_CODE_SET_SIZE] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_SET } },
+    [PARAVM_CODE_SET_VALS] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_SET } },
+    [PARAVM_CODE_BIN_SIZE] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_BIN } },
+    [PARAVM_CODE_BIN_EBIN] = { RESULT_FIXED, PARAVM_TYPE_BIN, { 0 } },
+    [PARAVM_CODE_BIN_DBIN] = { RESULT_ANY, 0, { [1] = PARAVM_TYPE_BIN } },
+    [PARAVM_CODE_BIN_EFS] = { RESULT_FIXED, PARAVM_TYPE_BIN, { 0 } },
+    [PARAVM_CODE_BIN_EFD] = { RESULT_FIXED, PARAVM_TYPE_BIN, { 0 } },
+    [PARAVM_CODE_BIN_DFS] = { RESULT_FIXED, PARAVM_TYPE_FLT, { [1] = PARAVM_TYPE_BIN } },
+    [PARAVM_CODE_BIN_DFD] = { RESULT_FIXED, PARAVM_TYPE_FLT, { [1] = PARAVM_TYPE_BIN } },
+    [PARAVM_CODE_BIN_EISU] = { RESULT_FIXED, PARAVM_TYPE_BIN, { 0 } },
+    [PARAVM_CODE_BIN_DIS] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_BIN } },
+    [PARAVM_CODE_BIN_DIU] = { RESULT_FIXED, PARAVM_TYPE_INT, { [1] = PARAVM_TYPE_BIN } },
+};
+
+// Kinds of values held by the registers of a function, with
+// one `ParaVMType` mask per register.
+typedef struct
+{
+    GHashTable *regs; // Register to index plus one.
+    GHashTable *blocks; // Block to index plus one.
+    size_t count; // Registers in the function.
+    uint16_t *ins; // Kinds held on entry to each block.
+    bool *reached; // Whether each block has been reached.
+    uint16_t *state; // Kinds held at the current point.
+    bool changed;
+} Inference;
+
+static size_t reg_index(const Inference *inf, const ParaVMRegister *reg)
+{
+    assert(inf);
+    assert(reg);
+
+    return GPOINTER_TO_SIZE(g_hash_table_lookup(inf->regs, reg)) - 1;
+}
+
+static size_t block_index(const Inference *inf, const ParaVMBlock *blk)
+{
+    assert(inf);
+    assert(blk);
+
+    return GPOINTER_TO_SIZE(g_hash_table_lookup(inf->blocks, blk)) - 1;
+}
+
+static bool is_read(const ParaVMOpCode *op, size_t pos)
+{
+    assert(op);
+
+    // Additional registers are always read.
+    return pos >= op->registers || (op->uses & (1 << pos));
+}
+
+// Merges the current state, with `extra` holding anything if
+// it is not `null`, into the entry state of `blk`.
+static void flow_to(Inference *inf, const ParaVMBlock *blk, const ParaVMRegister *extra)
+{
+    assert(inf);
+    assert(blk);
+
+    size_t idx = block_index(inf, blk);
+    uint16_t *in = &inf->ins[idx * inf->count];
+    size_t extra_idx = extra ? reg_index(inf, extra) : SIZE_MAX;
+
+    if (!inf->reached[idx])
+        inf->changed = true;
+
+    inf->reached[idx] = true;
+
+    for (size_t r = 0; r < inf->count; r++)
+    {
+        uint16_t merged = in[r] | (r == extra_idx ? (uint16_t)PARAVM_TYPE_ANY : inf->state[r]);
+
+        if (merged != in[r])
+            inf->changed = true;
+
+        in[r] = merged;
+    }
+}
+
+// Computes what an instruction following `rule` writes to
+// register 0, once its operands have been narrowed.
+static uint16_t result_types(const Inference *inf, const TypeRule *rule, const ParaVMInstruction *insn)
+{
+    assert(inf);
+    assert(rule);
+    assert(insn);
+
+    const ParaVMRegister *const *regs = paravm_get_instruction_registers(insn);
+
+    switch (rule->kind)
+    {
+        case RESULT_ANY:
+            return PARAVM_TYPE_ANY;
+        case RESULT_FIXED:
+            return rule->result;
+        case RESULT_COPY:
+            return inf->state[reg_index(inf, regs[1])];
+        case RESULT_ARITH:
+        {
+            // Integers stay integers, but a single float makes
+            // the result a float.
+            bool all_int = true;
+            bool any_flt = false;
+
+            for (uint8_t r = 1; r < insn->opcode->registers; r++)
+            {
+                uint16_t types = inf->state[reg_index(inf, regs[r])];
+
+                if (!types)
+                    return PARAVM_TYPE_NONE;
+
+                all_int &= (types & PARAVM_TYPE_INT) != 0;
+                any_flt |= (types & PARAVM_TYPE_FLT) != 0;
+            }
+
+            return (uint16_t)((all_int ? PARAVM_TYPE_INT : 0) | (any_flt ? PARAVM_TYPE_FLT : 0));
+        }
+        default:
+            assert_unreachable();
+            return PARAVM_TYPE_ANY;
+    }
+}
+
+// Applies `insn` to the current state, passing the state on
+// to the exception handler of `blk` and to branch targets.
+// `insn` must not be a superinstruction.
+static void step(Inference *inf, const ParaVMBlock *blk, const ParaVMInstruction *insn)
+{
+    assert(inf);
+    assert(blk);
+    assert(insn);
+
+    const ParaVMOpCode *op = insn->opcode;
+    const TypeRule *rule = &rules[op->code];
+    const ParaVMRegister *const *regs = paravm_get_instruction_registers(insn);
+
+    if (blk->handler && (op->flags & PARAVM_OPCODE_FLAG_THROWS))
+        flow_to(inf, blk->handler, blk->exception);
+
+    // Past this point, the instruction has not thrown, so its
+    // operands must have been of the kinds it accepts.
+    for (uint8_t r = 0; r < op->registers && r < MAX_RULE_REGISTERS; r++)
+        if (rule->accepts[r])
+            inf->state[reg_index(inf, regs[r])] &= rule->accepts[r];
+
+    if (op->defs & 1)
+        inf->state[reg_index(inf, regs[0])] = result_types(inf, rule, insn);
+
+    if (op->operand == PARAVM_OPERAND_TYPE_BLOCK)
+        flow_to(inf, insn->operand.block, null);
+    else if (op->operand == PARAVM_OPERAND_TYPE_BLOCKS)
+    {
+        flow_to(inf, insn->operand.blocks[0], null);
+        flow_to(inf, insn->operand.blocks[1], null);
+    }
+}
+
+// Runs `insn` on the current state and, if `types` is not
+// `null`, records the kinds its registers hold in it.
+static void infer_instruction(Inference *inf, const ParaVMBlock *blk, const ParaVMInstruction *insn, uint16_t *types)
+{
+    assert(inf);
+    assert(blk);
+    assert(insn);
+
+    const ParaVMInstruction *seq[PARAVM_MAX_EXPANSION];
+    bool fused;
+    size_t count = expand_sequence(insn, seq, &fused);
+    const ParaVMRegister *const *regs = paravm_get_instruction_registers(insn);
+    size_t reg_count = paravm_get_instruction_register_count(insn);
+
+    if (types)
+        memset(types, 0, reg_count * sizeof(uint16_t));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const ParaVMRegister *const *sub = paravm_get_instruction_registers(seq[i]);
+        const ParaVMOpCode *op = seq[i]->opcode;
+
+        // A register of a superinstruction can be read by any
+        // of the instructions it was fused from, so it can hold
+        // whatever it holds before each of those.
+        if (types)
+            for (size_t p = 0; p < reg_count; p++)
+                if (is_read(insn->opcode, p))
+                    for (size_t s = 0; sub[s]; s++)
+                        if (sub[s] == regs[p] && is_read(op, s))
+                            types[p] |= inf->state[reg_index(inf, regs[p])];
+
+        step(inf, blk, seq[i]);
+
+        // Registers that are only written hold what the last
+        // instruction to write them stored, even if a later one
+        // narrows them further.
+        if (types)
+            for (size_t p = 0; p < reg_count; p++)
+                if (!is_read(insn->opcode, p))
+                    for (size_t s = 0; sub[s]; s++)
+                        if (sub[s] == regs[p] && s < op->registers && (op->defs & (1 << s)))
+                            types[p] = inf->state[reg_index(inf, regs[p])];
+    }
+
+    release_sequence(seq, count, fused);
+}
+
+static void infer_block(Inference *inf, const ParaVMBlock *blk)
+{
+    assert(inf);
+    assert(blk);
+
+    memcpy(inf->state, &inf->ins[block_index(inf, blk) * inf->count], inf->count * sizeof(uint16_t));
+
+    for (const ParaVMInstruction *const *i = paravm_get_instructions(blk); *i; i++)
+        infer_instruction(inf, blk, *i, null);
+}
+
+static void set_types(const ParaVMInstruction *insn, uint16_t *types)
+{
+    assert(insn);
+
+    g_free((void *)insn->types);
+
+    ((ParaVMInstruction *)insn)->types = types;
+}
+
+static void infer_function(const ParaVMFunction *f)
+{
+    assert(f);
+
+    size_t block_count = paravm_get_block_count(f);
+
+    if (!block_count)
+        return;
+
+    Inference inf = {
+        .regs = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .blocks = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .count = paravm_get_register_count(f),
+        .changed = true,
+    };
+
+    inf.ins = g_new0(uint16_t, inf.count * block_count);
+    inf.reached = g_new0(bool, block_count);
+    inf.state = g_new0(uint16_t, inf.count);
+
+    size_t idx = 0;
+
+    for (const ParaVMRegister *const *r = paravm_get_registers(f); *r; r++)
+        g_hash_table_insert(inf.regs, (ParaVMRegister *)*r, GSIZE_TO_POINTER(++idx));
+
+    idx = 0;
+
+    for (const ParaVMBlock *const *b = paravm_get_blocks(f); *b; b++)
+        g_hash_table_insert(inf.blocks, (ParaVMBlock *)*b, GSIZE_TO_POINTER(++idx));
+
+    const ParaVMBlock *const *blocks = paravm_get_blocks(f);
+
+    // Arguments can be anything; all other registers hold
+    // nothing until they are assigned.
+    for (const ParaVMRegister *const *a = paravm_get_arguments(f); *a; a++)
+        inf.state[reg_index(&inf, *a)] = PARAVM_TYPE_ANY;
+
+    flow_to(&inf, blocks[0], null);
+
+    // Kinds are only ever added to the entry states, so this
+    // terminates once no block gains any.
+    while (inf.changed)
+    {
+        inf.changed = false;
+
+        for (size_t b = 0; b < block_count; b++)
+            if (inf.reached[b])
+                infer_block(&inf, blocks[b]);
+    }
+
+    for (size_t b = 0; b < block_count; b++)
+    {
+        const ParaVMInstruction *const *insns = paravm_get_instructions(blocks[b]);
+
+        // Nothing is known about code that never runs.
+        if (!inf.reached[b])
+        {
+            for (const ParaVMInstruction *const *i = insns; *i; i++)
+                set_types(*i, null);
+
+            continue;
+        }
+
+        memcpy(inf.state, &inf.ins[b * inf.count], inf.count * sizeof(uint16_t));
+
+        for (const ParaVMInstruction *const *i = insns; *i; i++)
+        {
+            uint16_t *types = g_new(uint16_t, paravm_get_instruction_register_count(*i));
+
+            infer_instruction(&inf, blocks[b], *i, types);
+            set_types(*i, types);
+        }
+    }
+
+    g_free(inf.state);
+    g_free(inf.reached);
+    g_free(inf.ins);
+    g_hash_table_destroy(inf.blocks);
+    g_hash_table_destroy(inf.regs);
+}
+
+void paravm_infer_module_types(const ParaVMModule *mod)
+{
+    assert(mod);
+
+    for (const ParaVMFunction *const *fun = paravm_get_functions(mod); *fun; fun++)
+        infer_function(*fun);
+}
+
+ParaVMType paravm_get_operand_types(const ParaVMInstruction *insn, size_t idx)
+{
+    assert(insn);
+    assert(idx < paravm_get_instruction_register_count(insn));
+
+    if (!insn->types)
+        return PARAVM_TYPE_ANY;
+
+    return (ParaVMType)((const uint16_t *)insn->types)[idx];
+}
@@ -0,0 +1,2470 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "interpret.h"
+#include "link.h"
+
+// Values are tagged with a single `ParaVMType` bit, so that
+// the interpreter and the type inference agree on kinds.
+typedef struct
+{
+    size_t refs;
+} Object;
+
+typedef struct
+{
+    uint16_t type;
+    union
+    {
+        int64_t i;
+        double f;
+        size_t atom;
+        Object *obj; // `null` for the empty list.
+    };
+} Value;
+
+// Kinds whose values live on the heap. Since values are
+// immutable, they can never form cycles, so counting
+// references is enough to reclaim them.
+#define HEAP_TYPES (PARAVM_TYPE_BIN | PARAVM_TYPE_FUNC | PARAVM_TYPE_TUP | \
+                    PARAVM_TYPE_LIST | PARAVM_TYPE_MAP | PARAVM_TYPE_SET)
+
+typedef struct
+{
+    Object obj;
+    size_t bits;
+    uint8_t data[];
+} Binary;
+
+// Holds the elements of a tuple, the sorted elements of a set,
+// or the key/value pairs of a map sorted by key.
+typedef struct
+{
+    Object obj;
+    size_t count; // Elements, or pairs for maps.
+    Value items[];
+} Array;
+
+typedef struct Cons
+{
+    Object obj;
+    Value head;
+    struct Cons *tail; // `null` at the end of the list.
+} Cons;
+
+typedef struct Insn Insn;
+
+// A function translated for the interpreter. Its arguments are
+// its first registers.
+typedef struct
+{
+    const ParaVMFunction *function;
+    size_t atom; // The function's name.
+    uint32_t arguments;
+    uint32_t registers;
+    Insn *code;
+    size_t size; // Instructions in `code`.
+} Function;
+
+typedef struct
+{
+    Object obj;
+    const Function *function;
+    size_t count; // Captured values.
+    Value items[];
+} Closure;
+
+// Returned by operations that did not throw.
+#define NO_REASON SIZE_MAX
+
+static Value nil_value(void)
+{
+    return (Value) { .type = PARAVM_TYPE_NIL, .i = 0 };
+}
+
+static Value int_value(int64_t i)
+{
+    return (Value) { .type = PARAVM_TYPE_INT, .i = i };
+}
+
+static Value flt_value(double f)
+{
+    return (Value) { .type = PARAVM_TYPE_FLT, .f = f };
+}
+
+static Value atom_value(size_t atom)
+{
+    return (Value) { .type = PARAVM_TYPE_ATOM, .atom = atom };
+}
+
+static Value bool_value(bool b)
+{
+    return atom_value(b ? PARAVM_ATOM_TRUE : PARAVM_ATOM_FALSE);
+}
+
+static Value obj_value(uint16_t type, void *obj)
+{
+    return (Value) { .type = type, .obj = obj };
+}
+
+static bool is_heap(Value v)
+{
+    return (v.type & HEAP_TYPES) && v.obj;
+}
+
+static Value retain(Value v)
+{
+    if (is_heap(v))
+        v.obj->refs++;
+
+    return v;
+}
+
+static void release(Value v);
+
+static void release_items(Value *items, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        release(items[i]);
+}
+
+static void destroy(Value v)
+{
+    switch (v.type)
+    {
+        case PARAVM_TYPE_BIN:
+            break;
+        case PARAVM_TYPE_FUNC:
+        {
+            Closure *c = (Closure *)v.obj;
+
+            release_items(c->items, c->count);
+
+            break;
+        }
+        case PARAVM_TYPE_TUP:
+        case PARAVM_TYPE_SET:
+        {
+            Array *a = (Array *)v.obj;
+
+            release_items(a->items, a->count);
+
+            break;
+        }
+        case PARAVM_TYPE_MAP:
+        {
+            Array *a = (Array *)v.obj;
+
+            release_items(a->items, a->count * 2);
+
+            break;
+        }
+        case PARAVM_TYPE_LIST:
+        {
+            // Lists are released iteratively so that long ones do
+            // not exhaust the C stack.
+            Cons *c = (Cons *)v.obj;
+
+            while (true)
+            {
+                Cons *next = c->tail;
+
+                release(c->head);
+                g_free(c);
+
+                if (!next || --next->obj.refs)
+                    break;
+
+                c = next;
+            }
+
+            return;
+        }
+        default:
+            assert_unreachable();
+            break;
+    }
+
+    g_free(v.obj);
+}
+
+static void release(Value v)
+{
+    if (is_heap(v) && !--v.obj->refs)
+        destroy(v);
+}
+
+// Stores `v`, which must already be retained, in `reg`.
+static void store(Value *reg, Value v)
+{
+    assert(reg);
+
+    Value old = *reg;
+
+    *reg = v;
+
+    release(old);
+}
+
+static Array *new_array(size_t count)
+{
+    Array *a = g_malloc(sizeof(Array) + count * sizeof(Value));
+
+    a->obj.refs = 1;
+    a->count = count;
+
+    return a;
+}
+
+// Allocates a set (`stride` 1) or map (`stride` 2) with room
+// for `count` entries.
+static Array *new_entries(size_t count, size_t stride)
+{
+    Array *a = g_malloc(sizeof(Array) + count * stride * sizeof(Value));
+
+    a->obj.refs = 1;
+    a->count = count;
+
+    return a;
+}
+
+static Binary *new_binary(size_t bits)
+{
+    Binary *b = g_malloc0(sizeof(Binary) + (bits + 7) / 8);
+
+    b->obj.refs = 1;
+    b->bits = bits;
+
+    return b;
+}
+
+static double to_flt(Value v)
+{
+    return v.type == PARAVM_TYPE_INT ? (double)v.i : v.f;
+}
+
+// Orders kinds for comparisons. Integers and floats compare by
+// value with each other.
+static int type_rank(uint16_t type)
+{
+    return type == PARAVM_TYPE_FLT ? PARAVM_TYPE_INT : type;
+}
+
+static int compare(const ParaVMAtomTable *table, Value a, Value b);
+
+static int compare_items(const ParaVMAtomTable *table, const Value *a, const Value *b, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int c = compare(table, a[i], b[i]);
+
+        if (c)
+            return c;
+    }
+
+    return 0;
+}
+
+static int compare_sizes(size_t a, size_t b)
+{
+    return a < b ? -1 : a > b;
+}
+
+static bool get_bit(const Binary *b, size_t bit)
+{
+    return (b->data[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+// Compares `a` and `b` in the total order of values: first
+// by kind, then by contents. Numbers compare numerically,
+// atoms by name, and containers by size and then elementwise,
+// except for lists and binaries, which compare like strings.
+static int compare(const ParaVMAtomTable *table, Value a, Value b)
+{
+    assert(table);
+
+    if (type_rank(a.type) != type_rank(b.type))
+        return type_rank(a.type) < type_rank(b.type) ? -1 : 1;
+
+    switch (a.type)
+    {
+        case PARAVM_TYPE_NIL:
+            return 0;
+        case PARAVM_TYPE_INT:
+        case PARAVM_TYPE_FLT:
+        {
+            if (a.type == PARAVM_TYPE_INT && b.type == PARAVM_TYPE_INT)
+                return a.i < b.i ? -1 : a.i > b.i;
+
+            double x = to_flt(a);
+            double y = to_flt(b);
+
+            return x < y ? -1 : x > y;
+        }
+        case PARAVM_TYPE_ATOM:
+            if (a.atom == b.atom)
+                return 0;
+
+            return strcmp(paravm_atom_to_string(table, a.atom), paravm_atom_to_string(table, b.atom));
+        case PARAVM_TYPE_BIN:
+        {
+            const Binary *x = (const Binary *)a.obj;
+            const Binary *y = (const Binary *)b.obj;
+            size_t bits = MIN(x->bits, y->bits);
+            int c = memcmp(x->data, y->data, bits / 8);
+
+            if (c)
+                return c < 0 ? -1 : 1;
+
+            for (size_t i = bits / 8 * 8; i < bits; i++)
+                if (get_bit(x, i) != get_bit(y, i))
+                    return get_bit(x, i) ? 1 : -1;
+
+            return compare_sizes(x->bits, y->bits);
+        }
+        case PARAVM_TYPE_FUNC:
+        {
+            const Closure *x = (const Closure *)a.obj;
+            const Closure *y = (const Closure *)b.obj;
+
+            if (x->function != y->function)
+                return x->function < y->function ? -1 : 1;
+
+            if (x->count != y->count)
+                return compare_sizes(x->count, y->count);
+
+            return compare_items(table, x->items, y->items, x->count);
+        }
+        case PARAVM_TYPE_TUP:
+        case PARAVM_TYPE_SET:
+        case PARAVM_TYPE_MAP:
+        {
+            const Array *x = (const Array *)a.obj;
+            const Array *y = (const Array *)b.obj;
+
+            if (x->count != y->count)
+                return compare_sizes(x->count, y->count);
+
+            return compare_items(table, x->items, y->items, a.type == PARAVM_TYPE_MAP ? x->count * 2 : x->count);
+        }
+        case PARAVM_TYPE_LIST:
+        {
+            const Cons *x = (const Cons *)a.obj;
+            const Cons *y = (const Cons *)b.obj;
+
+            for (; x && y; x = x->tail, y = y->tail)
+            {
+                int c = compare(table, x->head, y->head);
+
+                if (c)
+                    return c;
+            }
+
+            return x ? 1 : y ? -1 : 0;
+        }
+        default:
+            assert_unreachable();
+            return 0;
+    }
+}
+
+static void render(const ParaVMAtomTable *table, GString *str, Value v);
+
+static void render_items(const ParaVMAtomTable *table, GString *str, const Value *items, size_t count,
+                         size_t stride, const char *sep)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i)
+            g_string_append(str, ", ");
+
+        render(table, str, items[i * stride]);
+
+        if (sep)
+        {
+            g_string_append(str, sep);
+            render(table, str, items[i * stride + 1]);
+        }
+    }
+}
+
+// Appends the shortest representation of `f` that reads back
+// as the same value.
+static void render_float(GString *str, double f)
+{
+    assert(str);
+
+    char buf[32];
+
+    for (int prec = 15; prec <= 17; prec++)
+    {
+        snprintf(buf, sizeof(buf), "%.*g", prec, f);
+
+        if (strtod(buf, null) == f)
+            break;
+    }
+
+    g_string_append(str, buf);
+
+    if (!strpbrk(buf, ".e"))
+        g_string_append(str, ".0");
+}
+
+// Renders `v` in a syntax close to that of the assembler.
+static void render(const ParaVMAtomTable *table, GString *str, Value v)
+{
+    assert(table);
+    assert(str);
+
+    switch (v.type)
+    {
+        case PARAVM_TYPE_NIL:
+            g_string_append(str, "nil");
+
+            break;
+        case PARAVM_TYPE_INT:
+            g_string_append_printf(str, "%" PRId64, v.i);
+
+            break;
+        case PARAVM_TYPE_FLT:
+            render_float(str, v.f);
+
+            break;
+        case PARAVM_TYPE_ATOM:
+            g_string_append_c(str, '\'');
+
+            for (const char *p = paravm_atom_to_string(table, v.atom); *p; p++)
+            {
+                if (*p == '\'' || *p == '\\')
+                    g_string_append_c(str, '\\');
+
+                g_string_append_c(str, *p);
+            }
+
+            g_string_append_c(str, '\'');
+
+            break;
+        case PARAVM_TYPE_BIN:
+        {
+            const Binary *b = (const Binary *)v.obj;
+
+            g_string_append_c(str, ':');
+
+            for (size_t i = 0; i < b->bits; i++)
+                g_string_append_c(str, get_bit(b, i) ? '1' : '0');
+
+            g_string_append_c(str, ':');
+
+            break;
+        }
+        case PARAVM_TYPE_FUNC:
+        {
+            const Closure *c = (const Closure *)v.obj;
+
+            // Show how many arguments are still to be passed.
+            g_string_append_printf(str, "#func<%s/%zu>", c->function->function->name,
+                                   c->function->arguments - c->count);
+
+            break;
+        }
+        case PARAVM_TYPE_TUP:
+        {
+            const Array *a = (const Array *)v.obj;
+
+            g_string_append_c(str, '{');
+            render_items(table, str, a->items, a->count, 1, null);
+            g_string_append_c(str, '}');
+
+            break;
+        }
+        case PARAVM_TYPE_LIST:
+        {
+            g_string_append_c(str, '[');
+
+            for (const Cons *c = (const Cons *)v.obj; c; c = c->tail)
+            {
+                if (c != (const Cons *)v.obj)
+                    g_string_append(str, ", ");
+
+                render(table, str, c->head);
+            }
+
+            g_string_append_c(str, ']');
+
+            break;
+        }
+        case PARAVM_TYPE_MAP:
+        {
+            const Array *a = (const Array *)v.obj;
+
+            g_string_append(str, "%{");
+            render_items(table, str, a->items, a->count, 2, " => ");
+            g_string_append_c(str, '}');
+
+            break;
+        }
+        case PARAVM_TYPE_SET:
+        {
+            const Array *a = (const Array *)v.obj;
+
+            g_string_append(str, "#{");
+            render_items(table, str, a->items, a->count, 1, null);
+            g_string_append_c(str, '}');
+
+            break;
+        }
+        default:
+            assert_unreachable();
+            break;
+    }
+}
+
+typedef enum
+{
+    ARITH_ADD,
+    ARITH_SUB,
+    ARITH_MUL,
+    ARITH_DIV,
+    ARITH_REM,
+    ARITH_POW,
+} ArithOp;
+
+static size_t int_arith(ArithOp op, int64_t a, int64_t b, Value *out)
+{
+    assert(out);
+
+    int64_t r;
+
+    switch (op)
+    {
+        case ARITH_ADD:
+            if (__builtin_add_overflow(a, b, &r))
+                return PARAVM_ATOM_BADARITH;
+
+            break;
+        case ARITH_SUB:
+            if (__builtin_sub_overflow(a, b, &r))
+                return PARAVM_ATOM_BADARITH;
+
+            break;
+        case ARITH_MUL:
+            if (__builtin_mul_overflow(a, b, &r))
+                return PARAVM_ATOM_BADARITH;
+
+            break;
+        case ARITH_DIV:
+            if (!b || (a == INT64_MIN && b == -1))
+                return PARAVM_ATOM_BADARITH;
+
+            r = a / b;
+
+            break;
+        case ARITH_REM:
+            if (!b)
+                return PARAVM_ATOM_BADARITH;
+
+            r = b == -1 ? 0 : a % b;
+
+            break;
+        case ARITH_POW:
+        {
+            // Negative powers of integers are rarely integers.
+            if (b < 0)
+            {
+                double f = pow((double)a, (double)b);
+
+                if (!isfinite(f))
+                    return PARAVM_ATOM_BADARITH;
+
+                *out = flt_value(f);
+
+                return NO_REASON;
+            }
+
+            int64_t base = a;
+
+            r = 1;
+
+            for (uint64_t e = (uint64_t)b; e; e >>= 1)
+            {
+                if ((e & 1) && __builtin_mul_overflow(r, base, &r))
+                    return PARAVM_ATOM_BADARITH;
+
+                if (e > 1 && __builtin_mul_overflow(base, base, &base))
+                    return PARAVM_ATOM_BADARITH;
+            }
+
+            break;
+        }
+        default:
+            assert_unreachable();
+            return PARAVM_ATOM_BADARG;
+    }
+
+    *out = int_value(r);
+
+    return NO_REASON;
+}
+
+static size_t flt_arith(ArithOp op, double a, double b, Value *out)
+{
+    assert(out);
+
+    double r;
+
+    switch (op)
+    {
+        case ARITH_ADD:
+            r = a + b;
+            break;
+        case ARITH_SUB:
+            r = a - b;
+            break;
+        case ARITH_MUL:
+            r = a * b;
+            break;
+        case ARITH_DIV:
+            r = a / b;
+            break;
+        case ARITH_REM:
+            r = fmod(a, b);
+            break;
+        case ARITH_POW:
+            r = pow(a, b);
+            break;
+        default:
+            assert_unreachable();
+            return PARAVM_ATOM_BADARG;
+    }
+
+    // Infinities and NaNs never become values.
+    if (!isfinite(r))
+        return PARAVM_ATOM_BADARITH;
+
+    *out = flt_value(r);
+
+    return NO_REASON;
+}
+
+// Integers stay integers, but arithmetic involving a float
+// is done in floating point.
+static size_t arith(ArithOp op, Value a, Value b, Value *out)
+{
+    if (a.type == PARAVM_TYPE_INT && b.type == PARAVM_TYPE_INT)
+        return int_arith(op, a.i, b.i, out);
+
+    if (!(a.type & PARAVM_TYPE_NUM) || !(b.type & PARAVM_TYPE_NUM))
+        return PARAVM_ATOM_BADTYPE;
+
+    return flt_arith(op, to_flt(a), to_flt(b), out);
+}
+
+static size_t negate(Value a, Value *out)
+{
+    assert(out);
+
+    if (a.type == PARAVM_TYPE_FLT)
+        *out = flt_value(-a.f);
+    else if (a.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+    else if (a.i == INT64_MIN)
+        return PARAVM_ATOM_BADARITH;
+    else
+        *out = int_value(-a.i);
+
+    return NO_REASON;
+}
+
+typedef enum
+{
+    BITS_AND,
+    BITS_OR,
+    BITS_XOR,
+    BITS_SHL,
+    BITS_SHR,
+} BitsOp;
+
+static size_t bitwise(BitsOp op, Value a, Value b, Value *out)
+{
+    assert(out);
+
+    if (a.type != PARAVM_TYPE_INT || b.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    int64_t r;
+
+    switch (op)
+    {
+        case BITS_AND:
+            r = a.i & b.i;
+            break;
+        case BITS_OR:
+            r = a.i | b.i;
+            break;
+        case BITS_XOR:
+            r = a.i ^ b.i;
+            break;
+        case BITS_SHL:
+            if (b.i < 0 || b.i >= 64)
+                return PARAVM_ATOM_BADARG;
+
+            r = (int64_t)((uint64_t)a.i << b.i);
+
+            // Shifting out significant bits is an overflow.
+            if (r >> b.i != a.i)
+                return PARAVM_ATOM_BADARITH;
+
+            break;
+        case BITS_SHR:
+            if (b.i < 0 || b.i >= 64)
+                return PARAVM_ATOM_BADARG;
+
+            r = a.i >> b.i;
+
+            break;
+        default:
+            assert_unreachable();
+            return PARAVM_ATOM_BADARG;
+    }
+
+    *out = int_value(r);
+
+    return NO_REASON;
+}
+
+static size_t check_index(Value v, size_t count, size_t *idx)
+{
+    assert(idx);
+
+    if (v.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    if (v.i < 0 || (uint64_t)v.i >= count)
+        return PARAVM_ATOM_BADINDEX;
+
+    *idx = (size_t)v.i;
+
+    return NO_REASON;
+}
+
+static size_t tup_get(Value t, Value i, Value *out)
+{
+    assert(out);
+
+    if (t.type != PARAVM_TYPE_TUP)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Array *a = (const Array *)t.obj;
+    size_t idx;
+    size_t reason = check_index(i, a->count, &idx);
+
+    if (reason == NO_REASON)
+        *out = retain(a->items[idx]);
+
+    return reason;
+}
+
+static size_t tup_set(Value t, Value i, Value v, Value *out)
+{
+    assert(out);
+
+    if (t.type != PARAVM_TYPE_TUP)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Array *a = (const Array *)t.obj;
+    size_t idx;
+    size_t reason = check_index(i, a->count, &idx);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    Array *r = new_array(a->count);
+
+    for (size_t j = 0; j < a->count; j++)
+        r->items[j] = retain(j == idx ? v : a->items[j]);
+
+    *out = obj_value(PARAVM_TYPE_TUP, r);
+
+    return NO_REASON;
+}
+
+static size_t tup_del(Value t, Value i, Value *out)
+{
+    assert(out);
+
+    if (t.type != PARAVM_TYPE_TUP)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Array *a = (const Array *)t.obj;
+    size_t idx;
+    size_t reason = check_index(i, a->count, &idx);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    Array *r = new_array(a->count - 1);
+
+    for (size_t j = 0, k = 0; j < a->count; j++)
+        if (j != idx)
+            r->items[k++] = retain(a->items[j]);
+
+    *out = obj_value(PARAVM_TYPE_TUP, r);
+
+    return NO_REASON;
+}
+
+static Value cons(Value head, Cons *tail)
+{
+    Cons *c = g_new(Cons, 1);
+
+    c->obj.refs = 1;
+    c->head = head;
+    c->tail = tail;
+
+    return obj_value(PARAVM_TYPE_LIST, c);
+}
+
+// Finds `key` in the `count` sorted entries of `items`, each
+// of which is `stride` values wide. Returns whether it was
+// found; `*idx` is set to its position or to where it would
+// have to be inserted.
+static bool search(const ParaVMAtomTable *table, const Value *items, size_t count, size_t stride,
+                   Value key, size_t *idx)
+{
+    assert(table);
+    assert(idx);
+
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = compare(table, items[mid * stride], key);
+
+        if (!c)
+        {
+            *idx = mid;
+            return true;
+        }
+
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *idx = lo;
+
+    return false;
+}
+
+// Returns a copy of the sorted collection `a` (a set if
+// `stride` is 1, a map if it is 2) with `entry` inserted or,
+// if an entry with the same key exists, replacing it.
+static Array *insert(const ParaVMAtomTable *table, const Array *a, size_t stride, const Value *entry)
+{
+    assert(table);
+    assert(a);
+    assert(entry);
+
+    size_t idx;
+    bool found = search(table, a->items, a->count, stride, entry[0], &idx);
+    Array *r = new_entries(a->count + !found, stride);
+    size_t before = idx * stride;
+    size_t after = (a->count - idx - found) * stride;
+
+    for (size_t i = 0; i < before; i++)
+        r->items[i] = retain(a->items[i]);
+
+    for (size_t i = 0; i < stride; i++)
+        r->items[before + i] = retain(entry[i]);
+
+    for (size_t i = 0; i < after; i++)
+        r->items[before + stride + i] = retain(a->items[before + found * stride + i]);
+
+    return r;
+}
+
+// Returns a copy of `a` without the entry whose key is `key`.
+static Array *remove_entry(const ParaVMAtomTable *table, const Array *a, size_t stride, Value key)
+{
+    assert(table);
+    assert(a);
+
+    size_t idx;
+
+    if (!search(table, a->items, a->count, stride, key, &idx))
+    {
+        ((Array *)a)->obj.refs++;
+        return (Array *)a;
+    }
+
+    Array *r = new_entries(a->count - 1, stride);
+
+    for (size_t i = 0, k = 0; i < a->count * stride; i++)
+        if (i / stride != idx)
+            r->items[k++] = retain(a->items[i]);
+
+    return r;
+}
+
+// Builds a sorted collection from the `count` entries at
+// `entries`. Later entries replace earlier ones with the same
+// key.
+static Array *collect(const ParaVMAtomTable *table, const Value *entries, size_t count, size_t stride)
+{
+    assert(table);
+
+    Array *a = new_entries(0, stride);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Array *r = insert(table, a, stride, &entries[i * stride]);
+
+        release(obj_value(stride == 1 ? PARAVM_TYPE_SET : PARAVM_TYPE_MAP, a));
+
+        a = r;
+    }
+
+    return a;
+}
+
+// Makes a list of the entries of `a` at offset `which` of each
+// `stride` values, in order.
+static Value list_entries(const Array *a, size_t stride, size_t which)
+{
+    assert(a);
+
+    Value list = obj_value(PARAVM_TYPE_LIST, null);
+
+    for (size_t i = a->count; i; i--)
+        list = cons(retain(a->items[(i - 1) * stride + which]), (Cons *)list.obj);
+
+    return list;
+}
+
+static size_t get_endianness(size_t atom, bool *big)
+{
+    assert(big);
+
+    switch (atom)
+    {
+        case PARAVM_ATOM_LITTLE:
+            *big = false;
+            break;
+        case PARAVM_ATOM_BIG:
+            *big = true;
+            break;
+        case PARAVM_ATOM_NATIVE:
+            *big = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+            break;
+        default:
+            return PARAVM_ATOM_BADARG;
+    }
+
+    return NO_REASON;
+}
+
+// Reads `count` bits (at most 64) from `b` at bit `offset` as
+// an unsigned big-endian number.
+static uint64_t read_bits(const Binary *b, size_t offset, size_t count)
+{
+    assert(b);
+    assert(count <= 64);
+
+    uint64_t value = 0;
+
+    if (!(offset % 8) && !(count % 8))
+    {
+        for (size_t i = 0; i < count / 8; i++)
+            value = value << 8 | b->data[offset / 8 + i];
+
+        return value;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        value = value << 1 | get_bit(b, offset + i);
+
+    return value;
+}
+
+static void write_bits(Binary *b, size_t offset, size_t count, uint64_t value)
+{
+    assert(b);
+    assert(count <= 64);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t bit = offset + i;
+        uint8_t mask = (uint8_t)(1 << (7 - bit % 8));
+
+        if ((value >> (count - 1 - i)) & 1)
+            b->data[bit / 8] |= mask;
+        else
+            b->data[bit / 8] &= (uint8_t)~mask;
+    }
+}
+
+// Reverses the order of the bytes in the low `count` bits of
+// `value`. `count` must be a multiple of 8.
+static uint64_t swap_bytes(uint64_t value, size_t count)
+{
+    uint64_t r = 0;
+
+    for (size_t i = 0; i < count / 8; i++)
+        r = r << 8 | ((value >> (i * 8)) & 0xff);
+
+    return r;
+}
+
+static size_t check_range(const Binary *b, Value offset, Value count, size_t *off, size_t *len)
+{
+    assert(b);
+    assert(off);
+    assert(len);
+
+    if (offset.type != PARAVM_TYPE_INT || count.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    if (offset.i < 0 || count.i < 0)
+        return PARAVM_ATOM_BADARG;
+
+    if ((uint64_t)offset.i > b->bits || (uint64_t)count.i > b->bits - (uint64_t)offset.i)
+        return PARAVM_ATOM_BADINDEX;
+
+    *off = (size_t)offset.i;
+    *len = (size_t)count.i;
+
+    return NO_REASON;
+}
+
+// Reads `count` bits as a number, honoring `big` if `count` is
+// a whole number of bytes.
+static size_t decode(Value bin, Value offset, size_t count, bool big, uint64_t *out)
+{
+    assert(out);
+
+    if (bin.type != PARAVM_TYPE_BIN)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Binary *b = (const Binary *)bin.obj;
+    size_t off;
+    size_t len;
+    size_t reason = check_range(b, offset, int_value((int64_t)count), &off, &len);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    if (!big && count % 8)
+        return PARAVM_ATOM_BADARG;
+
+    uint64_t value = read_bits(b, off, len);
+
+    *out = big ? value : swap_bytes(value, count);
+
+    return NO_REASON;
+}
+
+// Returns a copy of `bin` with `count` bits of `value` written
+// at `offset`, extending it as needed. `offset` can be at most
+// the size of `bin`.
+static size_t encode(Value bin, Value offset, size_t count, bool big, uint64_t value, Value *out)
+{
+    assert(out);
+
+    if (bin.type != PARAVM_TYPE_BIN || offset.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Binary *b = (const Binary *)bin.obj;
+
+    if (offset.i < 0)
+        return PARAVM_ATOM_BADARG;
+
+    if ((uint64_t)offset.i > b->bits)
+        return PARAVM_ATOM_BADINDEX;
+
+    if (!big && count % 8)
+        return PARAVM_ATOM_BADARG;
+
+    size_t off = (size_t)offset.i;
+    Binary *r = new_binary(MAX(b->bits, off + count));
+
+    memcpy(r->data, b->data, (b->bits + 7) / 8);
+    write_bits(r, off, count, big ? value : swap_bytes(value, count));
+
+    *out = obj_value(PARAVM_TYPE_BIN, r);
+
+    return NO_REASON;
+}
+
+static size_t bin_dbin(Value bin, Value offset, Value count, Value *out)
+{
+    assert(out);
+
+    if (bin.type != PARAVM_TYPE_BIN)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Binary *b = (const Binary *)bin.obj;
+    size_t off;
+    size_t len;
+    size_t reason = check_range(b, offset, count, &off, &len);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    Binary *r = new_binary(len);
+
+    for (size_t i = 0; i < len; i += 64)
+        write_bits(r, i, MIN(64, len - i), read_bits(b, off + i, MIN(64, len - i)));
+
+    *out = obj_value(PARAVM_TYPE_BIN, r);
+
+    return NO_REASON;
+}
+
+static size_t bin_ebin(Value bin, Value offset, Value src, Value *out)
+{
+    assert(out);
+
+    if (src.type != PARAVM_TYPE_BIN)
+        return PARAVM_ATOM_BADTYPE;
+
+    const Binary *s = (const Binary *)src.obj;
+    Value r = retain(bin);
+
+    // Write the source a word at a time; each step copies the
+    // result, but binaries written this way are small.
+    if (!s->bits)
+    {
+        size_t reason = encode(bin, offset, 0, true, 0, &r);
+
+        release(bin);
+
+        return reason == NO_REASON ? (*out = r, NO_REASON) : reason;
+    }
+
+    for (size_t i = 0; i < s->bits; i += 64)
+    {
+        size_t len = MIN(64, s->bits - i);
+        Value next;
+        size_t reason = offset.type == PARAVM_TYPE_INT ?
+                        encode(r, int_value(offset.i + (int64_t)i), len, true, read_bits(s, i, len), &next) :
+                        PARAVM_ATOM_BADTYPE;
+
+        release(r);
+
+        if (reason != NO_REASON)
+            return reason;
+
+        r = next;
+    }
+
+    *out = r;
+
+    return NO_REASON;
+}
+
+static size_t bin_efloat(Value bin, Value offset, Value value, size_t bits, bool big, Value *out)
+{
+    assert(out);
+
+    if (!(value.type & PARAVM_TYPE_NUM))
+        return PARAVM_ATOM_BADTYPE;
+
+    double f = to_flt(value);
+    uint64_t raw;
+
+    if (bits == 32)
+    {
+        float s = (float)f;
+        uint32_t raw32;
+
+        memcpy(&raw32, &s, sizeof(raw32));
+
+        raw = raw32;
+    }
+    else
+        memcpy(&raw, &f, sizeof(raw));
+
+    return encode(bin, offset, bits, big, raw, out);
+}
+
+static size_t bin_dfloat(Value bin, Value offset, size_t bits, bool big, Value *out)
+{
+    assert(out);
+
+    uint64_t raw;
+    size_t reason = decode(bin, offset, bits, big, &raw);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    double f;
+
+    if (bits == 32)
+    {
+        uint32_t raw32 = (uint32_t)raw;
+        float s;
+
+        memcpy(&s, &raw32, sizeof(s));
+
+        f = s;
+    }
+    else
+        memcpy(&f, &raw, sizeof(f));
+
+    if (!isfinite(f))
+        return PARAVM_ATOM_BADARITH;
+
+    *out = flt_value(f);
+
+    return NO_REASON;
+}
+
+static size_t check_width(Value count, size_t *bits)
+{
+    assert(bits);
+
+    if (count.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    if (count.i < 1 || count.i > 64)
+        return PARAVM_ATOM_BADARG;
+
+    *bits = (size_t)count.i;
+
+    return NO_REASON;
+}
+
+static size_t bin_eisu(Value bin, Value offset, Value count, Value value, bool big, Value *out)
+{
+    assert(out);
+
+    size_t bits;
+    size_t reason = check_width(count, &bits);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    if (value.type != PARAVM_TYPE_INT)
+        return PARAVM_ATOM_BADTYPE;
+
+    uint64_t raw = (uint64_t)value.i;
+
+    // Only the low `bits` bits are kept, so signed and unsigned
+    // numbers are encoded alike.
+    if (bits < 64)
+        raw &= ((uint64_t)1 << bits) - 1;
+
+    return encode(bin, offset, bits, big, raw, out);
+}
+
+static size_t bin_dint(Value bin, Value offset, Value count, bool big, bool is_signed, Value *out)
+{
+    assert(out);
+
+    size_t bits;
+    size_t reason = check_width(count, &bits);
+
+    if (reason != NO_REASON)
+        return reason;
+
+    uint64_t raw;
+
+    if ((reason = decode(bin, offset, bits, big, &raw)) != NO_REASON)
+        return reason;
+
+    if (is_signed && bits < 64 && (raw >> (bits - 1)) & 1)
+        raw |= ~(uint64_t)0 << bits;
+    else if (!is_signed && raw > INT64_MAX)
+        return PARAVM_ATOM_BADARITH;
+
+    *out = int_value((int64_t)raw);
+
+    return NO_REASON;
+}
+
+// Opcodes for instructions whose operands are known to be of
+// the kinds they accept, which skip the checks. These follow
+// the codes of the instruction set. They are only sound if
+// every opcode that can throw has `PARAVM_OPCODE_FLAG_THROWS`,
+// so that inference sees all states that reach a handler;
+// debug builds assert the kinds instead of trusting them.
+enum
+{
+    OP_ADD_II = 256,
+    OP_SUB_II,
+    OP_MUL_II,
+    OP_ADD_FF,
+    OP_SUB_FF,
+    OP_MUL_FF,
+    OP_DIV_FF,
+    OP_LT_JUMP_II,
+    OP_GT_JUMP_II,
+    OP_EQ_JUMP_II,
+    OP_NEQ_JUMP_II,
+    OP_LTEQ_JUMP_II,
+    OP_GTEQ_JUMP_II,
+    OP_ADD_INT_I,
+    OP_TUP_GET_TI,
+    OP_UNDEF, // The body of a function without blocks.
+    OP_COUNT,
+};
+
+#define NO_REGISTER UINT32_MAX
+
+// A pre-decoded instruction. Register operands are indices
+// into the frame, branch targets point straight at the
+// instructions to continue at, and `label` is the address of
+// the code that executes the instruction.
+struct Insn
+{
+    const void *label;
+    const uint32_t *extra; // All registers, including additional ones.
+    const Insn *handler; // Where to go if the instruction throws, or `null`.
+    uint32_t exception; // Register to store thrown values in, or `NO_REGISTER`.
+    uint32_t op;
+    uint32_t count; // Registers, including additional ones.
+    uint32_t r[6];
+    union
+    {
+        int64_t i;
+        double f;
+        size_t atom;
+        Binary *bin;
+        bool big;
+        const Insn *target[2];
+        const Function *callee; // The function a call or `load.func` was linked to, or `null`.
+    } imm;
+};
+
+typedef struct
+{
+    const Function *function;
+    const Insn *ret; // The call to return to in the caller, or `null`.
+    size_t base; // Index of the first register in the stack.
+    Value caught; // The last exception caught in the frame.
+} Frame;
+
+typedef struct
+{
+    const ParaVMProgram *program;
+    const ParaVMAtomTable *table;
+    Value *stack;
+    size_t top;
+    size_t capacity;
+    Frame *frames;
+    size_t depth;
+    size_t frame_capacity;
+} Machine;
+
+// Pushes a frame for `fn` with all registers set to `nil`,
+// and returns its registers. This can move the registers of
+// the other frames.
+static Value *push_frame(Machine *m, const Function *fn, const Insn *ret)
+{
+    assert(m);
+    assert(fn);
+
+    if (m->top + fn->registers > m->capacity)
+    {
+        m->capacity = MAX(m->capacity * 2, m->top + fn->registers);
+        m->stack = g_renew(Value, m->stack, m->capacity);
+    }
+
+    if (m->depth == m->frame_capacity)
+    {
+        m->frame_capacity = MAX(m->frame_capacity * 2, 16u);
+        m->frames = g_renew(Frame, m->frames, m->frame_capacity);
+    }
+
+    Frame *f = &m->frames[m->depth++];
+
+    f->function = fn;
+    f->ret = ret;
+    f->base = m->top;
+    f->caught = nil_value();
+
+    Value *regs = m->stack + m->top;
+
+    for (uint32_t i = 0; i < fn->registers; i++)
+        regs[i] = nil_value();
+
+    m->top += fn->registers;
+
+    return regs;
+}
+
+// Pops the innermost frame, and returns the call to continue
+// after in the caller, or `null` if it was the outermost one.
+static const Insn *pop_frame(Machine *m)
+{
+    assert(m);
+    assert(m->depth);
+
+    Frame *f = &m->frames[--m->depth];
+
+    release_items(m->stack + f->base, f->function->registers);
+    release(f->caught);
+
+    m->top = f->base;
+
+    return f->ret;
+}
+
+static Value *frame_registers(const Machine *m)
+{
+    assert(m);
+    assert(m->depth);
+
+    return m->stack + m->frames[m->depth - 1].base;
+}
+
+// Finds the function named by the atoms `mod` and `fn`. Only
+// functions in the program itself can be found.
+static size_t resolve(const Machine *m, Value mod, Value fn, const Function **callee)
+{
+    assert(m);
+    assert(callee);
+
+    if (mod.type != PARAVM_TYPE_ATOM || fn.type != PARAVM_TYPE_ATOM)
+        return PARAVM_ATOM_BADTYPE;
+
+    if (mod.atom != m->program->module_atom)
+        return PARAVM_ATOM_UNDEF;
+
+    *callee = g_hash_table_lookup((GHashTable *)m->program->function_table, GSIZE_TO_POINTER(fn.atom + 1));
+
+    return *callee ? NO_REASON : PARAVM_ATOM_UNDEF;
+}
+
+// Copies a sorted collection's entries out of the registers
+// of `insn` that follow the first one.
+static Array *collect_registers(const ParaVMAtomTable *table, const Insn *insn, const Value *regs,
+                                size_t stride)
+{
+    assert(table);
+    assert(insn);
+    assert(regs);
+
+    size_t count = insn->count - 1u;
+    Value *entries = g_new(Value, count);
+
+    for (size_t i = 0; i < count; i++)
+        entries[i] = regs[insn->extra[i + 1]];
+
+    Array *a = collect(table, entries, count / stride, stride);
+
+    g_free(entries);
+
+    return a;
+}
+
+// Runs `entry` with the `count` values at `args`, which are
+// consumed, and stores the value it returns or throws in
+// `*result`.
+//
+// If `labels` is not `null`, nothing is run; instead, the
+// table of the addresses that execute each opcode is stored in
+// `*labels`, for threading the code of functions.
+static ParaVMRunResult execute(Machine *m, const Function *entry, Value *args, size_t count, Value *result,
+                               const void *const **labels)
+{
+    static const void *const table[OP_COUNT] =
+    {
+        [PARAVM_CODE_NOOP] = &&op_noop,
+        [PARAVM_CODE_COPY] = &&op_copy,
+        [PARAVM_CODE_TYPE] = &&op_type,
+        [PARAVM_CODE_LOAD_NIL] = &&op_load_nil,
+        [PARAVM_CODE_LOAD_INT] = &&op_load_int,
+        [PARAVM_CODE_LOAD_FLT] = &&op_load_flt,
+        [PARAVM_CODE_LOAD_ATOM] = &&op_load_atom,
+        [PARAVM_CODE_LOAD_BIN] = &&op_load_bin,
+        [PARAVM_CODE_LOAD_FUNC] = &&op_load_func,
+        [PARAVM_CODE_NUM_ADD] = &&op_num_add,
+        [PARAVM_CODE_NUM_SUB] = &&op_num_sub,
+        [PARAVM_CODE_NUM_MUL] = &&op_num_mul,
+        [PARAVM_CODE_NUM_DIV] = &&op_num_div,
+        [PARAVM_CODE_NUM_REM] = &&op_num_rem,
+        [PARAVM_CODE_NUM_POW] = &&op_num_pow,
+        [PARAVM_CODE_NUM_NEG] = &&op_num_neg,
+        [PARAVM_CODE_NUM_AND] = &&op_num_and,
+        [PARAVM_CODE_NUM_OR] = &&op_num_or,
+        [PARAVM_CODE_NUM_XOR] = &&op_num_xor,
+        [PARAVM_CODE_NUM_NOT] = &&op_num_not,
+        [PARAVM_CODE_NUM_SHL] = &&op_num_shl,
+        [PARAVM_CODE_NUM_SHR] = &&op_num_shr,
+        [PARAVM_CODE_CMP_LT] = &&op_cmp_lt,
+        [PARAVM_CODE_CMP_GT] = &&op_cmp_gt,
+        [PARAVM_CODE_CMP_EQ] = &&op_cmp_eq,
+        [PARAVM_CODE_CMP_NEQ] = &&op_cmp_neq,
+        [PARAVM_CODE_CMP_LTEQ] = &&op_cmp_lteq,
+        [PARAVM_CODE_CMP_GTEQ] = &&op_cmp_gteq,
+        [PARAVM_CODE_CALL_REM] = &&op_call_rem,
+        [PARAVM_CODE_CALL_FUNC] = &&op_call_func,
+        [PARAVM_CODE_CALL_UP] = &&op_call_rem,
+        [PARAVM_CODE_TUP_MAKE] = &&op_tup_make,
+        [PARAVM_CODE_TUP_GET] = &&op_tup_get,
+        [PARAVM_CODE_TUP_SET] = &&op_tup_set,
+        [PARAVM_CODE_TUP_DEL] = &&op_tup_del,
+        [PARAVM_CODE_TUP_SIZE] = &&op_tup_size,
+        [PARAVM_CODE_LIST_MAKE] = &&op_list_make,
+        [PARAVM_CODE_LIST_HEAD] = &&op_list_head,
+        [PARAVM_CODE_LIST_TAIL] = &&op_list_tail,
+        [PARAVM_CODE_LIST_CONS] = &&op_list_cons,
+        [PARAVM_CODE_MAP_MAKE] = &&op_map_make,
+        [PARAVM_CODE_MAP_ADD] = &&op_map_add,
+        [PARAVM_CODE_MAP_GET] = &&op_map_get,
+        [PARAVM_CODE_MAP_DEL] = &&op_map_del,
+        [PARAVM_CODE_MAP_SIZE] = &&op_map_size,
+        [PARAVM_CODE_MAP_KEYS] = &&op_map_keys,
+        [PARAVM_CODE_MAP_VALS] = &&op_map_vals,
+        [PARAVM_CODE_SET_MAKE] = &&op_set_make,
+        [PARAVM_CODE_SET_ADD] = &&op_set_add,
+        [PARAVM_CODE_SET_FIND] = &&op_set_find,
+        [PARAVM_CODE_SET_DEL] = &&op_set_del,
+        [PARAVM_CODE_SET_SIZE] = &&op_set_size,
+        [PARAVM_CODE_SET_VALS] = &&op_set_vals,
+        [PARAVM_CODE_BIN_SIZE] = &&op_bin_size,
+        [PARAVM_CODE_BIN_EBIN] = &&op_bin_ebin,
+        [PARAVM_CODE_BIN_DBIN] = &&op_bin_dbin,
+        [PARAVM_CODE_BIN_EFS] = &&op_bin_efs,
+        [PARAVM_CODE_BIN_EFD] = &&op_bin_efd,
+        [PARAVM_CODE_BIN_DFS] = &&op_bin_dfs,
+        [PARAVM_CODE_BIN_DFD] = &&op_bin_dfd,
+        [PARAVM_CODE_BIN_EISU] = &&op_bin_eisu,
+        [PARAVM_CODE_BIN_DIS] = &&op_bin_dis,
+        [PARAVM_CODE_BIN_DIU] = &&op_bin_diu,
+        [PARAVM_CODE_JUMP_GOTO] = &&op_jump_goto,
+        [PARAVM_CODE_JUMP_COND] = &&op_jump_cond,
+        [PARAVM_CODE_JUMP_RET] = &&op_jump_ret,
+        [PARAVM_CODE_EXC_NEW] = &&op_exc_new,
+        [PARAVM_CODE_EXC_GET] = &&op_exc_get,
+        [PARAVM_CODE_EXC_CONT] = &&op_exc_cont,
+        [PARAVM_CODE_CMP_LT_JUMP] = &&op_cmp_lt_jump,
+        [PARAVM_CODE_CMP_GT_JUMP] = &&op_cmp_gt_jump,
+        [PARAVM_CODE_CMP_EQ_JUMP] = &&op_cmp_eq_jump,
+        [PARAVM_CODE_CMP_NEQ_JUMP] = &&op_cmp_neq_jump,
+        [PARAVM_CODE_CMP_LTEQ_JUMP] = &&op_cmp_lteq_jump,
+        [PARAVM_CODE_CMP_GTEQ_JUMP] = &&op_cmp_gteq_jump,
+        [PARAVM_CODE_NUM_ADD_INT] = &&op_num_add_int,
+        [PARAVM_CODE_TUP_GET_GET] = &&op_tup_get_get,
+        [OP_ADD_II] = &&op_add_ii,
+        [OP_SUB_II] = &&op_sub_ii,
+        [OP_MUL_II] = &&op_mul_ii,
+        [OP_ADD_FF] = &&op_add_ff,
+        [OP_SUB_FF] = &&op_sub_ff,
+        [OP_MUL_FF] = &&op_mul_ff,
+        [OP_DIV_FF] = &&op_div_ff,
+        [OP_LT_JUMP_II] = &&op_lt_jump_ii,
+        [OP_GT_JUMP_II] = &&op_gt_jump_ii,
+        [OP_EQ_JUMP_II] = &&op_eq_jump_ii,
+        [OP_NEQ_JUMP_II] = &&op_neq_jump_ii,
+        [OP_LTEQ_JUMP_II] = &&op_lteq_jump_ii,
+        [OP_GTEQ_JUMP_II] = &&op_gteq_jump_ii,
+        [OP_ADD_INT_I] = &&op_add_int_i,
+        [OP_TUP_GET_TI] = &&op_tup_get_ti,
+        [OP_UNDEF] = &&op_undef,
+    };
+
+    if (labels)
+    {
+        *labels = table;
+        return PARAVM_RUN_OK;
+    }
+
+    assert(m);
+    assert(entry);
+    assert(count == entry->arguments);
+    assert(result);
+
+    const ParaVMAtomTable *atoms = m->table;
+    Value *regs = push_frame(m, entry, null);
+    const Insn *pc = entry->code;
+    Value v;
+    Value exc;
+    size_t reason;
+
+    for (size_t i = 0; i < count; i++)
+        regs[i] = args[i];
+
+    // Each instruction jumps straight to the code for the next
+    // one, so that every opcode has its own indirect branch
+    // for the CPU to predict.
+#define DISPATCH() goto *pc->label
+#define NEXT() \
+    do \
+    { \
+        pc++; \
+        DISPATCH(); \
+    } while (false)
+#define R(n) regs[pc->r[n]]
+#define X(n) regs[pc->extra[n]]
+#define THROW(atom) \
+    do \
+    { \
+        exc = atom_value(atom); \
+        goto unwind; \
+    } while (false)
+#define INT_OP(fn) \
+    do \
+    { \
+        int64_t r_; \
+        assert(R(1).type == PARAVM_TYPE_INT && R(2).type == PARAVM_TYPE_INT); \
+        if (fn(R(1).i, R(2).i, &r_)) \
+            THROW(PARAVM_ATOM_BADARITH); \
+        store(&R(0), int_value(r_)); \
+        NEXT(); \
+    } while (false)
+#define FLT_OP(op) \
+    do \
+    { \
+        assert(R(1).type == PARAVM_TYPE_FLT && R(2).type == PARAVM_TYPE_FLT); \
+        double r_ = R(1).f op R(2).f; \
+        if (!isfinite(r_)) \
+            THROW(PARAVM_ATOM_BADARITH); \
+        store(&R(0), flt_value(r_)); \
+        NEXT(); \
+    } while (false)
+#define CMP(cond) \
+    do \
+    { \
+        int c_ = compare(atoms, R(1), R(2)); \
+        store(&R(0), bool_value(cond)); \
+        NEXT(); \
+    } while (false)
+#define CMP_JUMP(cond) \
+    do \
+    { \
+        int c_ = compare(atoms, R(1), R(2)); \
+        bool b_ = cond; \
+        store(&R(0), bool_value(b_)); \
+        pc = pc->imm.target[!b_]; \
+        DISPATCH(); \
+    } while (false)
+#define INT_CMP_JUMP(op) \
+    do \
+    { \
+        assert(R(1).type == PARAVM_TYPE_INT && R(2).type == PARAVM_TYPE_INT); \
+        bool b_ = R(1).i op R(2).i; \
+        store(&R(0), bool_value(b_)); \
+        pc = pc->imm.target[!b_]; \
+        DISPATCH(); \
+    } while (false)
+
+    DISPATCH();
+
+op_noop:
+    NEXT();
+op_copy:
+    v = retain(R(1));
+    store(&R(0), v);
+    NEXT();
+op_type:
+    store(&R(0), atom_value(PARAVM_ATOM_NIL + (size_t)__builtin_ctz(R(1).type)));
+    NEXT();
+op_load_nil:
+    store(&R(0), nil_value());
+    NEXT();
+op_load_int:
+    store(&R(0), int_value(pc->imm.i));
+    NEXT();
+op_load_flt:
+    store(&R(0), flt_value(pc->imm.f));
+    NEXT();
+op_load_atom:
+    store(&R(0), atom_value(pc->imm.atom));
+    NEXT();
+op_load_bin:
+    pc->imm.bin->obj.refs++;
+    store(&R(0), obj_value(PARAVM_TYPE_BIN, pc->imm.bin));
+    NEXT();
+op_load_func:
+{
+    const Function *callee = pc->imm.callee;
+
+    if ((reason = callee ? NO_REASON : resolve(m, R(1), R(2), &callee)) != NO_REASON)
+        goto result;
+
+    size_t captured = pc->count - 3u;
+
+    if (captured > callee->arguments)
+    {
+        reason = PARAVM_ATOM_BADARITY;
+        goto result;
+    }
+
+    Closure *c = g_malloc(sizeof(Closure) + captured * sizeof(Value));
+
+    c->obj.refs = 1;
+    c->function = callee;
+    c->count = captured;
+
+    for (size_t i = 0; i < captured; i++)
+        c->items[i] = retain(X(3 + i));
+
+    v = obj_value(PARAVM_TYPE_FUNC, c);
+
+    goto result;
+}
+op_num_add:
+    reason = arith(ARITH_ADD, R(1), R(2), &v);
+    goto result;
+op_num_sub:
+    reason = arith(ARITH_SUB, R(1), R(2), &v);
+    goto result;
+op_num_mul:
+    reason = arith(ARITH_MUL, R(1), R(2), &v);
+    goto result;
+op_num_div:
+    reason = arith(ARITH_DIV, R(1), R(2), &v);
+    goto result;
+op_num_rem:
+    reason = arith(ARITH_REM, R(1), R(2), &v);
+    goto result;
+op_num_pow:
+    reason = arith(ARITH_POW, R(1), R(2), &v);
+    goto result;
+op_num_neg:
+    reason = negate(R(1), &v);
+    goto result;
+op_num_and:
+    reason = bitwise(BITS_AND, R(1), R(2), &v);
+    goto result;
+op_num_or:
+    reason = bitwise(BITS_OR, R(1), R(2), &v);
+    goto result;
+op_num_xor:
+    reason = bitwise(BITS_XOR, R(1), R(2), &v);
+    goto result;
+op_num_not:
+    if (R(1).type != PARAVM_TYPE_INT)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), int_value(~R(1).i));
+    NEXT();
+op_num_shl:
+    reason = bitwise(BITS_SHL, R(1), R(2), &v);
+    goto result;
+op_num_shr:
+    reason = bitwise(BITS_SHR, R(1), R(2), &v);
+    goto result;
+op_cmp_lt:
+    CMP(c_ < 0);
+op_cmp_gt:
+    CMP(c_ > 0);
+op_cmp_eq:
+    CMP(!c_);
+op_cmp_neq:
+    CMP(c_);
+op_cmp_lteq:
+    CMP(c_ <= 0);
+op_cmp_gteq:
+    CMP(c_ >= 0);
+op_call_rem:
+{
+    const Function *callee = pc->imm.callee;
+
+    if ((reason = callee ? NO_REASON : resolve(m, R(1), R(2), &callee)) != NO_REASON)
+        THROW(reason);
+
+    if (pc->count - 3u != callee->arguments)
+        THROW(PARAVM_ATOM_BADARITY);
+
+    Value *callee_regs = push_frame(m, callee, pc);
+
+    regs = m->stack + m->frames[m->depth - 2].base;
+
+    for (uint32_t i = 0; i < callee->arguments; i++)
+        callee_regs[i] = retain(X(3 + i));
+
+    regs = callee_regs;
+    pc = callee->code;
+
+    DISPATCH();
+}
+op_call_func:
+{
+    if (R(1).type != PARAVM_TYPE_FUNC)
+        THROW(PARAVM_ATOM_BADFUNC);
+
+    const Closure *c = (const Closure *)R(1).obj;
+    const Function *callee = c->function;
+    size_t passed = pc->count - 2u;
+
+    if (c->count + passed != callee->arguments)
+        THROW(PARAVM_ATOM_BADARITY);
+
+    Value *callee_regs = push_frame(m, callee, pc);
+
+    regs = m->stack + m->frames[m->depth - 2].base;
+
+    for (size_t i = 0; i < c->count; i++)
+        callee_regs[i] = retain(c->items[i]);
+
+    for (size_t i = 0; i < passed; i++)
+        callee_regs[c->count + i] = retain(X(2 + i));
+
+    regs = callee_regs;
+    pc = callee->code;
+
+    DISPATCH();
+}
+op_tup_make:
+{
+    Array *a = new_array(pc->count - 1u);
+
+    for (size_t i = 0; i < a->count; i++)
+        a->items[i] = retain(X(1 + i));
+
+    store(&R(0), obj_value(PARAVM_TYPE_TUP, a));
+    NEXT();
+}
+op_tup_get:
+    reason = tup_get(R(1), R(2), &v);
+    goto result;
+op_tup_set:
+    reason = tup_set(R(1), R(2), R(3), &v);
+    goto result;
+op_tup_del:
+    reason = tup_del(R(1), R(2), &v);
+    goto result;
+op_tup_size:
+    if (R(1).type != PARAVM_TYPE_TUP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), int_value((int64_t)((const Array *)R(1).obj)->count));
+    NEXT();
+op_list_make:
+    v = obj_value(PARAVM_TYPE_LIST, null);
+
+    for (size_t i = pc->count - 1u; i; i--)
+        v = cons(retain(X(i)), (Cons *)v.obj);
+
+    store(&R(0), v);
+    NEXT();
+op_list_head:
+    if (R(1).type != PARAVM_TYPE_LIST)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    if (!R(1).obj)
+        THROW(PARAVM_ATOM_BADARG);
+
+    v = retain(((const Cons *)R(1).obj)->head);
+    store(&R(0), v);
+    NEXT();
+op_list_tail:
+    if (R(1).type != PARAVM_TYPE_LIST)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    if (!R(1).obj)
+        THROW(PARAVM_ATOM_BADARG);
+
+    v = retain(obj_value(PARAVM_TYPE_LIST, ((const Cons *)R(1).obj)->tail));
+    store(&R(0), v);
+    NEXT();
+op_list_cons:
+    if (R(2).type != PARAVM_TYPE_LIST)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    v = retain(R(2));
+    v = cons(retain(R(1)), (Cons *)v.obj);
+    store(&R(0), v);
+    NEXT();
+op_map_make:
+    if ((pc->count - 1u) % 2)
+        THROW(PARAVM_ATOM_BADARG);
+
+    store(&R(0), obj_value(PARAVM_TYPE_MAP, collect_registers(atoms, pc, regs, 2)));
+    NEXT();
+op_map_add:
+{
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    Value pair[] = { R(2), R(3) };
+
+    store(&R(0), obj_value(PARAVM_TYPE_MAP, insert(atoms, (const Array *)R(1).obj, 2, pair)));
+    NEXT();
+}
+op_map_get:
+{
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    const Array *a = (const Array *)R(1).obj;
+    size_t idx;
+
+    if (!search(atoms, a->items, a->count, 2, R(2), &idx))
+        THROW(PARAVM_ATOM_BADKEY);
+
+    v = retain(a->items[idx * 2 + 1]);
+    store(&R(0), v);
+    NEXT();
+}
+op_map_del:
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), obj_value(PARAVM_TYPE_MAP, remove_entry(atoms, (const Array *)R(1).obj, 2, R(2))));
+    NEXT();
+op_map_size:
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), int_value((int64_t)((const Array *)R(1).obj)->count));
+    NEXT();
+op_map_keys:
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), list_entries((const Array *)R(1).obj, 2, 0));
+    NEXT();
+op_map_vals:
+    if (R(1).type != PARAVM_TYPE_MAP)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), list_entries((const Array *)R(1).obj, 2, 1));
+    NEXT();
+op_set_make:
+    store(&R(0), obj_value(PARAVM_TYPE_SET, collect_registers(atoms, pc, regs, 1)));
+    NEXT();
+op_set_add:
+    if (R(1).type != PARAVM_TYPE_SET)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), obj_value(PARAVM_TYPE_SET, insert(atoms, (const Array *)R(1).obj, 1, &R(2))));
+    NEXT();
+op_set_find:
+{
+    if (R(1).type != PARAVM_TYPE_SET)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    const Array *a = (const Array *)R(1).obj;
+    size_t idx;
+
+    store(&R(0), bool_value(search(atoms, a->items, a->count, 1, R(2), &idx)));
+    NEXT();
+}
+op_set_del:
+    if (R(1).type != PARAVM_TYPE_SET)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), obj_value(PARAVM_TYPE_SET, remove_entry(atoms, (const Array *)R(1).obj, 1, R(2))));
+    NEXT();
+op_set_size:
+    if (R(1).type != PARAVM_TYPE_SET)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), int_value((int64_t)((const Array *)R(1).obj)->count));
+    NEXT();
+op_set_vals:
+    if (R(1).type != PARAVM_TYPE_SET)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), list_entries((const Array *)R(1).obj, 1, 0));
+    NEXT();
+op_bin_size:
+    if (R(1).type != PARAVM_TYPE_BIN)
+        THROW(PARAVM_ATOM_BADTYPE);
+
+    store(&R(0), int_value((int64_t)((const Binary *)R(1).obj)->bits));
+    NEXT();
+op_bin_ebin:
+    reason = bin_ebin(R(1), R(2), R(3), &v);
+    goto result;
+op_bin_dbin:
+    reason = bin_dbin(R(1), R(2), R(3), &v);
+    goto result;
+op_bin_efs:
+    reason = bin_efloat(R(1), R(2), R(3), 32, pc->imm.big, &v);
+    goto result;
+op_bin_efd:
+    reason = bin_efloat(R(1), R(2), R(3), 64, pc->imm.big, &v);
+    goto result;
+op_bin_dfs:
+    reason = bin_dfloat(R(1), R(2), 32, pc->imm.big, &v);
+    goto result;
+op_bin_dfd:
+    reason = bin_dfloat(R(1), R(2), 64, pc->imm.big, &v);
+    goto result;
+op_bin_eisu:
+    reason = bin_eisu(R(1), R(2), R(3), R(4), pc->imm.big, &v);
+    goto result;
+op_bin_dis:
+    reason = bin_dint(R(1), R(2), R(3), pc->imm.big, true, &v);
+    goto result;
+op_bin_diu:
+    reason = bin_dint(R(1), R(2), R(3), pc->imm.big, false, &v);
+    goto result;
+op_jump_goto:
+    pc = pc->imm.target[0];
+    DISPATCH();
+op_jump_cond:
+{
+    Value c = R(0);
+
+    pc = pc->imm.target[!(c.type == PARAVM_TYPE_ATOM && c.atom == PARAVM_ATOM_TRUE)];
+    DISPATCH();
+}
+op_jump_ret:
+{
+    v = retain(R(0));
+
+    const Insn *ret = pop_frame(m);
+
+    if (!ret)
+    {
+        *result = v;
+        return PARAVM_RUN_OK;
+    }
+
+    pc = ret;
+    regs = frame_registers(m);
+
+    store(&R(0), v);
+    NEXT();
+}
+op_exc_new:
+    exc = retain(R(0));
+    goto unwind;
+op_exc_get:
+    v = retain(m->frames[m->depth - 1].caught);
+    store(&R(0), v);
+    NEXT();
+op_exc_cont:
+    exc = retain(m->frames[m->depth - 1].caught);
+    goto unwind;
+op_cmp_lt_jump:
+    CMP_JUMP(c_ < 0);
+op_cmp_gt_jump:
+    CMP_JUMP(c_ > 0);
+op_cmp_eq_jump:
+    CMP_JUMP(!c_);
+op_cmp_neq_jump:
+    CMP_JUMP(c_);
+op_cmp_lteq_jump:
+    CMP_JUMP(c_ <= 0);
+op_cmp_gteq_jump:
+    CMP_JUMP(c_ >= 0);
+op_num_add_int:
+    store(&R(2), int_value(pc->imm.i));
+    reason = arith(ARITH_ADD, R(1), R(2), &v);
+    goto result;
+op_tup_get_get:
+    if ((reason = tup_get(R(1), R(2), &v)) != NO_REASON)
+        THROW(reason);
+
+    store(&R(0), v);
+
+    if ((reason = tup_get(R(4), R(5), &v)) != NO_REASON)
+        THROW(reason);
+
+    store(&R(3), v);
+    NEXT();
+op_add_ii:
+    INT_OP(__builtin_add_overflow);
+op_sub_ii:
+    INT_OP(__builtin_sub_overflow);
+op_mul_ii:
+    INT_OP(__builtin_mul_overflow);
+op_add_ff:
+    FLT_OP(+);
+op_sub_ff:
+    FLT_OP(-);
+op_mul_ff:
+    FLT_OP(*);
+op_div_ff:
+    FLT_OP(/);
+op_lt_jump_ii:
+    INT_CMP_JUMP(<);
+op_gt_jump_ii:
+    INT_CMP_JUMP(>);
+op_eq_jump_ii:
+    INT_CMP_JUMP(==);
+op_neq_jump_ii:
+    INT_CMP_JUMP(!=);
+op_lteq_jump_ii:
+    INT_CMP_JUMP(<=);
+op_gteq_jump_ii:
+    INT_CMP_JUMP(>=);
+op_add_int_i:
+{
+    int64_t r;
+
+    store(&R(2), int_value(pc->imm.i));
+
+    assert(R(1).type == PARAVM_TYPE_INT);
+
+    if (__builtin_add_overflow(R(1).i, pc->imm.i, &r))
+        THROW(PARAVM_ATOM_BADARITH);
+
+    store(&R(0), int_value(r));
+    NEXT();
+}
+op_tup_get_ti:
+{
+    assert(R(1).type == PARAVM_TYPE_TUP && R(2).type == PARAVM_TYPE_INT);
+
+    const Array *a = (const Array *)R(1).obj;
+    int64_t idx = R(2).i;
+
+    if (idx < 0 || (uint64_t)idx >= a->count)
+        THROW(PARAVM_ATOM_BADINDEX);
+
+    v = retain(a->items[idx]);
+    store(&R(0), v);
+    NEXT();
+}
+op_undef:
+    THROW(PARAVM_ATOM_UNDEF);
+
+    // Stores the result of an operation that can throw.
+result:
+    if (reason != NO_REASON)
+        THROW(reason);
+
+    store(&R(0), v);
+    NEXT();
+
+    // Transfers control to the handler of the instruction that
+    // threw, or to that of the call it is in.
+unwind:
+    while (true)
+    {
+        if (pc->handler)
+        {
+            Frame *f = &m->frames[m->depth - 1];
+
+            if (pc->exception != NO_REGISTER)
+                store(&regs[pc->exception], retain(exc));
+
+            store(&f->caught, exc);
+
+            pc = pc->handler;
+
+            DISPATCH();
+        }
+
+        const Insn *ret = pop_frame(m);
+
+        if (!ret)
+        {
+            *result = exc;
+            return PARAVM_RUN_EXCEPTION;
+        }
+
+        pc = ret;
+        regs = frame_registers(m);
+    }
+
+#undef DISPATCH
+#undef NEXT
+#undef R
+#undef X
+#undef THROW
+#undef INT_OP
+#undef FLT_OP
+#undef CMP
+#undef CMP_JUMP
+#undef INT_CMP_JUMP
+}
+
+static bool both_are(const ParaVMLinkedInstruction *insn, ParaVMType type)
+{
+    assert(insn);
+
+    return insn->types[1] == type && insn->types[2] == type;
+}
+
+// Picks the opcode to execute `insn` with, preferring ones
+// that skip checks when the operands' kinds are known.
+static uint32_t select_op(const ParaVMLinkedInstruction *insn)
+{
+    assert(insn);
+
+    switch (insn->opcode->code)
+    {
+        case PARAVM_CODE_NUM_ADD:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_ADD_II :
+                   both_are(insn, PARAVM_TYPE_FLT) ? OP_ADD_FF : PARAVM_CODE_NUM_ADD;
+        case PARAVM_CODE_NUM_SUB:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_SUB_II :
+                   both_are(insn, PARAVM_TYPE_FLT) ? OP_SUB_FF : PARAVM_CODE_NUM_SUB;
+        case PARAVM_CODE_NUM_MUL:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_MUL_II :
+                   both_are(insn, PARAVM_TYPE_FLT) ? OP_MUL_FF : PARAVM_CODE_NUM_MUL;
+        case PARAVM_CODE_NUM_DIV:
+            return both_are(insn, PARAVM_TYPE_FLT) ? OP_DIV_FF : PARAVM_CODE_NUM_DIV;
+        case PARAVM_CODE_CMP_LT_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_LT_JUMP_II : PARAVM_CODE_CMP_LT_JUMP;
+        case PARAVM_CODE_CMP_GT_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_GT_JUMP_II : PARAVM_CODE_CMP_GT_JUMP;
+        case PARAVM_CODE_CMP_EQ_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_EQ_JUMP_II : PARAVM_CODE_CMP_EQ_JUMP;
+        case PARAVM_CODE_CMP_NEQ_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_NEQ_JUMP_II : PARAVM_CODE_CMP_NEQ_JUMP;
+        case PARAVM_CODE_CMP_LTEQ_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_LTEQ_JUMP_II : PARAVM_CODE_CMP_LTEQ_JUMP;
+        case PARAVM_CODE_CMP_GTEQ_JUMP:
+            return both_are(insn, PARAVM_TYPE_INT) ? OP_GTEQ_JUMP_II : PARAVM_CODE_CMP_GTEQ_JUMP;
+        case PARAVM_CODE_NUM_ADD_INT:
+            return insn->types[1] == PARAVM_TYPE_INT ? OP_ADD_INT_I : PARAVM_CODE_NUM_ADD_INT;
+        case PARAVM_CODE_TUP_GET:
+            return insn->types[1] == PARAVM_TYPE_TUP && insn->types[2] == PARAVM_TYPE_INT ?
+                   OP_TUP_GET_TI : PARAVM_CODE_TUP_GET;
+        default:
+            return insn->opcode->code;
+    }
+}
+
+static bool is_endianness_op(uint8_t code)
+{
+    return code >= PARAVM_CODE_BIN_EFS && code <= PARAVM_CODE_BIN_DIU;
+}
+
+// Translates the linked operand of `insn` into `out`. Branch
+// targets are relative to `code`, and resolved functions to
+// `fns`.
+static void translate_operand(const ParaVMLinkedInstruction *insn, const Function *fns, Insn *code, Insn *out)
+{
+    assert(insn);
+    assert(fns);
+    assert(code);
+    assert(out);
+
+    if (insn->function != PARAVM_LINK_NONE)
+        out->imm.callee = &fns[insn->function];
+
+    switch (insn->opcode->operand)
+    {
+        case PARAVM_OPERAND_TYPE_NONE:
+            break;
+        case PARAVM_OPERAND_TYPE_INTEGER:
+            out->imm.i = insn->operand.integer;
+            break;
+        case PARAVM_OPERAND_TYPE_FLOAT:
+            out->imm.f = insn->operand.real;
+            break;
+        case PARAVM_OPERAND_TYPE_ATOM:
+            // The verifier has made sure that endianness atoms
+            // are valid.
+            if (is_endianness_op(insn->opcode->code))
+                get_endianness(insn->operand.atom, &out->imm.big);
+            else
+                out->imm.atom = insn->operand.atom;
+
+            break;
+        case PARAVM_OPERAND_TYPE_BINARY:
+        {
+            Binary *b = new_binary(insn->operand.binary.size);
+
+            memcpy(b->data, insn->operand.binary.data, (b->bits + 7) / 8);
+
+            out->imm.bin = b;
+
+            break;
+        }
+        case PARAVM_OPERAND_TYPE_BLOCK:
+            out->imm.target[0] = code + insn->operand.targets[0];
+            break;
+        case PARAVM_OPERAND_TYPE_BLOCKS:
+            out->imm.target[0] = code + insn->operand.targets[0];
+            out->imm.target[1] = code + insn->operand.targets[1];
+            break;
+        default:
+            assert_unreachable();
+            break;
+    }
+}
+
+// Translates the linked code of `fn` into instructions for
+// the interpreter.
+static void compile_function(Function *fn, const ParaVMLinkedFunction *linked, const Function *fns,
+                             const void *const *labels)
+{
+    assert(fn);
+    assert(linked);
+    assert(fns);
+    assert(labels);
+
+    fn->arguments = linked->arguments;
+    fn->registers = linked->slots;
+
+    // A function without blocks cannot be called.
+    if (!linked->length)
+    {
+        fn->size = 1;
+        fn->code = g_new0(Insn, 1);
+        fn->code->op = OP_UNDEF;
+        fn->code->label = labels[OP_UNDEF];
+        fn->code->exception = NO_REGISTER;
+
+        return;
+    }
+
+    fn->size = linked->length;
+    fn->code = g_new0(Insn, fn->size);
+
+    for (size_t i = 0; i < fn->size; i++)
+    {
+        const ParaVMLinkedInstruction *insn = &linked->code[i];
+        Insn *out = &fn->code[i];
+
+        out->op = select_op(insn);
+        out->label = labels[out->op];
+        out->extra = insn->registers;
+        out->count = insn->register_count;
+        out->handler = insn->handler != PARAVM_LINK_NONE ? fn->code + insn->handler : null;
+        out->exception = insn->exception;
+
+        for (size_t r = 0; r < MIN(out->count, G_N_ELEMENTS(out->r)); r++)
+            out->r[r] = insn->registers[r];
+
+        translate_operand(insn, fns, fn->code, out);
+    }
+}
+
+ParaVMError paravm_create_program(const ParaVMModule *mod, const ParaVMProgram **program)
+{
+    assert(mod);
+    assert(mod->atom_table);
+    assert(program);
+
+    const ParaVMLinkedModule *linked;
+    ParaVMError err;
+
+    if ((err = paravm_link_module(mod, &linked)))
+        return err;
+
+    const void *const *labels;
+
+    execute(null, null, null, 0, null, &labels);
+
+    ParaVMAtomTable *table = (ParaVMAtomTable *)mod->atom_table;
+    ParaVMProgram *prog = g_new0(ParaVMProgram, 1);
+    Function *fns = g_new0(Function, linked->function_count);
+    GHashTable *fn_table = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+
+    prog->module = mod;
+    prog->linked = linked;
+    prog->functions = fns;
+    prog->function_table = fn_table;
+    prog->module_atom = paravm_string_to_retained_atom(table, mod->name);
+
+    for (size_t f = 0; f < linked->function_count; f++)
+    {
+        fns[f].function = linked->functions[f].function;
+        fns[f].atom = paravm_string_to_retained_atom(table, fns[f].function->name);
+
+        g_hash_table_insert(fn_table, GSIZE_TO_POINTER(fns[f].atom + 1), &fns[f]);
+
+        compile_function(&fns[f], &linked->functions[f], fns, labels);
+    }
+
+    *program = prog;
+
+    return PARAVM_ERROR_OK;
+}
+
+void paravm_destroy_program(const ParaVMProgram *program)
+{
+    if (program)
+    {
+        ParaVMAtomTable *table = (ParaVMAtomTable *)program->module->atom_table;
+        Function *fns = (Function *)program->functions;
+        size_t count = paravm_get_function_count(program->module);
+
+        for (size_t f = 0; f < count; f++)
+        {
+            for (size_t i = 0; i < fns[f].size; i++)
+                if (fns[f].code[i].op == PARAVM_CODE_LOAD_BIN)
+                    release(obj_value(PARAVM_TYPE_BIN, fns[f].code[i].imm.bin));
+
+            paravm_release_atom(table, fns[f].atom);
+
+            g_free(fns[f].code);
+        }
+
+        paravm_release_atom(table, program->module_atom);
+        paravm_destroy_linked_module(program->linked);
+
+        g_hash_table_destroy((GHashTable *)program->function_table);
+        g_free(fns);
+        g_free((ParaVMProgram *)program);
+    }
+}
+
+// Makes a list of binaries holding the bytes of `args`.
+static Value make_arguments(const char *const *args)
+{
+    assert(args);
+
+    size_t count = 0;
+
+    while (args[count])
+        count++;
+
+    Value list = obj_value(PARAVM_TYPE_LIST, null);
+
+    for (size_t i = count; i; i--)
+    {
+        size_t len = strlen(args[i - 1]);
+        Binary *b = new_binary(len * 8);
+
+        memcpy(b->data, args[i - 1], len);
+
+        list = cons(obj_value(PARAVM_TYPE_BIN, b), (Cons *)list.obj);
+    }
+
+    return list;
+}
+
+ParaVMRunResult paravm_run_program(const ParaVMProgram *program, const char *entry,
+                                   const char *const *args, char **value)
+{
+    assert(program);
+    assert(entry);
+    assert(args);
+    assert(value);
+
+    *value = null;
+
+    const ParaVMFunction *func = paravm_get_function(program->module, entry);
+
+    if (!func)
+        return PARAVM_RUN_NO_ENTRY;
+
+    const Function *fn = program->functions;
+
+    while (fn->function != func)
+        fn++;
+
+    if (fn->arguments > 1)
+        return PARAVM_RUN_BAD_ENTRY;
+
+    Machine m = {
+        .program = program,
+        .table = program->module->atom_table,
+    };
+    Value arg = fn->arguments ? make_arguments(args) : nil_value();
+    Value result;
+    ParaVMRunResult r = execute(&m, fn, &arg, fn->arguments, &result, null);
+    GString *str = g_string_new(null);
+
+    render(m.table, str, result);
+    release(result);
+
+    g_free(m.stack);
+    g_free(m.frames);
+
+    *value = g_string_free(str, false);
+
+    return r;
+}
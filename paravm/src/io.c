@@ -6,52 +6,14 @@
 
 #include <glib.h>
 
+#include "internal/syserror.h"
+
 #include "io.h"
 
 const uint32_t paravm_version = 5;
 
 const uint32_t paravm_fourcc = 0x43565000;
 
-static ParaVMError errno_to_error(int err)
-{
-    assert(err);
-
-    switch (err)
-    {
-        case EROFS:
-            return PARAVM_ERROR_READ_ONLY;
-        case EACCES:
-            return PARAVM_ERROR_ACCESS;
-        case ETXTBSY:
-            return PARAVM_ERROR_BUSY;
-        case EINTR:
-            return PARAVM_ERROR_IO_INTERRUPT;
-        case EISDIR:
-            return PARAVM_ERROR_DIRECTORY;
-        case ELOOP:
-        case EMFILE:
-        case ENFILE:
-        case ENOMEM:
-        case EFBIG:
-            return PARAVM_ERROR_LIMIT;
-        case EOVERFLOW:
-            return PARAVM_ERROR_EOF;
-        case ENAMETOOLONG:
-            return PARAVM_ERROR_PATH_LENGTH;
-        case ENOENT:
-            return PARAVM_ERROR_NONEXISTENT;
-        case ENOSPC:
-            return PARAVM_ERROR_NO_SPACE;
-        case ENOTDIR:
-            return PARAVM_ERROR_NOT_DIRECTORY;
-        case EIO:
-            return PARAVM_ERROR_IO;
-        default:
-            assert_unreachable();
-            return PARAVM_ERROR_OK;
-    }
-}
-
 static void write(jmp_buf *sjlj, FILE *f, const void *data, size_t size)
 {
     assert(sjlj);
@@ -220,16 +182,72 @@ ParaVMError paravm_write_module(const ParaVMModule *mod, const char *path)
     return PARAVM_ERROR_OK;
 }
 
-ParaVMError paravm_read_module(const char *path, const ParaVMModule *mod)
+ParaVMError paravm_write_image(const void *data, size_t size, const char *path)
 {
+    assert(data);
     assert(path);
-    assert(mod);
+
+    FILE *f = fopen(path, "w");
+
+    if (!f)
+        return errno_to_error(errno);
+
+    if (size && !fwrite(data, size, 1, f))
+    {
+        int err = errno;
+
+        fclose(f);
+        return errno_to_error(err);
+    }
+
+    if (fclose(f))
+        return errno_to_error(errno);
+
+    return PARAVM_ERROR_OK;
+}
+
+ParaVMError paravm_read_image(const char *path, void **data, size_t *size)
+{
+    assert(path);
+    assert(data);
+    assert(size);
 
     FILE *f = fopen(path, "r");
 
     if (!f)
         return errno_to_error(errno);
 
+    GByteArray *buf = g_byte_array_new();
+    uint8_t chunk[65536];
+    size_t len;
+
+    while ((len = fread(chunk, 1, sizeof(chunk), f)))
+        g_byte_array_append(buf, chunk, (guint)len);
+
+    if (ferror(f))
+    {
+        int err = errno;
+
+        g_byte_array_free(buf, true);
+        fclose(f);
+        return errno_to_error(err);
+    }
+
+    fclose(f);
+
+    *size = buf->len;
+    *data = g_byte_array_free(buf, false);
+
+    return PARAVM_ERROR_OK;
+}
+
+// Loads the module that `f` contains into `mod`. `f` is
+// closed in all cases.
+static ParaVMError read_module(FILE *f, const ParaVMModule *mod)
+{
+    assert(f);
+    assert(mod);
+
     jmp_buf sjlj;
 
     if (setjmp(sjlj))
@@ -445,7 +463,7 @@ ParaVMError paravm_read_module(const char *path, const ParaVMModule *mod)
                 const ParaVMInstruction *ins = paravm_create_instruction(opc,
                                                                          operand,
                                                                          own_operand,
-                                                                         (const ParaVMRegister *const *)insn_regs);
+                                                                         (const ParaVMRegister *const *)insn_regs->pdata);
 
                 g_ptr_array_free(insn_regs, true);
 
@@ -463,6 +481,36 @@ ParaVMError paravm_read_module(const char *path, const ParaVMModule *mod)
     return PARAVM_ERROR_OK;
 }
 
+ParaVMError paravm_read_module(const char *path, const ParaVMModule *mod)
+{
+    assert(path);
+    assert(mod);
+
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return errno_to_error(errno);
+
+    return read_module(f, mod);
+}
+
+ParaVMError paravm_read_module_image(const void *data, size_t size, const ParaVMModule *mod)
+{
+    assert(data || !size);
+    assert(mod);
+
+    // An empty image is simply cut short before its header.
+    if (!size)
+        return PARAVM_ERROR_EOF;
+
+    FILE *f = fmemopen((void *)data, size, "r");
+
+    if (!f)
+        return errno_to_error(errno);
+
+    return read_module(f, mod);
+}
+
 static const char pva_ext[] = ".pva";
 static const char pvc_ext[] = ".pvc";
 
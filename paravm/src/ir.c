@@ -40,6 +40,8 @@ const ParaVMInstruction *paravm_create_instruction(const ParaVMOpCode *op,
 
     i->block = null;
     i->opcode = op;
+    i->atom = SIZE_MAX;
+    i->types = null;
 
     if (op->operand == PARAVM_OPERAND_TYPE_BLOCK ||
         op->operand == PARAVM_OPERAND_TYPE_BLOCKS)
@@ -68,11 +70,13 @@ const ParaVMInstruction *paravm_create_instruction(const ParaVMOpCode *op,
 
 void paravm_destroy_instruction(const ParaVMInstruction *insn)
 {
-    if (insn && insn->own_operand)
+    if (insn)
     {
-        g_free((void *)insn->operand.string);
+        if (insn->own_operand)
+            g_free((void *)insn->operand.string);
 
         g_array_free((GArray *)insn->registers, true);
+        g_free((void *)insn->types);
     }
 
     g_free((ParaVMInstruction *)insn);
@@ -364,6 +368,7 @@ const ParaVMModule *paravm_create_module(const char *name)
     ParaVMModule *m = g_new(ParaVMModule, 1);
 
     m->name = g_strdup(name);
+    m->atom_table = null;
 
     m->function_table = g_hash_table_new_full(&g_str_hash, &g_str_equal, null,
                                               (GDestroyNotify)&paravm_destroy_function);
@@ -372,10 +377,26 @@ const ParaVMModule *paravm_create_module(const char *name)
     return m;
 }
 
+static void release_module_atoms(const ParaVMModule *mod)
+{
+    assert(mod);
+
+    ParaVMAtomTable *table = (ParaVMAtomTable *)mod->atom_table;
+
+    for (const ParaVMFunction *const *f = paravm_get_functions(mod); *f; f++)
+        for (const ParaVMBlock *const *b = paravm_get_blocks(*f); *b; b++)
+            for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++)
+                if ((*i)->atom != SIZE_MAX)
+                    paravm_release_atom(table, (*i)->atom);
+}
+
 void paravm_destroy_module(const ParaVMModule *mod)
 {
     if (mod)
     {
+        if (mod->atom_table)
+            release_module_atoms(mod);
+
         g_free((char *)mod->name);
 
         g_hash_table_destroy((GHashTable *)mod->function_table);
@@ -423,3 +444,45 @@ size_t paravm_get_function_count(const ParaVMModule *mod)
 
     return ((GArray *)mod->function_list)->len;
 }
+
+void paravm_intern_module_atoms(const ParaVMModule *mod, ParaVMAtomTable *table)
+{
+    assert(mod);
+    assert(table);
+    assert(!mod->atom_table || mod->atom_table == table);
+
+    GPtrArray *insns = g_ptr_array_new();
+    GPtrArray *strs = g_ptr_array_new();
+
+    for (const ParaVMFunction *const *f = paravm_get_functions(mod); *f; f++)
+    {
+        for (const ParaVMBlock *const *b = paravm_get_blocks(*f); *b; b++)
+        {
+            for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++)
+            {
+                // Instructions interned by an earlier call already
+                // hold a reference.
+                if ((*i)->opcode->operand != PARAVM_OPERAND_TYPE_ATOM || (*i)->atom != SIZE_MAX)
+                    continue;
+
+                g_ptr_array_add(insns, (ParaVMInstruction *)*i);
+                g_ptr_array_add(strs, (char *)(*i)->operand.string);
+            }
+        }
+    }
+
+    size_t *atoms = g_new(size_t, insns->len);
+
+    // Keep the atoms alive for as long as the module is.
+    if (insns->len)
+        paravm_strings_to_retained_atoms(table, (const char *const *)strs->pdata, insns->len, atoms);
+
+    for (guint i = 0; i < insns->len; i++)
+        ((ParaVMInstruction *)g_ptr_array_index(insns, i))->atom = atoms[i];
+
+    ((ParaVMModule *)mod)->atom_table = table;
+
+    g_free(atoms);
+    g_ptr_array_free(insns, true);
+    g_ptr_array_free(strs, true);
+}
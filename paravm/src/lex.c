@@ -1,12 +1,21 @@
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__)
+#    include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#    include <arm_neon.h>
+#endif
+
 #include <glib.h>
 
 #include "lex.h"
 #include "opcode.h"
 
+#include "internal/syserror.h"
+
 ParaVMToken *paravm_create_token(ParaVMTokenType type, char *value,
                                  uint32_t line, uint32_t column)
 {
@@ -41,370 +50,861 @@ void paravm_destroy_token(ParaVMToken *tok)
 #define CHAR_BRACKET_CLOSE 0x0000005D
 #define CHAR_SEMICOLON 0x0000003B
 #define CHAR_PERIOD 0x0000002E
-#define CHAR_E_LOWER 0x00000065
-#define CHAR_E_UPPER 0x00000045
-#define CHAR_PLUS 0x0000002B
-#define CHAR_MINUS 0x0000002D
 #define CHAR_COLON 0x0000003A
-#define CHAR_ONE 0x00000031
-#define CHAR_ZERO 0x00000030
 
-ParaVMError paravm_lex_string(const char *str, ParaVMToken ***tokens,
-                              uint32_t *line, uint32_t *column)
+// Returned by `peek_char` at the end of the input and for
+// malformed UTF-8, respectively. Neither is a valid code point.
+#define CHAR_END UINT32_MAX
+#define CHAR_BAD (UINT32_MAX - 1)
+
+// The kinds of byte runs that `scan_run` can skip over.
+typedef enum
 {
-    assert(str);
-    assert(tokens);
-    assert(line);
-    assert(column);
+    SCAN_SPACE, // ASCII white space.
+    SCAN_COMMENT, // Anything up to a line feed.
+    SCAN_QUOTE, // String contents up to `"`, `\` or a line feed.
+    SCAN_APOSTROPHE, // Atom contents up to `'`, `\` or a line feed.
+    SCAN_WORD, // ASCII letters and periods.
+    SCAN_DIGITS, // ASCII digits.
+} ScanKind;
+
+// Checks whether `b` ends a run of `kind`. Non-ASCII bytes
+// and the null terminator end every kind of run, so that the
+// caller can fall back to decoding UTF-8.
+static inline bool is_stop(unsigned char b, ScanKind kind)
+{
+    if (b & 0x80)
+        return true;
 
-    *tokens = null;
-    *line = 1;
-    *column = 0;
+    switch (kind)
+    {
+        case SCAN_SPACE:
+            return b != ' ' && b != '\t' && b != '\n' && b != '\f' && b != '\r';
+        case SCAN_COMMENT:
+            return !b || b == '\n';
+        case SCAN_QUOTE:
+            return !b || b == '\n' || b == '\\' || b == '"';
+        case SCAN_APOSTROPHE:
+            return !b || b == '\n' || b == '\\' || b == '\'';
+        case SCAN_WORD:
+            return ((b | 0x20) < 'a' || (b | 0x20) > 'z') && b != '.';
+        case SCAN_DIGITS:
+            return b < '0' || b > '9';
+        default:
+            assert_unreachable();
+            return true;
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+
+#if defined(__SSE2__)
+
+typedef __m128i Vector;
+
+// Number of mask bits per byte produced by `vec_mask`.
+#define VEC_BITS 1
+
+#define vec_load(P) _mm_load_si128((const __m128i *)(P))
+#define vec_eq(V, B) _mm_cmpeq_epi8(V, _mm_set1_epi8(B))
+#define vec_or(A, B) _mm_or_si128(A, B)
+#define vec_not(V) _mm_xor_si128(V, _mm_set1_epi8(-1))
+#define vec_high(V) _mm_cmplt_epi8(V, _mm_setzero_si128())
+#define vec_mask(V) ((uint64_t)(uint32_t)_mm_movemask_epi8(V))
+
+// Bytes are signed here, so bytes with the high bit set are
+// never in range.
+#define vec_range(V, LO, HI) \
+    _mm_and_si128(_mm_cmpgt_epi8(V, _mm_set1_epi8((LO) - 1)), _mm_cmplt_epi8(V, _mm_set1_epi8((HI) + 1)))
 
-    __block const char *lstr = str;
+#else
 
-    if (!g_utf8_validate(lstr, -1, null))
-        return PARAVM_ERROR_BAD_UTF8;
+typedef uint8x16_t Vector;
 
-    gunichar (^ peek_char)(void) = ^(void)
+// NEON has no equivalent of `movemask`, so narrow each byte
+// of the comparison result to four bits instead.
+#define VEC_BITS 4
+
+#define vec_load(P) vld1q_u8((const uint8_t *)(P))
+#define vec_eq(V, B) vceqq_u8(V, vdupq_n_u8(B))
+#define vec_or(A, B) vorrq_u8(A, B)
+#define vec_not(V) vmvnq_u8(V)
+#define vec_high(V) vcgeq_u8(V, vdupq_n_u8(0x80))
+#define vec_mask(V) vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(V), 4)), 0)
+#define vec_range(V, LO, HI) vandq_u8(vcgeq_u8(V, vdupq_n_u8(LO)), vcleq_u8(V, vdupq_n_u8(HI)))
+
+#endif
+
+// Vector equivalent of `is_stop`.
+paravm_inline
+static inline uint64_t stop_mask(Vector v, ScanKind kind)
+{
+    Vector stop;
+
+    switch (kind)
     {
-        if (!*lstr)
-            return UINT32_MAX;
+        case SCAN_SPACE:
+            stop = vec_not(vec_or(vec_or(vec_eq(v, ' '), vec_eq(v, '\t')),
+                                  vec_or(vec_eq(v, '\n'), vec_or(vec_eq(v, '\f'), vec_eq(v, '\r')))));
+            break;
+        case SCAN_COMMENT:
+            stop = vec_or(vec_eq(v, '\0'), vec_eq(v, '\n'));
+            break;
+        case SCAN_QUOTE:
+            stop = vec_or(vec_or(vec_eq(v, '\0'), vec_eq(v, '\n')), vec_or(vec_eq(v, '\\'), vec_eq(v, '"')));
+            break;
+        case SCAN_APOSTROPHE:
+            stop = vec_or(vec_or(vec_eq(v, '\0'), vec_eq(v, '\n')), vec_or(vec_eq(v, '\\'), vec_eq(v, '\'')));
+            break;
+        case SCAN_WORD:
+            stop = vec_not(vec_or(vec_or(vec_range(v, 'a', 'z'), vec_range(v, 'A', 'Z')), vec_eq(v, '.')));
+            break;
+        case SCAN_DIGITS:
+            stop = vec_not(vec_range(v, '0', '9'));
+            break;
+        default:
+            assert_unreachable();
+            stop = v;
+            break;
+    }
 
-        return g_utf8_get_char(lstr);
-    };
+    return vec_mask(vec_or(stop, vec_high(v)));
+}
+
+// Returns the number of bytes at `p` before the first byte
+// that ends a run of `kind`.
+//
+// Only aligned blocks are loaded. This can read bytes before
+// `p` and after the null terminator, which is harmless since
+// an aligned block cannot cross a page boundary, but it does
+// upset the address sanitizer.
+no_asan
+static size_t scan_run(const char *p, ScanKind kind)
+{
+    size_t offset = (uintptr_t)p % sizeof(Vector);
+    const char *block = p - offset;
+    uint64_t mask = stop_mask(vec_load(block), kind) >> (offset * VEC_BITS);
+
+    if (mask)
+        return (size_t)__builtin_ctzll(mask) / VEC_BITS;
 
-    __block uint32_t lline = 1;
-    __block uint32_t lcolumn = 0;
+    size_t n = sizeof(Vector) - offset;
 
-    gunichar (^ next_char)(void) = ^(void)
+    while (true)
     {
-        if (!*lstr)
-            return UINT32_MAX;
+        block += sizeof(Vector);
+        mask = stop_mask(vec_load(block), kind);
+
+        if (mask)
+            return n + (size_t)__builtin_ctzll(mask) / VEC_BITS;
 
-        gunichar ch = g_utf8_get_char(lstr);
-        lstr = g_utf8_next_char(lstr); // Note: This handles the null terminator properly.
+        n += sizeof(Vector);
+    }
+}
+
+#else
+
+static size_t scan_run(const char *p, ScanKind kind)
+{
+    const char *start = p;
+
+    while (!is_stop((unsigned char)*p, kind))
+        p++;
+
+    return (size_t)(p - start);
+}
+
+#endif
+
+typedef struct
+{
+    const char *pos;
+    uint32_t line;
+    uint32_t column;
+} Cursor;
+
+// Advances `cur` past `n` ASCII bytes that are not line feeds.
+static inline void advance(Cursor *cur, size_t n)
+{
+    cur->pos += n;
+    cur->column += (uint32_t)n;
+}
+
+// Decodes the character at `cur`, validating it if it is not
+// ASCII. This takes the place of validating the whole input
+// up front.
+static gunichar peek_char(const Cursor *cur)
+{
+    unsigned char b = (unsigned char)*cur->pos;
+
+    if (!b)
+        return CHAR_END;
+
+    if (!(b & 0x80))
+        return b;
+
+    gunichar ch = g_utf8_get_char_validated(cur->pos, -1);
+
+    if (ch == (gunichar)-1 || ch == (gunichar)-2)
+        return CHAR_BAD;
+
+    return ch;
+}
+
+// Advances `cur` past `ch`, as returned by `peek_char`.
+static void skip_char(Cursor *cur, gunichar ch)
+{
+    cur->pos = g_utf8_next_char(cur->pos);
+
+    if (ch == CHAR_LINE_FEED)
+    {
+        cur->line++;
+        cur->column = 0;
+    }
+    else
+        cur->column++;
+}
+
+// Skips ASCII white space. Other white space is rare enough
+// to be left to the caller.
+static void skip_space(Cursor *cur)
+{
+    const char *end = cur->pos + scan_run(cur->pos, SCAN_SPACE);
+    const char *lf;
+
+    while ((lf = memchr(cur->pos, '\n', (size_t)(end - cur->pos))))
+    {
+        cur->pos = lf + 1;
+        cur->line++;
+        cur->column = 0;
+    }
+
+    advance(cur, (size_t)(end - cur->pos));
+}
+
+// Skips a comment up to (but not including) the line feed
+// that ends it.
+static ParaVMError skip_comment(Cursor *cur)
+{
+    while (true)
+    {
+        advance(cur, scan_run(cur->pos, SCAN_COMMENT));
+
+        gunichar c = peek_char(cur);
+
+        if (c == CHAR_BAD)
+            return PARAVM_ERROR_BAD_UTF8;
+
+        if (c == CHAR_END || c == CHAR_LINE_FEED)
+            return PARAVM_ERROR_OK;
+
+        skip_char(cur, c);
+    }
+}
 
-        if (ch == CHAR_LINE_FEED)
+static bool is_word_char(gunichar c)
+{
+    return g_unichar_isalpha(c) || c == CHAR_PERIOD;
+}
+
+static bool is_digit_char(gunichar c)
+{
+    return g_unichar_isdigit(c);
+}
+
+// Skips a run of characters, where ASCII characters are
+// matched by `kind` and any others by `accept`.
+static ParaVMError skip_run(Cursor *cur, ScanKind kind, bool (*accept)(gunichar))
+{
+    while (true)
+    {
+        advance(cur, scan_run(cur->pos, kind));
+
+        if (!((unsigned char)*cur->pos & 0x80))
+            return PARAVM_ERROR_OK;
+
+        gunichar c = peek_char(cur);
+
+        if (c == CHAR_BAD)
+            return PARAVM_ERROR_BAD_UTF8;
+
+        if (!accept(c))
+            return PARAVM_ERROR_OK;
+
+        skip_char(cur, c);
+    }
+}
+
+// Skips the contents of a string or atom along with the `term`
+// character that ends it.
+static ParaVMError skip_quoted(Cursor *cur, gunichar term, bool *escaped)
+{
+    ScanKind kind = term == CHAR_QUOTE ? SCAN_QUOTE : SCAN_APOSTROPHE;
+
+    while (true)
+    {
+        advance(cur, scan_run(cur->pos, kind));
+
+        gunichar c = peek_char(cur);
+
+        if (c == CHAR_END)
+            return PARAVM_ERROR_SYNTAX;
+
+        if (c == CHAR_BAD)
+            return PARAVM_ERROR_BAD_UTF8;
+
+        skip_char(cur, c);
+
+        if (c == term)
+            return PARAVM_ERROR_OK;
+
+        // Only these three characters are actually escaped; a
+        // backslash before anything else is kept as-is.
+        if (c == CHAR_BACKSLASH && (*cur->pos == '\\' || *cur->pos == '\'' || *cur->pos == '"'))
         {
-            lline++;
-            lcolumn = 0;
+            *escaped = true;
+            advance(cur, 1);
         }
-        else
-            lcolumn++;
+    }
+}
 
-        return ch;
-    };
+// Checks whether the `length` bytes at `str` spell out `word`.
+static bool slice_equals(const char *str, size_t length, const char *word)
+{
+    return strlen(word) == length && !memcmp(str, word, length);
+}
 
-    ParaVMError result = PARAVM_ERROR_OK;
-    GPtrArray *arr = g_ptr_array_new();
+// Copies `length` bytes of a value from `src` to `dst` while
+// processing escape sequences. Returns the resulting length.
+static size_t unescape(char *dst, const char *src, size_t length)
+{
+    char *start = dst;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        if (src[i] == '\\' && i + 1 < length &&
+            (src[i + 1] == '\\' || src[i + 1] == '\'' || src[i + 1] == '"'))
+            i++;
+
+        *dst++ = src[i];
+    }
+
+    return (size_t)(dst - start);
+}
+
+char *paravm_get_slice_value(const char *str, const ParaVMTokenSlice *slice)
+{
+    assert(str);
+    assert(slice);
 
-    gunichar c;
+    const char *src = str + slice->offset;
 
-    while ((c = next_char()) != UINT32_MAX)
+    if (!slice->escaped)
+        return g_strndup(src, slice->length);
+
+    char *value = g_new(char, slice->length + 1);
+
+    value[unescape(value, src, slice->length)] = '\0';
+
+    return value;
+}
+
+// Skips white space and comments at `cur` and then lexes a
+// single token into `tok`, with its offset relative to `str`.
+// Sets `*found` to `false` if the end of the input was hit.
+static ParaVMError lex_token(const char *str, Cursor *cur, ParaVMTokenSlice *tok, bool *found)
+{
+    *found = false;
+
+    while (true)
     {
-        // Skip all forms of white space.
+        skip_space(cur);
+
+        gunichar c = peek_char(cur);
+
+        if (c == CHAR_END)
+            return PARAVM_ERROR_OK;
+
+        *tok = (ParaVMTokenSlice) {
+            .escaped = false,
+            .line = cur->line,
+            .column = cur->column + 1,
+        };
+
+        if (c == CHAR_BAD)
+            return PARAVM_ERROR_BAD_UTF8;
+
         if (g_unichar_isspace(c))
+        {
+            skip_char(cur, c);
             continue;
+        }
 
         // Skip comments starting with `;`.
         if (c == CHAR_SEMICOLON)
         {
-            while (true)
-            {
-                c = peek_char();
-
-                if (c == UINT32_MAX || c == CHAR_LINE_FEED)
-                    break;
+            ParaVMError result = skip_comment(cur);
 
-                next_char();
-            }
+            if (result != PARAVM_ERROR_OK)
+                return result;
 
             continue;
         }
 
-        bool is_directive = false;
+        break;
+    }
 
-        ParaVMTokenType tt;
-        GArray *str_arr = g_array_new(false, false, sizeof(gunichar));
-        uint32_t tline = lline;
-        uint32_t tcol = lcolumn;
+    ParaVMError result = PARAVM_ERROR_OK;
+    const char *start = cur->pos;
+    gunichar c = peek_char(cur);
 
-        if (c != CHAR_APOSTROPHE && c != CHAR_QUOTE && c != CHAR_COLON)
-            g_array_append_val(str_arr, c);
+    skip_char(cur, c);
 
-        switch (c)
-        {
-            case CHAR_APOSTROPHE:
-            case CHAR_QUOTE:
-                tt = c == CHAR_APOSTROPHE ? PARAVM_TOKEN_TYPE_ATOM : PARAVM_TOKEN_TYPE_STRING;
+    switch (c)
+    {
+        case CHAR_APOSTROPHE:
+        case CHAR_QUOTE:
+            tok->type = c == CHAR_APOSTROPHE ? PARAVM_TOKEN_TYPE_ATOM : PARAVM_TOKEN_TYPE_STRING;
+            start = cur->pos;
+            result = skip_quoted(cur, c, &tok->escaped);
 
-                gunichar term = c;
+            break;
+        case CHAR_COLON:
+            tok->type = PARAVM_TOKEN_TYPE_BINARY;
+            start = cur->pos;
 
-                while (true)
-                {
-                    c = peek_char();
+            while (*cur->pos == '0' || *cur->pos == '1')
+                advance(cur, 1);
 
-                    if (c == UINT32_MAX)
-                    {
-                        result = PARAVM_ERROR_SYNTAX;
-                        break;
-                    }
-
-                    // Handle escape sequences.
-                    if (c == CHAR_BACKSLASH)
-                    {
-                        c = next_char();
-
-                        gunichar c2 = peek_char();
-
-                        switch (c2)
-                        {
-                            case CHAR_BACKSLASH:
-                            case CHAR_APOSTROPHE:
-                            case CHAR_QUOTE:
-                                // Drop c, and only save c2.
-                                c2 = next_char();
-                                g_array_append_val(str_arr, c2);
-                                break;
-                            default:
-                                g_array_append_val(str_arr, c);
-                                break;
-                        }
-                    }
-                    else if (c != term)
-                    {
-                        c = next_char();
-                        g_array_append_val(str_arr, c);
-                    }
-                    else
-                    {
-                        next_char(); // Drop terminator character.
-                        break;
-                    }
-                }
+            if (*cur->pos != ':')
+                result = PARAVM_ERROR_SYNTAX;
 
-                break;
-            case CHAR_COLON:
-                tt = PARAVM_TOKEN_TYPE_BINARY;
+            break;
+        case CHAR_PAREN_OPEN:
+            tok->type = PARAVM_TOKEN_TYPE_PAREN_OPEN;
 
-                while (true)
-                {
-                    c = peek_char();
-
-                    if (c == CHAR_ZERO || c == CHAR_ONE)
-                    {
-                        c = next_char();
-                        g_array_append_val(str_arr, c);
-                    }
-                    else if (c == CHAR_COLON)
-                    {
-                        next_char(); // Drop terminator character.
-                        break;
-                    }
-                    else
-                    {
-                        result = PARAVM_ERROR_SYNTAX;
-                        break;
-                    }
-                }
+            break;
+        case CHAR_PAREN_CLOSE:
+            tok->type = PARAVM_TOKEN_TYPE_PAREN_CLOSE;
 
-                break;
-            case CHAR_PAREN_OPEN:
-                tt = PARAVM_TOKEN_TYPE_PAREN_OPEN;
+            break;
+        case CHAR_BRACKET_OPEN:
+            tok->type = PARAVM_TOKEN_TYPE_BRACKET_OPEN;
 
-                break;
-            case CHAR_PAREN_CLOSE:
-                tt = PARAVM_TOKEN_TYPE_PAREN_CLOSE;
+            break;
+        case CHAR_BRACKET_CLOSE:
+            tok->type = PARAVM_TOKEN_TYPE_BRACKET_CLOSE;
 
-                break;
-            case CHAR_BRACKET_OPEN:
-                tt = PARAVM_TOKEN_TYPE_BRACKET_OPEN;
+            break;
+        case CHAR_PERIOD:
+            while (g_unichar_isalpha(c = peek_char(cur)))
+                skip_char(cur, c);
 
+            if (c == CHAR_BAD)
+            {
+                result = PARAVM_ERROR_BAD_UTF8;
                 break;
-            case CHAR_BRACKET_CLOSE:
-                tt = PARAVM_TOKEN_TYPE_BRACKET_CLOSE;
+            }
 
-                break;
-            case CHAR_PERIOD:
-                is_directive = true;
+            size_t len = (size_t)(cur->pos - start);
+
+            // Make sure it's actually a correct directive.
+            if (slice_equals(start, len, ".fun"))
+                tok->type = PARAVM_TOKEN_TYPE_FUN;
+            else if (slice_equals(start, len, ".arg"))
+                tok->type = PARAVM_TOKEN_TYPE_ARG;
+            else if (slice_equals(start, len, ".reg"))
+                tok->type = PARAVM_TOKEN_TYPE_REG;
+            else if (slice_equals(start, len, ".blk"))
+                tok->type = PARAVM_TOKEN_TYPE_BLK;
+            else if (slice_equals(start, len, ".unw"))
+                tok->type = PARAVM_TOKEN_TYPE_UNW;
+            else
+                result = PARAVM_ERROR_SYNTAX;
 
-                while (true)
-                {
-                    c = peek_char();
-
-                    if (g_unichar_isalpha(c))
-                    {
-                        c = next_char();
-                        g_array_append_val(str_arr, c);
-                    }
-                    else
-                        break;
-                }
+            break;
+        default:
+            if (g_unichar_isalpha(c))
+            {
+                tok->type = PARAVM_TOKEN_TYPE_OPCODE;
 
-                break;
-            default:
-                if (g_unichar_isalpha(c))
+                if ((result = skip_run(cur, SCAN_WORD, &is_word_char)) != PARAVM_ERROR_OK)
+                    break;
+
+                // No opcode name comes anywhere near this long.
+                char name[64];
+                size_t name_len = (size_t)(cur->pos - start);
+
+                if (name_len >= sizeof(name))
                 {
-                    tt = PARAVM_TOKEN_TYPE_OPCODE;
-
-                    while (true)
-                    {
-                        c = peek_char();
-
-                        if (g_unichar_isalpha(c) || c == CHAR_PERIOD)
-                        {
-                            c = next_char();
-                            g_array_append_val(str_arr, c);
-                        }
-                        else
-                            break;
-                    }
+                    result = PARAVM_ERROR_SYNTAX;
+                    break;
                 }
-                else if (g_unichar_isdigit(c))
+
+                memcpy(name, start, name_len);
+                name[name_len] = '\0';
+
+                if (!paravm_get_opcode_by_name(name))
+                    result = PARAVM_ERROR_SYNTAX;
+            }
+            else if (g_unichar_isdigit(c))
+            {
+                // Must be an integer so far.
+                tok->type = PARAVM_TOKEN_TYPE_INTEGER;
+
+                if ((result = skip_run(cur, SCAN_DIGITS, &is_digit_char)) != PARAVM_ERROR_OK)
+                    break;
+
+                if (*cur->pos != '.')
+                    break;
+
+                // Looks like it's actually a float.
+                tok->type = PARAVM_TOKEN_TYPE_FLOAT;
+                advance(cur, 1);
+
+                if ((result = skip_run(cur, SCAN_DIGITS, &is_digit_char)) != PARAVM_ERROR_OK)
+                    break;
+
+                if (*cur->pos == 'e' || *cur->pos == 'E')
                 {
-                    // Must be an integer so far.
-                    tt = PARAVM_TOKEN_TYPE_INTEGER;
-
-                    while (true)
-                    {
-                        c = peek_char();
-
-                        if (g_unichar_isdigit(c))
-                        {
-                            c = next_char();
-                            g_array_append_val(str_arr, c);
-                            continue;
-                        }
-
-                        if (c == CHAR_PERIOD)
-                        {
-                            // Looks like it's actually a float.
-                            tt = PARAVM_TOKEN_TYPE_FLOAT;
-
-                            c = next_char();
-                            g_array_append_val(str_arr, c);
-
-                            bool have_exp = false;
-
-                            while (true)
-                            {
-                                c = peek_char();
-
-                                if (g_unichar_isdigit(c))
-                                {
-                                    c = next_char();
-                                    g_array_append_val(str_arr, c);
-                                }
-                                else if (!have_exp && (c == CHAR_E_LOWER || c == CHAR_E_UPPER))
-                                {
-                                    have_exp = true;
-
-                                    c = next_char();
-                                    g_array_append_val(str_arr, c);
-
-                                    c = peek_char();
-
-                                    if (c == CHAR_PLUS || c == CHAR_MINUS)
-                                    {
-                                        c = next_char();
-                                        g_array_append_val(str_arr, c);
-                                    }
-
-                                    while (true)
-                                    {
-                                        c = peek_char();
-
-                                        if (g_unichar_isdigit(c))
-                                        {
-                                            c = next_char();
-                                            g_array_append_val(str_arr, c);
-                                        }
-                                        else
-                                            break;
-                                    }
-                                }
-                                else
-                                    break;
-                            }
-                        }
+                    advance(cur, 1);
+
+                    if (*cur->pos == '+' || *cur->pos == '-')
+                        advance(cur, 1);
 
+                    if ((result = skip_run(cur, SCAN_DIGITS, &is_digit_char)) != PARAVM_ERROR_OK)
                         break;
-                    }
                 }
-                else
-                    result = PARAVM_ERROR_SYNTAX;
 
-                break;
-        }
+                gchar *value = g_strndup(start, (gsize)(cur->pos - start));
 
-        if (result == PARAVM_ERROR_OK)
-        {
-            gchar *ustr = g_ucs4_to_utf8((gunichar *)str_arr->data, str_arr->len, null, null, null);
-
-            if (is_directive)
-            {
-                // Make sure it's actually a correct directive.
-                if (!strcmp(ustr, ".fun"))
-                    tt = PARAVM_TOKEN_TYPE_FUN;
-                else if (!strcmp(ustr, ".arg"))
-                    tt = PARAVM_TOKEN_TYPE_ARG;
-                else if (!strcmp(ustr, ".reg"))
-                    tt = PARAVM_TOKEN_TYPE_REG;
-                else if (!strcmp(ustr, ".blk"))
-                    tt = PARAVM_TOKEN_TYPE_BLK;
-                else if (!strcmp(ustr, ".unw"))
-                    tt = PARAVM_TOKEN_TYPE_UNW;
-                else
-                    result = PARAVM_ERROR_SYNTAX;
-            }
-            else if (tt == PARAVM_TOKEN_TYPE_OPCODE)
-            {
-                if (!paravm_get_opcode_by_name(ustr))
-                    result = PARAVM_ERROR_SYNTAX;
-            }
-            else if (tt == PARAVM_TOKEN_TYPE_FLOAT)
-            {
                 errno = 0;
-                strtod(ustr, null);
+                strtod(value, null);
 
                 if (errno)
                     result = PARAVM_ERROR_OVERFLOW;
+
+                g_free(value);
             }
+            else
+                result = PARAVM_ERROR_SYNTAX;
 
-            // Double-check since the result may have changed due to
-            // the directive and opcode checks above.
-            if (result == PARAVM_ERROR_OK)
-            {
-                ParaVMToken *tok = paravm_create_token(tt, ustr, tline, tcol);
-                g_ptr_array_add(arr, tok);
+            break;
+    }
 
-                g_free(ustr);
-            }
-        }
+    if (result != PARAVM_ERROR_OK)
+        return result;
+
+    tok->offset = (uint32_t)(start - str);
+    tok->length = (uint32_t)(cur->pos - start);
+
+    // Drop the terminator characters of strings, atoms, and
+    // binaries from the value.
+    switch (tok->type)
+    {
+        case PARAVM_TOKEN_TYPE_STRING:
+        case PARAVM_TOKEN_TYPE_ATOM:
+            tok->length--;
+            break;
+        case PARAVM_TOKEN_TYPE_BINARY:
+            advance(cur, 1);
+            break;
+        default:
+            break;
+    }
+
+    *found = true;
+
+    return PARAVM_ERROR_OK;
+}
+
+ParaVMError paravm_lex_slices(const char *str, ParaVMTokenSlice **slices, size_t *count,
+                              uint32_t *line, uint32_t *column)
+{
+    assert(str);
+    assert(slices);
+    assert(count);
+    assert(line);
+    assert(column);
+
+    *slices = null;
+    *count = 0;
+    *line = 1;
+    *column = 0;
 
-        g_array_free(str_arr, true);
+    ParaVMError result = PARAVM_ERROR_OK;
+    GArray *arr = g_array_new(false, false, sizeof(ParaVMTokenSlice));
+
+    Cursor cur = {
+        .pos = str,
+        .line = 1,
+        .column = 0,
+    };
+
+    while (true)
+    {
+        ParaVMTokenSlice tok = {
+            .line = cur.line,
+            .column = cur.column,
+        };
+
+        bool found;
+
+        result = lex_token(str, &cur, &tok, &found);
+
+        // Offsets are stored as 32-bit values.
+        if (result == PARAVM_ERROR_OK && (size_t)(cur.pos - str) > UINT32_MAX)
+            result = PARAVM_ERROR_OVERFLOW;
 
         if (result != PARAVM_ERROR_OK)
         {
             // Try to give the actual location of the error.
-            *line = tline;
-            *column = tcol;
+            *line = tok.line;
+            *column = tok.column;
 
             break;
         }
+
+        if (!found)
+            break;
+
+        g_array_append_val(arr, tok);
     }
 
     if (result == PARAVM_ERROR_OK)
     {
-        g_ptr_array_add(arr, null);
+        *count = arr->len;
+        *slices = (ParaVMTokenSlice *)arr->data;
+        *line = cur.line;
+        *column = cur.column;
+    }
+
+    g_array_free(arr, result != PARAVM_ERROR_OK);
+
+    return result;
+}
+
+ParaVMError paravm_lex_string(const char *str, ParaVMToken ***tokens,
+                              uint32_t *line, uint32_t *column)
+{
+    assert(str);
+    assert(tokens);
+    assert(line);
+    assert(column);
+
+    *tokens = null;
+
+    ParaVMTokenSlice *slices;
+    size_t count;
+    ParaVMError result = paravm_lex_slices(str, &slices, &count, line, column);
+
+    if (result != PARAVM_ERROR_OK)
+        return result;
+
+    ParaVMToken **arr = g_new(ParaVMToken *, count + 1);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        ParaVMToken *tok = g_new(ParaVMToken, 1);
+
+        tok->type = slices[i].type;
+        tok->value = paravm_get_slice_value(str, &slices[i]);
+        tok->line = slices[i].line;
+        tok->column = slices[i].column;
 
-        *tokens = (ParaVMToken **)arr->pdata;
-        *line = lline;
-        *column = lcolumn;
+        arr[i] = tok;
     }
 
-    g_ptr_array_free(arr, result != PARAVM_ERROR_OK);
+    arr[count] = null;
+
+    g_free(slices);
+
+    *tokens = arr;
 
     return result;
 }
+
+// The initial size of the window that file lexers read into.
+#define LEXER_BUFFER_SIZE 65536
+
+ParaVMLexer *paravm_create_lexer(const char *str)
+{
+    assert(str);
+
+    ParaVMLexer *lexer = g_new(ParaVMLexer, 1);
+
+    lexer->file = null;
+    lexer->buffer = (char *)str;
+    lexer->value = g_string_new(null);
+    lexer->position = 0;
+    lexer->length = strlen(str);
+    lexer->capacity = 0;
+    lexer->line = 1;
+    lexer->column = 0;
+    lexer->eof = true;
+
+    return lexer;
+}
+
+ParaVMError paravm_open_lexer(const char *path, ParaVMLexer **lexer)
+{
+    assert(path);
+    assert(lexer);
+
+    *lexer = null;
+
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return errno_to_error(errno);
+
+    ParaVMLexer *lex = g_new(ParaVMLexer, 1);
+
+    lex->file = f;
+    lex->buffer = g_new(char, LEXER_BUFFER_SIZE);
+    lex->value = g_string_new(null);
+    lex->position = 0;
+    lex->length = 0;
+    lex->capacity = LEXER_BUFFER_SIZE;
+    lex->line = 1;
+    lex->column = 0;
+    lex->eof = false;
+
+    ((char *)lex->buffer)[0] = '\0';
+
+    *lexer = lex;
+
+    return PARAVM_ERROR_OK;
+}
+
+void paravm_destroy_lexer(ParaVMLexer *lexer)
+{
+    if (!lexer)
+        return;
+
+    if (lexer->file)
+    {
+        fclose(lexer->file);
+        g_free(lexer->buffer);
+    }
+
+    g_string_free(lexer->value, true);
+    g_free(lexer);
+}
+
+// Discards the part of the buffer that has been lexed and
+// reads more of the file in after the rest.
+static ParaVMError fill_lexer(ParaVMLexer *lexer)
+{
+    char *buf = lexer->buffer;
+    size_t keep = lexer->length - lexer->position;
+
+    memmove(buf, buf + lexer->position, keep);
+
+    lexer->position = 0;
+    lexer->length = keep;
+
+    // A single token (or comment) is taking up most of the
+    // buffer, so make room for the rest of it.
+    if (keep >= lexer->capacity / 2)
+    {
+        lexer->capacity *= 2;
+        lexer->buffer = buf = g_realloc(buf, lexer->capacity);
+    }
+
+    size_t n = fread(buf + keep, 1, lexer->capacity - keep - 1, lexer->file);
+
+    if (!n)
+    {
+        if (ferror(lexer->file))
+            return errno ? errno_to_error(errno) : PARAVM_ERROR_IO;
+
+        lexer->eof = true;
+    }
+
+    lexer->length += n;
+    buf[lexer->length] = '\0';
+
+    return PARAVM_ERROR_OK;
+}
+
+ParaVMError paravm_lex_token(ParaVMLexer *lexer, ParaVMToken *tok)
+{
+    assert(lexer);
+    assert(tok);
+
+    while (true)
+    {
+        const char *buf = lexer->buffer;
+
+        Cursor cur = {
+            .pos = buf + lexer->position,
+            .line = lexer->line,
+            .column = lexer->column,
+        };
+
+        ParaVMTokenSlice slice = {
+            .line = lexer->line,
+            .column = lexer->column,
+        };
+
+        bool found;
+        ParaVMError result = lex_token(buf, &cur, &slice, &found);
+
+        // Anything that runs up to the end of the buffer (even
+        // an error, such as a partial UTF-8 sequence) may just
+        // continue in the part of the file that hasn't been
+        // read yet, so read more and start over.
+        if (!lexer->eof && (size_t)(cur.pos - buf) + 4 > lexer->length)
+        {
+            if ((result = fill_lexer(lexer)) != PARAVM_ERROR_OK)
+            {
+                tok->line = lexer->line;
+                tok->column = lexer->column;
+
+                return result;
+            }
+
+            continue;
+        }
+
+        if (result != PARAVM_ERROR_OK)
+        {
+            tok->line = slice.line;
+            tok->column = slice.column;
+
+            return result;
+        }
+
+        lexer->position = (size_t)(cur.pos - buf);
+        lexer->line = cur.line;
+        lexer->column = cur.column;
+
+        if (!found)
+        {
+            tok->value = null;
+            tok->line = cur.line;
+            tok->column = cur.column;
+
+            return PARAVM_ERROR_OK;
+        }
+
+        GString *value = lexer->value;
+
+        const char *src = buf + slice.offset;
+
+        g_string_set_size(value, slice.length);
+
+        if (slice.escaped)
+            g_string_truncate(value, unescape(value->str, src, slice.length));
+        else
+            memcpy(value->str, src, slice.length);
+
+        tok->type = slice.type;
+        tok->value = value->str;
+        tok->line = slice.line;
+        tok->column = slice.column;
+
+        return PARAVM_ERROR_OK;
+    }
+}
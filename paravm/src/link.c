@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "link.h"
+
+// Per-function state while linking.
+typedef struct
+{
+    size_t module_atom; // The module's name, or `SIZE_MAX` if atoms are not interned.
+    GHashTable *functions; // Function name atom to index.
+    GPtrArray *storage;
+    GHashTable *slots; // Register to slot.
+    GHashTable *starts; // Block to index of its first instruction.
+    size_t *atoms; // The atom each slot was loaded with in the current block, or `SIZE_MAX`.
+} Linker;
+
+// Looks up the index that `table` maps `key` to, if any.
+static uint32_t lookup(GHashTable *table, const void *key)
+{
+    assert(table);
+
+    void *value;
+
+    if (!g_hash_table_lookup_extended(table, key, null, &value))
+        return PARAVM_LINK_NONE;
+
+    return (uint32_t)GPOINTER_TO_SIZE(value);
+}
+
+static uint32_t slot_of(const Linker *lnk, const ParaVMRegister *reg)
+{
+    assert(lnk);
+    assert(reg);
+
+    return lookup(lnk->slots, reg);
+}
+
+static uint32_t start_of(const Linker *lnk, const ParaVMBlock *blk)
+{
+    assert(lnk);
+    assert(blk);
+
+    return lookup(lnk->starts, blk);
+}
+
+static ParaVMError decode_operand(const Linker *lnk, const ParaVMInstruction *insn, ParaVMLinkedOperand *out)
+{
+    assert(lnk);
+    assert(insn);
+    assert(out);
+
+    switch (insn->opcode->operand)
+    {
+        case PARAVM_OPERAND_TYPE_NONE:
+            break;
+        case PARAVM_OPERAND_TYPE_INTEGER:
+        {
+            errno = 0;
+
+            long long i = strtoll(insn->operand.string, null, 10);
+
+            if (errno == ERANGE)
+                return PARAVM_ERROR_OVERFLOW;
+
+            out->integer = i;
+
+            break;
+        }
+        case PARAVM_OPERAND_TYPE_FLOAT:
+            out->real = strtod(insn->operand.string, null);
+
+            if (!isfinite(out->real))
+                return PARAVM_ERROR_OVERFLOW;
+
+            break;
+        case PARAVM_OPERAND_TYPE_ATOM:
+            out->atom = insn->atom;
+
+            break;
+        case PARAVM_OPERAND_TYPE_BINARY:
+        {
+            const char *bits = insn->operand.string;
+            size_t size = strlen(bits);
+            uint8_t *data = g_malloc0(size / 8 + 1);
+
+            for (size_t i = 0; i < size; i++)
+                if (bits[i] == '1')
+                    data[i / 8] |= (uint8_t)(1 << (7 - i % 8));
+
+            g_ptr_array_add(lnk->storage, data);
+
+            out->binary.data = data;
+            out->binary.size = size;
+
+            break;
+        }
+        case PARAVM_OPERAND_TYPE_BLOCK:
+            out->targets[0] = start_of(lnk, insn->operand.block);
+
+            break;
+        case PARAVM_OPERAND_TYPE_BLOCKS:
+            out->targets[0] = start_of(lnk, insn->operand.blocks[0]);
+            out->targets[1] = start_of(lnk, insn->operand.blocks[1]);
+
+            break;
+        default:
+            assert_unreachable();
+            break;
+    }
+
+    return PARAVM_ERROR_OK;
+}
+
+// Finds the function that `insn` always refers to, given the
+// atoms that its module and function registers were loaded
+// with in the current block.
+static uint32_t resolve_function(const Linker *lnk, const ParaVMLinkedInstruction *insn)
+{
+    assert(lnk);
+    assert(insn);
+
+    switch (insn->opcode->code)
+    {
+        case PARAVM_CODE_LOAD_FUNC:
+        case PARAVM_CODE_CALL_REM:
+        case PARAVM_CODE_CALL_UP:
+            break;
+        default:
+            return PARAVM_LINK_NONE;
+    }
+
+    size_t mod = lnk->atoms[insn->registers[1]];
+    size_t fn = lnk->atoms[insn->registers[2]];
+
+    if (mod == SIZE_MAX || fn == SIZE_MAX || mod != lnk->module_atom)
+        return PARAVM_LINK_NONE;
+
+    return lookup(lnk->functions, GSIZE_TO_POINTER(fn));
+}
+
+// Records the atoms that `insn` loads into slots, and forgets
+// those of the slots it overwrites otherwise.
+static void track_atoms(Linker *lnk, const ParaVMInstruction *insn, const ParaVMLinkedInstruction *out)
+{
+    assert(lnk);
+    assert(insn);
+    assert(out);
+
+    for (uint32_t r = 0; r < out->register_count && r < 8; r++)
+        if (insn->opcode->defs & (1 << r))
+            lnk->atoms[out->registers[r]] = SIZE_MAX;
+
+    if (insn->opcode->code == PARAVM_CODE_LOAD_ATOM)
+        lnk->atoms[out->registers[0]] = insn->atom;
+}
+
+static ParaVMError link_function(Linker *lnk, ParaVMLinkedFunction *out)
+{
+    assert(lnk);
+    assert(out);
+
+    const ParaVMFunction *func = out->function;
+    size_t idx = 0;
+
+    // Arguments come first, so that callers can pass them in
+    // the first slots of a new frame.
+    for (const ParaVMRegister *const *a = paravm_get_arguments(func); *a; a++)
+        g_hash_table_insert(lnk->slots, (ParaVMRegister *)*a, GSIZE_TO_POINTER(idx++));
+
+    for (const ParaVMRegister *const *r = paravm_get_registers(func); *r; r++)
+        if (!(*r)->argument)
+            g_hash_table_insert(lnk->slots, (ParaVMRegister *)*r, GSIZE_TO_POINTER(idx++));
+
+    out->arguments = (uint32_t)paravm_get_argument_count(func);
+    out->slots = (uint32_t)idx;
+
+    size_t count = 0;
+
+    for (const ParaVMBlock *const *b = paravm_get_blocks(func); *b; b++)
+    {
+        g_hash_table_insert(lnk->starts, (ParaVMBlock *)*b, GSIZE_TO_POINTER(out->length));
+
+        for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++)
+        {
+            out->length++;
+            count += paravm_get_instruction_register_count(*i);
+        }
+    }
+
+    ParaVMLinkedInstruction *code = g_new0(ParaVMLinkedInstruction, out->length);
+    uint32_t *slots = g_new(uint32_t, count);
+    ParaVMType *types = g_new(ParaVMType, count);
+
+    g_ptr_array_add(lnk->storage, code);
+    g_ptr_array_add(lnk->storage, slots);
+    g_ptr_array_add(lnk->storage, types);
+
+    lnk->atoms = g_new(size_t, out->slots);
+    out->code = code;
+
+    ParaVMError err = PARAVM_ERROR_OK;
+
+    for (const ParaVMBlock *const *b = paravm_get_blocks(func); *b && !err; b++)
+    {
+        uint32_t handler = (*b)->handler ? start_of(lnk, (*b)->handler) : PARAVM_LINK_NONE;
+        uint32_t exception = (*b)->exception ? slot_of(lnk, (*b)->exception) : PARAVM_LINK_NONE;
+
+        // Only loads within the block are known to reach its
+        // instructions.
+        for (uint32_t s = 0; s < out->slots; s++)
+            lnk->atoms[s] = SIZE_MAX;
+
+        for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++, code++)
+        {
+            const ParaVMRegister *const *regs = paravm_get_instruction_registers(*i);
+
+            code->opcode = (*i)->opcode;
+            code->register_count = (uint32_t)paravm_get_instruction_register_count(*i);
+            code->registers = slots;
+            code->types = types;
+            code->handler = handler;
+            code->exception = exception;
+
+            for (uint32_t r = 0; r < code->register_count; r++)
+            {
+                *slots++ = slot_of(lnk, regs[r]);
+                *types++ = paravm_get_operand_types(*i, r);
+            }
+
+            if ((err = decode_operand(lnk, *i, &code->operand)))
+                break;
+
+            code->function = resolve_function(lnk, code);
+
+            track_atoms(lnk, *i, code);
+        }
+    }
+
+    g_free(lnk->atoms);
+    g_hash_table_remove_all(lnk->starts);
+    g_hash_table_remove_all(lnk->slots);
+
+    return err;
+}
+
+ParaVMError paravm_link_module(const ParaVMModule *mod, const ParaVMLinkedModule **linked)
+{
+    assert(mod);
+    assert(linked);
+
+    ParaVMLinkedModule *lm = g_new0(ParaVMLinkedModule, 1);
+    ParaVMLinkedFunction *fns = g_new0(ParaVMLinkedFunction, paravm_get_function_count(mod));
+    ParaVMAtomTable *table = (ParaVMAtomTable *)mod->atom_table;
+    Linker lnk = {
+        .module_atom = SIZE_MAX,
+        .functions = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .storage = g_ptr_array_new_with_free_func(&g_free),
+        .slots = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .starts = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+    };
+
+    lm->module = mod;
+    lm->functions = fns;
+    lm->function_count = paravm_get_function_count(mod);
+    lm->storage = lnk.storage;
+
+    g_ptr_array_add(lnk.storage, fns);
+
+    for (size_t f = 0; f < lm->function_count; f++)
+        fns[f].function = paravm_get_functions(mod)[f];
+
+    // Calls can only be linked by comparing interned atoms. The
+    // module and function names are retained for as long as the
+    // linked module lives so that a sweep cannot reclaim them
+    // and hand their atoms out to other strings.
+    if (table)
+    {
+        const char **names = g_new(const char *, lm->function_count + 1);
+        size_t *atoms = g_new(size_t, lm->function_count + 1);
+
+        names[0] = mod->name;
+
+        for (size_t f = 0; f < lm->function_count; f++)
+            names[f + 1] = fns[f].function->name;
+
+        paravm_strings_to_retained_atoms(table, names, lm->function_count + 1, atoms);
+
+        lnk.module_atom = atoms[0];
+        lm->atoms = atoms;
+
+        for (size_t f = 0; f < lm->function_count; f++)
+            g_hash_table_insert(lnk.functions, GSIZE_TO_POINTER(atoms[f + 1]), GSIZE_TO_POINTER(f));
+
+        g_free(names);
+    }
+
+    ParaVMError err = PARAVM_ERROR_OK;
+
+    for (size_t f = 0; f < lm->function_count && !err; f++)
+        err = link_function(&lnk, &fns[f]);
+
+    g_hash_table_destroy(lnk.starts);
+    g_hash_table_destroy(lnk.slots);
+    g_hash_table_destroy(lnk.functions);
+
+    if (err)
+    {
+        paravm_destroy_linked_module(lm);
+        return err;
+    }
+
+    *linked = lm;
+
+    return PARAVM_ERROR_OK;
+}
+
+void paravm_destroy_linked_module(const ParaVMLinkedModule *linked)
+{
+    if (linked)
+    {
+        size_t *atoms = (size_t *)linked->atoms;
+
+        if (atoms)
+        {
+            ParaVMAtomTable *table = (ParaVMAtomTable *)linked->module->atom_table;
+
+            for (size_t i = 0; i < linked->function_count + 1; i++)
+                paravm_release_atom(table, atoms[i]);
+
+            g_free(atoms);
+        }
+
+        g_ptr_array_free((GPtrArray *)linked->storage, true);
+    }
+
+    g_free((ParaVMLinkedModule *)linked);
+}
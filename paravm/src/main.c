@@ -1,4 +1,5 @@
 #include <getopt.h>
+#include <stdlib.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -12,6 +13,9 @@ const char *opt_entry;
 const char *opt_hdf;
 const char *opt_out;
 const char *opt_pid;
+int opt_jobs = 1;
+const char *opt_manifest;
+const char *opt_cache;
 
 static const struct option options[] =
 {
@@ -22,6 +26,9 @@ static const struct option options[] =
     { "hdf", required_argument, null, 'h' },
     { "out", required_argument, null, 'o' },
     { "pid", required_argument, null, 'p' },
+    { "jobs", required_argument, null, 'j' },
+    { "manifest", required_argument, null, 'm' },
+    { "cache", required_argument, null, 'c' },
     { null, 0, null, 0 },
 };
 
@@ -62,6 +69,27 @@ int main(int argc, char *argv[])
             case 'p':
                 opt_pid = optarg;
                 break;
+            case 'j':
+            {
+                char *end;
+                long jobs = strtol(optarg, &end, 10);
+
+                // Zero means one job per processor.
+                if (*end || end == optarg || jobs < 0 || jobs > INT32_MAX)
+                {
+                    g_fprintf(stderr, "Error: Invalid job count '%s'\n", optarg);
+                    return 1;
+                }
+
+                opt_jobs = (int)jobs;
+                break;
+            }
+            case 'm':
+                opt_manifest = optarg;
+                break;
+            case 'c':
+                opt_cache = optarg;
+                break;
             case ':':
             case '?':
                 usage(argv[0]);
@@ -1,13 +1,21 @@
+#include <fcntl.h>
+#include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
 
 #include "internal/option.h"
+#include "internal/syserror.h"
 #include "internal/tool.h"
 
 #include "assemble.h"
+#include "context.h"
 #include "disassemble.h"
+#include "fuse.h"
+#include "infer.h"
+#include "interpret.h"
 #include "io.h"
 #include "verify.h"
 
@@ -16,6 +24,26 @@ static const char pvc_ext[] = ".pvc";
 static const char hdf_ext[] = ".hdf";
 static const char pid_ext[] = ".pid";
 
+// When set, diagnostics for the file being processed on this
+// thread are collected here rather than printed right away,
+// so that batches can print them in input order.
+static thread_local GString *diagnostics;
+
+static void report(const char *format, ...)
+{
+    assert(format);
+
+    va_list args;
+    va_start(args, format);
+
+    if (diagnostics)
+        g_string_append_vprintf(diagnostics, format, args);
+    else
+        g_vfprintf(stderr, format, args);
+
+    va_end(args);
+}
+
 static int check_path(const char *path, const char *ext)
 {
     assert(path);
@@ -26,78 +54,112 @@ static int check_path(const char *path, const char *ext)
 
     if (!strcmp(base, "/"))
     {
-        g_fprintf(stderr, "Error: File '%s' does not have a base name\n", path);
+        report("Error: File '%s' does not have a base name\n", path);
         g_free(base);
         return 1;
     }
 
     if (!dot || strcmp(dot, ext))
     {
-        g_fprintf(stderr, "Error: File '%s' does not end in '%s'\n", path, ext);
+        report("Error: File '%s' does not end in '%s'\n", path, ext);
         g_free(base);
         return 1;
     }
 
     if (dot == base)
     {
-        g_fprintf(stderr, "Error: File '%s' does not have a root name\n", path);
+        report("Error: File '%s' does not have a root name\n", path);
         g_free(base);
         return 1;
     }
 
+    g_free(base);
     return 0;
 }
 
-static const ParaVMModule *read_module(const char *path)
+static const ParaVMModule *create_module(const char *path)
 {
     char *name = paravm_extract_module_name(path);
     const ParaVMModule *mod = paravm_create_module(name);
     g_free(name);
 
-    ParaVMError io_err = paravm_read_module(path, mod);
+    return mod;
+}
 
+// Reports `io_err`, if any, from loading `mod` from `path`.
+// Returns `mod`, or `null` if it could not be loaded, in
+// which case it is destroyed.
+static const ParaVMModule *finish_read(const char *path, const ParaVMModule *mod, ParaVMError io_err)
+{
     if (io_err != PARAVM_ERROR_OK)
         paravm_destroy_module(mod);
 
     if (io_err == PARAVM_ERROR_FOURCC)
     {
-        g_fprintf(stderr, "Error: Could not read '%s': File is not a PVC module\n", path);
+        report("Error: Could not read '%s': File is not a PVC module\n", path);
         return null;
     }
 
     if (io_err == PARAVM_ERROR_NAME_EXISTS ||
         io_err == PARAVM_ERROR_NONEXISTENT_NAME)
     {
-        g_fprintf(stderr, "Error: Could not read '%s': Module contains invalid code\n", path);
+        report("Error: Could not read '%s': Module contains invalid code\n", path);
         return null;
     }
 
     if (io_err != PARAVM_ERROR_OK)
     {
-        g_fprintf(stderr, "Error: Could not read '%s': %s\n", path, paravm_error_to_string(io_err));
+        report("Error: Could not read '%s': %s\n", path, paravm_error_to_string(io_err));
         return null;
     }
 
     return mod;
 }
 
+static const ParaVMModule *read_module(const char *path)
+{
+    const ParaVMModule *mod = create_module(path);
+
+    return finish_read(path, mod, paravm_read_module(path, mod));
+}
+
+static char *output_path(const char *path)
+{
+    if (opt_out)
+        return g_strdup(opt_out);
+
+    char *out_name = g_strdup(path);
+    strncpy(out_name + strlen(out_name) - sizeof(pvc_ext) + 1, pvc_ext, sizeof(pvc_ext) - 1);
+
+    return out_name;
+}
+
 static int write_module(const char *path, const ParaVMModule *mod)
 {
-    char *out_name;
+    char *out_name = output_path(path);
 
-    if (!opt_out)
+    ParaVMError io_err = paravm_write_module(mod, out_name);
+
+    if (io_err != PARAVM_ERROR_OK)
     {
-        out_name = g_strdup(path);
-        strncpy(out_name + strlen(out_name) - sizeof(pvc_ext) + 1, pvc_ext, sizeof(pvc_ext) - 1);
+        report("Error: Could not write '%s': %s\n", out_name, paravm_error_to_string(io_err));
+        g_free(out_name);
+        return 1;
     }
-    else
-        out_name = g_strdup(opt_out);
 
-    ParaVMError io_err = paravm_write_module(mod, out_name);
+    g_free(out_name);
+    return 0;
+}
+
+static int write_image(const char *path, const void *data, size_t size)
+{
+    char *out_name = output_path(path);
+
+    ParaVMError io_err = paravm_write_image(data, size, out_name);
 
     if (io_err != PARAVM_ERROR_OK)
     {
-        g_fprintf(stderr, "Error: Could not write '%s': %s\n", out_name, paravm_error_to_string(io_err));
+        report("Error: Could not write '%s': %s\n", out_name, paravm_error_to_string(io_err));
         g_free(out_name);
         return 1;
     }
@@ -106,17 +168,35 @@ static int write_module(const char *path, const ParaVMModule *mod)
     return 0;
 }
 
-int asm_tool(int argc, char *argv[])
+// The number of jobs to process the functions of a file
+// with. Batches run a job per file instead.
+static uint32_t file_jobs = 1;
+
+// Reads the PVA source at `path` into a null-terminated
+// string, reporting failures the same way as when the source
+// is lexed straight from the file.
+static char *read_source(const char *path)
 {
-    assert(argv);
+    void *data;
+    size_t size;
+    ParaVMError io_err = paravm_read_image(path, &data, &size);
 
-    if (!argc)
+    if (io_err != PARAVM_ERROR_OK)
     {
-        g_fprintf(stderr, "Error: No input file given\n");
-        return 1;
+        report("Error: Could not read '%s': %s\n", path, paravm_error_to_string(io_err));
+        return null;
     }
 
-    const char *file = argv[0];
+    char *source = g_realloc(data, size + 1);
+
+    source[size] = '\0';
+
+    return source;
+}
+
+static int asm_file(const char *file)
+{
+    assert(file);
 
     if (check_path(file, pva_ext))
         return 1;
@@ -124,92 +204,150 @@ int asm_tool(int argc, char *argv[])
     if (opt_out && check_path(opt_out, pvc_ext))
         return 1;
 
-    gchar *source = null;
-    GError *error = null;
+    uint32_t line;
+    uint32_t column;
+    ParaVMError asm_err;
+    const ParaVMModule *mod = null;
+    void *image = null;
+    size_t size = 0;
 
-    if (!g_file_get_contents(file, &source, null, &error))
+    if (opt_cache)
     {
-        g_fprintf(stderr, "Error: %s\n", error->message);
-        return 1;
-    }
+        char *source = read_source(file);
 
-    g_free(error);
+        if (!source)
+            return 1;
 
-    ParaVMToken **tokens;
-    uint32_t line;
-    uint32_t column;
+        ParaVMAssemblyCache *cache = paravm_create_assembly_cache();
+        ParaVMError cache_err = paravm_load_assembly_cache(cache, opt_cache);
 
-    ParaVMError lex_err = paravm_lex_string(source, &tokens, &line, &column);
+        // A missing, stale, or damaged cache just means that
+        // everything is translated again.
+        if (cache_err != PARAVM_ERROR_OK && cache_err != PARAVM_ERROR_NONEXISTENT &&
+            cache_err != PARAVM_ERROR_FOURCC && cache_err != PARAVM_ERROR_VERSION &&
+            cache_err != PARAVM_ERROR_MALFORMED)
+        {
+            report("Error: Could not read '%s': %s\n", opt_cache, paravm_error_to_string(cache_err));
+            paravm_destroy_assembly_cache(cache);
+            g_free(source);
 
-    g_free(source);
+            return 1;
+        }
 
-    if (lex_err == PARAVM_ERROR_BAD_UTF8)
-    {
-        g_fprintf(stderr, "Error: File '%s' contains bad UTF-8\n", file);
-        return 1;
-    }
+        // Only functions that changed since the cache was
+        // saved are translated again.
+        asm_err = paravm_translate_incremental(source, cache, &image, &size, &line, &column);
 
-    if (lex_err == PARAVM_ERROR_SYNTAX)
-    {
-        g_fprintf(stderr, "Error: Syntax error in '%s' (near line %i, column %i)\n", file, line, column);
-        return 1;
-    }
+        if (asm_err == PARAVM_ERROR_OK)
+            cache_err = paravm_save_assembly_cache(cache, opt_cache);
+
+        paravm_destroy_assembly_cache(cache);
+        g_free(source);
 
-    if (lex_err == PARAVM_ERROR_OVERFLOW)
+        if (asm_err == PARAVM_ERROR_OK && cache_err != PARAVM_ERROR_OK)
+        {
+            report("Error: Could not write '%s': %s\n", opt_cache, paravm_error_to_string(cache_err));
+            g_free(image);
+
+            return 1;
+        }
+    }
+    else if (file_jobs == 1)
     {
-        g_fprintf(stderr, "Error: Floating point overflow in '%s' (near line %i, column %i)\n", file, line, column);
-        return 1;
+        ParaVMLexer *lexer;
+
+        if ((asm_err = paravm_open_lexer(file, &lexer)) == PARAVM_ERROR_OK)
+        {
+            // Tokens are lexed from the file as they are needed and
+            // translated without building a module, so the source
+            // is never in memory at once; only the output image and
+            // the function being translated are.
+            asm_err = paravm_translate_stream(lexer, &image, &size, &line, &column);
+
+            paravm_destroy_lexer(lexer);
+        }
     }
+    else
+    {
+        char *source = read_source(file);
 
-    char *name = paravm_extract_module_name(file);
-    const ParaVMModule *mod = paravm_create_module(name);
-    g_free(name);
+        if (!source)
+            return 1;
+
+        char *name = paravm_extract_module_name(file);
+        mod = paravm_create_module(name);
+        g_free(name);
 
-    ParaVMError asm_err = paravm_assemble_tokens(tokens, mod, &line, &column);
+        ParaVMTokenSlice *slices;
+        size_t count;
 
-    for (ParaVMToken **tok = &tokens[0]; *tok; tok++)
-        paravm_destroy_token(*tok);
+        // Functions are independent of each other, so they can
+        // be assembled in parallel once the file has been lexed.
+        if ((asm_err = paravm_lex_slices(source, &slices, &count, &line, &column)) == PARAVM_ERROR_OK)
+        {
+            asm_err = paravm_assemble_slices_parallel(source, slices, count, mod, file_jobs,
+                                                      &line, &column);
 
-    g_free(tokens);
+            g_free(slices);
+        }
+
+        g_free(source);
+    }
 
     if (asm_err != PARAVM_ERROR_OK)
         paravm_destroy_module(mod);
 
+    if (asm_err == PARAVM_ERROR_BAD_UTF8)
+    {
+        report("Error: File '%s' contains bad UTF-8 (near line %i, column %i)\n", file, line, column);
+        return 1;
+    }
+
+    if (asm_err == PARAVM_ERROR_OVERFLOW)
+    {
+        report("Error: Floating point overflow in '%s' (near line %i, column %i)\n", file, line, column);
+        return 1;
+    }
+
     if (asm_err == PARAVM_ERROR_SYNTAX)
     {
-        g_fprintf(stderr, "Error: Syntax error in '%s' (near line %i, column %i)\n", file, line, column);
+        report("Error: Syntax error in '%s' (near line %i, column %i)\n", file, line, column);
         return 1;
     }
 
     if (asm_err == PARAVM_ERROR_ASSEMBLY)
     {
-        g_fprintf(stderr, "Error: Assembly error in '%s' (near line %i, column %i)\n", file, line, column);
+        report("Error: Assembly error in '%s' (near line %i, column %i)\n", file, line, column);
         return 1;
     }
 
-    int res = write_module(file, mod);
+    if (asm_err != PARAVM_ERROR_OK)
+    {
+        report("Error: Could not read '%s': %s\n", file, paravm_error_to_string(asm_err));
+        return 1;
+    }
+
+    int res;
+
+    if (mod)
+        res = write_module(file, mod);
+    else
+        res = write_image(file, image, size);
 
     paravm_destroy_module(mod);
+    g_free(image);
 
     return res;
 }
 
-int dis_tool(int argc, char *argv[])
+static int dis_file(const char *file)
 {
-    assert(argv);
-
-    if (!argc)
-    {
-        g_fprintf(stderr, "Error: No input file given\n");
-        return 1;
-    }
-
-    const char *file = argv[0];
+    assert(file);
 
     if (check_path(file, pvc_ext))
         return 1;
 
-    if (opt_out && check_path(opt_out, pva_ext))
+    if (opt_out && strcmp(opt_out, "-") && check_path(opt_out, pva_ext))
         return 1;
 
     const ParaVMModule *mod;
@@ -227,11 +365,25 @@ int dis_tool(int argc, char *argv[])
     else
         out_name = g_strdup(opt_out);
 
-    ParaVMError io_err = paravm_disassemble_module(mod, out_name);
+    ParaVMError io_err;
+    int fd = STDOUT_FILENO;
+
+    // `-` means standard output.
+    if (strcmp(out_name, "-") && (fd = open(out_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+        io_err = errno_to_error(errno);
+    else
+    {
+        io_err = paravm_disassemble_module_parallel(mod, fd, file_jobs);
+
+        if (fd != STDOUT_FILENO && close(fd) && io_err == PARAVM_ERROR_OK && errno != EINTR)
+            io_err = errno_to_error(errno);
+    }
+
+    paravm_destroy_module(mod);
 
     if (io_err != PARAVM_ERROR_OK)
     {
-        g_fprintf(stderr, "Error: Could not write '%s': %s\n", out_name, paravm_error_to_string(io_err));
+        report("Error: Could not write '%s': %s\n", out_name, paravm_error_to_string(io_err));
         g_free(out_name);
         return 1;
     }
@@ -241,52 +393,340 @@ int dis_tool(int argc, char *argv[])
     return 0;
 }
 
-int chk_tool(int argc, char *argv[])
+static int chk_file(const char *file)
 {
-    assert(argv);
+    assert(file);
 
-    if (!argc)
+    if (check_path(file, pvc_ext))
+        return 1;
+
+    const ParaVMModule *mod;
+    uint8_t digest[PARAVM_VERIFIER_DIGEST_SIZE];
+
+    if (opt_cache)
     {
-        g_fprintf(stderr, "Error: No input file given\n");
+        void *image;
+        size_t size;
+        ParaVMError io_err = paravm_read_image(file, &image, &size);
+
+        if (io_err != PARAVM_ERROR_OK)
+        {
+            report("Error: Could not read '%s': %s\n", file, paravm_error_to_string(io_err));
+            return 1;
+        }
+
+        paravm_digest_module_image(image, size, digest);
+
+        // Modules that passed before are not even loaded.
+        if (paravm_is_module_verified(opt_cache, digest))
+        {
+            g_free(image);
+            return 0;
+        }
+
+        mod = create_module(file);
+        mod = finish_read(file, mod, paravm_read_module_image(image, size, mod));
+
+        g_free(image);
+    }
+    else
+        mod = read_module(file);
+
+    if (!mod)
         return 1;
+
+    ParaVMAtomTable *atoms = paravm_create_atom_table();
+
+    paravm_intern_module_atoms(mod, atoms);
+
+    ParaVMDiagnostic *diags;
+    size_t count;
+
+    // Every error is reported, not just the first one.
+    int res = paravm_verify_module_parallel(mod, file_jobs, &diags, &count) != PARAVM_VERIFIER_OK;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const ParaVMDiagnostic *diag = &diags[i];
+
+        if (diag->result == PARAVM_VERIFIER_NO_TERMINATOR)
+            report("Error: Block '%s' in function '%s' has no terminator\n",
+                   diag->block->name, diag->function->name);
+
+        if (diag->result == PARAVM_VERIFIER_MULTIPLE_TERMINATORS)
+            report("Error: Block '%s' in function '%s' has multiple terminators\n",
+                   diag->block->name, diag->function->name);
+
+        if (diag->result == PARAVM_VERIFIER_BAD_ENDIANNESS)
+        {
+            report("Error: Instruction %s at %zu in %s has bad endianness operand (%s)\n",
+                   diag->instruction->opcode->name, paravm_get_instruction_index(diag->block, diag->instruction),
+                   diag->block->name, diag->instruction->operand.string);
+        }
+
+        if (diag->result == PARAVM_VERIFIER_BAD_REGISTER_COUNT)
+        {
+            report("Error: Instruction %s at %zu in %s has %zu registers, but takes %s%u\n",
+                   diag->instruction->opcode->name, paravm_get_instruction_index(diag->block, diag->instruction),
+                   diag->block->name, paravm_get_instruction_register_count(diag->instruction),
+                   diag->instruction->opcode->variable_registers ? "at least " : "",
+                   diag->instruction->opcode->registers);
+        }
+
+        if (diag->result == PARAVM_VERIFIER_FOREIGN_REGISTER)
+        {
+            report("Error: Instruction %s at %zu in %s uses register '%s' of another function\n",
+                   diag->instruction->opcode->name, paravm_get_instruction_index(diag->block, diag->instruction),
+                   diag->block->name, diag->reg->name);
+        }
+
+        if (diag->result == PARAVM_VERIFIER_BAD_TARGET)
+        {
+            report("Error: Instruction %s at %zu in %s branches outside of function '%s'\n",
+                   diag->instruction->opcode->name, paravm_get_instruction_index(diag->block, diag->instruction),
+                   diag->block->name, diag->function->name);
+        }
+
+        if (diag->result == PARAVM_VERIFIER_BAD_HANDLER)
+            report("Error: Block '%s' in function '%s' has a bad exception handler\n",
+                   diag->block->name, diag->function->name);
+
+        if (diag->result == PARAVM_VERIFIER_UNASSIGNED_REGISTER)
+        {
+            report("Error: Instruction %s at %zu in %s reads register '%s' before it is assigned\n",
+                   diag->instruction->opcode->name, paravm_get_instruction_index(diag->block, diag->instruction),
+                   diag->block->name, diag->reg->name);
+        }
     }
 
-    const char *file = argv[0];
+    g_free(diags);
 
-    if (check_path(file, pvc_ext))
-        return 1;
+    paravm_destroy_module(mod);
+    paravm_destroy_atom_table(atoms);
 
-    const ParaVMModule *mod;
+    if (!res && opt_cache)
+    {
+        ParaVMError rec_err = paravm_record_module_verified(opt_cache, digest);
 
-    if (!(mod = read_module(file)))
-        return 1;
+        // The module is still valid; it is just checked again
+        // next time.
+        if (rec_err != PARAVM_ERROR_OK)
+            report("Warning: Could not record '%s' as verified: %s\n", file, paravm_error_to_string(rec_err));
+    }
 
-    const ParaVMFunction *o_fun;
-    const ParaVMBlock *o_blk;
-    const ParaVMInstruction *o_insn;
+    return res;
+}
+
+typedef struct
+{
+    const char *file;
+    GString *diagnostics;
+    int result;
+    bool done;
+} FileJob;
+
+typedef struct
+{
+    int (*func)(const char *file);
+    FileJob *jobs;
+    size_t count;
+    size_t printed;
+    GMutex lock;
+} Batch;
+
+static void file_job(void *data, void *user_data)
+{
+    assert(data);
+    assert(user_data);
+
+    FileJob *job = data;
+    Batch *batch = user_data;
+
+    diagnostics = job->diagnostics;
+    job->result = batch->func(job->file);
+    diagnostics = null;
+
+    g_mutex_lock(&batch->lock);
 
-    ParaVMVerifierResult ver_res = paravm_verify_module(mod, &o_fun, &o_blk, &o_insn);
+    job->done = true;
 
-    int res = ver_res != PARAVM_VERIFIER_OK;
+    // Print everything that is now complete in input order.
+    for (; batch->printed < batch->count && batch->jobs[batch->printed].done; batch->printed++)
+        fputs(batch->jobs[batch->printed].diagnostics->str, stderr);
 
-    if (ver_res == PARAVM_VERIFIER_NO_TERMINATOR)
-        g_fprintf(stderr, "Error: Block '%s' in function '%s' has no terminator\n", o_blk->name, o_fun->name);
+    g_mutex_unlock(&batch->lock);
+}
+
+// Collects the input files given on the command line and in
+// the manifest, if any. Returns `NULL` if the manifest could
+// not be read.
+static GPtrArray *collect_files(int argc, char *argv[], char **manifest)
+{
+    assert(argv);
+    assert(manifest);
 
-    if (ver_res == PARAVM_VERIFIER_MULTIPLE_TERMINATORS)
-        g_fprintf(stderr, "Error: Block '%s' in function '%s' has multiple terminators\n", o_blk->name, o_fun->name);
+    GPtrArray *files = g_ptr_array_new();
 
-    if (ver_res == PARAVM_VERIFIER_BAD_ENDIANNESS)
+    for (int i = 0; i < argc; i++)
+        g_ptr_array_add(files, argv[i]);
+
+    *manifest = null;
+
+    if (!opt_manifest)
+        return files;
+
+    GError *error = null;
+
+    if (!g_file_get_contents(opt_manifest, manifest, null, &error))
     {
-        g_fprintf(stderr, "Error: Instruction %s at %zu in %s has bad endianness operand (%s)\n",
-                  o_insn->opcode->name, paravm_get_instruction_index(o_blk, o_insn),
-                  o_blk->name, o_insn->operand.string);
+        g_fprintf(stderr, "Error: %s\n", error->message);
+        g_error_free(error);
+        g_ptr_array_free(files, true);
+
+        return null;
     }
 
-    paravm_destroy_module(mod);
+    // One path per line. Empty lines and lines starting with
+    // `#` are ignored.
+    for (char *line = *manifest; line; )
+    {
+        char *next = strchr(line, '\n');
+
+        if (next)
+            *next++ = '\0';
+
+        g_strstrip(line);
+
+        if (*line && *line != '#')
+            g_ptr_array_add(files, line);
+
+        line = next;
+    }
+
+    return files;
+}
+
+// Runs `func` on every input file. With more than one file,
+// the files are processed on up to `--jobs` threads, their
+// diagnostics are printed in input order, and the result is
+// `1` if any of them failed.
+static int run_files(int argc, char *argv[], int (*func)(const char *file))
+{
+    assert(argv);
+    assert(func);
+
+    char *manifest;
+    GPtrArray *files = collect_files(argc, argv, &manifest);
+
+    if (!files)
+        return 1;
+
+    int res = 0;
+
+    if (!files->len)
+    {
+        g_fprintf(stderr, "Error: No input file given\n");
+        res = 1;
+    }
+    else if (files->len == 1)
+    {
+        file_jobs = (uint32_t)opt_jobs;
+        res = func(g_ptr_array_index(files, 0));
+    }
+    else if (opt_out)
+    {
+        g_fprintf(stderr, "Error: Cannot use --out with multiple input files\n");
+        res = 1;
+    }
+    else if (opt_cache && func == &asm_file)
+    {
+        // An assembly cache only holds the code of one file.
+        g_fprintf(stderr, "Error: Cannot use --cache with multiple input files\n");
+        res = 1;
+    }
+    else
+    {
+        Batch batch = {
+            .func = func,
+            .jobs = g_new0(FileJob, files->len),
+            .count = files->len,
+            .printed = 0,
+        };
+
+        g_mutex_init(&batch.lock);
+
+        for (size_t i = 0; i < batch.count; i++)
+        {
+            batch.jobs[i].file = g_ptr_array_index(files, i);
+            batch.jobs[i].diagnostics = g_string_new(null);
+        }
+
+        uint32_t threads = opt_jobs ? (uint32_t)opt_jobs : g_get_num_processors();
+
+        if (threads > batch.count)
+            threads = (uint32_t)batch.count;
+
+        if (threads <= 1)
+        {
+            for (size_t i = 0; i < batch.count; i++)
+                file_job(&batch.jobs[i], &batch);
+        }
+        else
+        {
+            GThreadPool *pool = g_thread_pool_new(&file_job, &batch, (gint)threads, true, null);
+
+            for (size_t i = 0; i < batch.count; i++)
+                g_thread_pool_push(pool, &batch.jobs[i], null);
+
+            g_thread_pool_free(pool, false, true);
+        }
+
+        for (size_t i = 0; i < batch.count; i++)
+        {
+            res |= batch.jobs[i].result;
+
+            g_string_free(batch.jobs[i].diagnostics, true);
+        }
+
+        g_mutex_clear(&batch.lock);
+        g_free(batch.jobs);
+    }
+
+    g_ptr_array_free(files, true);
+    g_free(manifest);
 
     return res;
 }
 
+int asm_tool(int argc, char *argv[])
+{
+    assert(argv);
+
+    return run_files(argc, argv, &asm_file);
+}
+
+int dis_tool(int argc, char *argv[])
+{
+    assert(argv);
+
+    // There is nothing to cache; silently ignoring the option
+    // would hide that it means something else for other tools.
+    if (opt_cache)
+    {
+        g_fprintf(stderr, "Error: Cannot use --cache with dis\n");
+        return 1;
+    }
+
+    return run_files(argc, argv, &dis_file);
+}
+
+int chk_tool(int argc, char *argv[])
+{
+    assert(argv);
+
+    return run_files(argc, argv, &chk_file);
+}
+
 int exe_tool(int argc, char *argv[])
 {
     assert(argv);
@@ -308,7 +748,109 @@ int exe_tool(int argc, char *argv[])
     if (opt_pid && check_path(opt_pid, pid_ext))
         return 1;
 
-    return 0;
+    // Only the emulator can run code for now.
+    if (paravm_has_esdk() && !opt_emu)
+    {
+        g_fprintf(stderr, "Error: Execution on Epiphany cores is not supported yet; use '--emu'\n");
+        return 1;
+    }
+
+    const ParaVMModule *mod = read_module(file);
+
+    if (!mod)
+        return 1;
+
+    ParaVMContext *ctx = paravm_create_context(null);
+    const ParaVMFunction *fun;
+    const ParaVMBlock *blk;
+    const ParaVMInstruction *insn;
+    int res = 1;
+
+    if (opt_cache)
+    {
+        ParaVMError snap_err = paravm_load_atom_snapshot(ctx->atom_table, opt_cache);
+
+        // A missing, stale, or damaged snapshot just means that
+        // every atom is interned from scratch.
+        if (snap_err != PARAVM_ERROR_OK && snap_err != PARAVM_ERROR_NONEXISTENT &&
+            snap_err != PARAVM_ERROR_FOURCC && snap_err != PARAVM_ERROR_VERSION &&
+            snap_err != PARAVM_ERROR_MALFORMED && snap_err != PARAVM_ERROR_EOF)
+        {
+            g_fprintf(stderr, "Error: Could not read '%s': %s\n", opt_cache, paravm_error_to_string(snap_err));
+            goto done;
+        }
+    }
+
+    paravm_intern_module_atoms(mod, ctx->atom_table);
+
+    // The interpreter relies on the module being valid.
+    if (paravm_verify_module(mod, &fun, &blk, &insn) != PARAVM_VERIFIER_OK)
+    {
+        g_fprintf(stderr, "Error: Function '%s' in '%s' is invalid; run 'paravm chk' for details\n",
+                  fun->name, file);
+        goto done;
+    }
+
+    paravm_fuse_module(mod);
+    paravm_infer_module_types(mod);
+
+    const ParaVMProgram *prog;
+    ParaVMError err = paravm_create_program(mod, &prog);
+
+    if (err != PARAVM_ERROR_OK)
+    {
+        g_fprintf(stderr, "Error: Could not load '%s': %s\n", file, paravm_error_to_string(err));
+        goto done;
+    }
+
+    const char *entry = opt_entry ? opt_entry : "main";
+    char *value;
+
+    switch (paravm_run_program(prog, entry, (const char *const *)argv + 1, &value))
+    {
+        case PARAVM_RUN_OK:
+            // Programs that return nothing print nothing.
+            if (strcmp(value, "nil"))
+                g_printf("%s\n", value);
+
+            res = 0;
+
+            break;
+        case PARAVM_RUN_EXCEPTION:
+            g_fprintf(stderr, "Error: Uncaught exception: %s\n", value);
+            break;
+        case PARAVM_RUN_NO_ENTRY:
+            g_fprintf(stderr, "Error: Entry point '%s' does not exist\n", entry);
+            break;
+        case PARAVM_RUN_BAD_ENTRY:
+            g_fprintf(stderr, "Error: Entry point '%s' takes more than one argument\n", entry);
+            break;
+        default:
+            assert_unreachable();
+            break;
+    }
+
+    g_free(value);
+    paravm_destroy_program(prog);
+
+    // The atoms of this run, including those created while
+    // running, give the next run a warm start.
+    if (opt_cache)
+    {
+        ParaVMError snap_err = paravm_save_atom_snapshot(ctx->atom_table, opt_cache);
+
+        if (snap_err != PARAVM_ERROR_OK)
+        {
+            g_fprintf(stderr, "Error: Could not write '%s': %s\n", opt_cache, paravm_error_to_string(snap_err));
+            res = 1;
+        }
+    }
+
+done:
+    paravm_destroy_module(mod);
+    paravm_destroy_context(ctx);
+
+    return res;
 }
 
 int dbg_tool(int argc, char *argv[])
@@ -1,7 +1,436 @@
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <glib.h>
+
+#include "internal/fuse.h"
+
+#include "fuse.h"
+#include "io.h"
 #include "verify.h"
 
+const uint32_t paravm_verifier_version = 2;
+
+// Reports an error through `report`, returning whatever it
+// returns.
+static bool report_error(bool (^ report)(const ParaVMDiagnostic *), ParaVMVerifierResult result,
+                         const ParaVMBlock *blk, const ParaVMInstruction *insn, const ParaVMRegister *reg)
+{
+    assert(report);
+    assert(blk);
+
+    ParaVMDiagnostic diag = {
+        .result = result,
+        .function = blk->function,
+        .block = blk,
+        .instruction = insn,
+        .reg = reg,
+    };
+
+    return report(&diag);
+}
+
+static bool is_endianness_op(const ParaVMOpCode *op)
+{
+    assert(op);
+
+    return op == &paravm_op_bin_efs ||
+           op == &paravm_op_bin_efd ||
+           op == &paravm_op_bin_dfs ||
+           op == &paravm_op_bin_dfd ||
+           op == &paravm_op_bin_eisu ||
+           op == &paravm_op_bin_dis ||
+           op == &paravm_op_bin_diu;
+}
+
+static bool is_endianness(const ParaVMInstruction *insn)
+{
+    assert(insn);
+
+    if (insn->atom != SIZE_MAX)
+        return insn->atom == PARAVM_ATOM_LITTLE ||
+               insn->atom == PARAVM_ATOM_BIG ||
+               insn->atom == PARAVM_ATOM_NATIVE;
+
+    return !strcmp(insn->operand.string, "little") ||
+           !strcmp(insn->operand.string, "big") ||
+           !strcmp(insn->operand.string, "native");
+}
+
+// Checks the structure of every block of `f`: terminators,
+// operands, register counts, branch targets, and exception
+// handlers. Sets `*clean` to whether no errors were found.
+// Returns `false` as soon as `report` does.
+static bool verify_structure(const ParaVMFunction *f, bool (^ report)(const ParaVMDiagnostic *), bool *clean)
+{
+    assert(f);
+    assert(report);
+    assert(clean);
+
+    *clean = true;
+
+    for (const ParaVMBlock *const *b = paravm_get_blocks(f); *b; b++)
+    {
+        if (((*b)->handler && (!(*b)->exception || (*b)->handler->function != f ||
+                               (*b)->exception->function != f)) ||
+            (!(*b)->handler && (*b)->exception))
+        {
+            *clean = false;
+
+            if (!report_error(report, PARAVM_VERIFIER_BAD_HANDLER, *b, null, null))
+                return false;
+        }
+
+        bool have_term = false;
+        bool multiple_terms = false;
+
+        for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++)
+        {
+            const ParaVMOpCode *op = (*i)->opcode;
+            size_t reg_count = paravm_get_instruction_register_count(*i);
+
+            if (reg_count < op->registers || (reg_count > op->registers && !op->variable_registers))
+            {
+                *clean = false;
+
+                if (!report_error(report, PARAVM_VERIFIER_BAD_REGISTER_COUNT, *b, *i, null))
+                    return false;
+            }
+
+            for (const ParaVMRegister *const *r = paravm_get_instruction_registers(*i); *r; r++)
+            {
+                if ((*r)->function == f)
+                    continue;
+
+                *clean = false;
+
+                if (!report_error(report, PARAVM_VERIFIER_FOREIGN_REGISTER, *b, *i, *r))
+                    return false;
+            }
+
+            if (is_endianness_op(op) && !is_endianness(*i))
+            {
+                *clean = false;
+
+                if (!report_error(report, PARAVM_VERIFIER_BAD_ENDIANNESS, *b, *i, null))
+                    return false;
+            }
+
+            if ((op->operand == PARAVM_OPERAND_TYPE_BLOCK &&
+                 (!(*i)->operand.block || (*i)->operand.block->function != f)) ||
+                (op->operand == PARAVM_OPERAND_TYPE_BLOCKS &&
+                 (!(*i)->operand.blocks[0] || (*i)->operand.blocks[0]->function != f ||
+                  !(*i)->operand.blocks[1] || (*i)->operand.blocks[1]->function != f)))
+            {
+                *clean = false;
+
+                if (!report_error(report, PARAVM_VERIFIER_BAD_TARGET, *b, *i, null))
+                    return false;
+            }
+
+            if (op->control_flow != PARAVM_CONTROL_FLOW_NONE)
+            {
+                // A block is only reported once, no matter how
+                // many extra terminators it has.
+                if (have_term && !multiple_terms)
+                {
+                    *clean = false;
+
+                    if (!report_error(report, PARAVM_VERIFIER_MULTIPLE_TERMINATORS, *b, null, null))
+                        return false;
+
+                    multiple_terms = true;
+                }
+
+                have_term = true;
+            }
+        }
+
+        if (!have_term)
+        {
+            *clean = false;
+
+            if (!report_error(report, PARAVM_VERIFIER_NO_TERMINATOR, *b, null, null))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Definite assignment state of the registers of a function,
+// with one bit per register.
+typedef struct
+{
+    GHashTable *regs; // Register to index plus one.
+    GHashTable *blocks; // Block to index plus one.
+    size_t words; // Words per set.
+    uint64_t *ins; // Registers assigned on entry to each block.
+    bool *reached; // Whether each block has been reached.
+    uint64_t *state; // Registers assigned at the current point.
+    bool changed;
+} Assignment;
+
+static size_t reg_index(const Assignment *as, const ParaVMRegister *reg)
+{
+    assert(as);
+    assert(reg);
+
+    return GPOINTER_TO_SIZE(g_hash_table_lookup(as->regs, reg)) - 1;
+}
+
+static size_t block_index(const Assignment *as, const ParaVMBlock *blk)
+{
+    assert(as);
+    assert(blk);
+
+    return GPOINTER_TO_SIZE(g_hash_table_lookup(as->blocks, blk)) - 1;
+}
+
+static bool is_assigned(const Assignment *as, const ParaVMRegister *reg)
+{
+    assert(as);
+    assert(reg);
+
+    size_t idx = reg_index(as, reg);
+
+    return as->state[idx / 64] & ((uint64_t)1 << (idx % 64));
+}
+
+static void assign(Assignment *as, const ParaVMRegister *reg)
+{
+    assert(as);
+    assert(reg);
+
+    size_t idx = reg_index(as, reg);
+
+    as->state[idx / 64] |= (uint64_t)1 << (idx % 64);
+}
+
+// Merges the current state, plus `extra` if it is not `null`,
+// into the entry state of `blk`.
+static void flow_to(Assignment *as, const ParaVMBlock *blk, const ParaVMRegister *extra)
+{
+    assert(as);
+    assert(blk);
+
+    size_t idx = block_index(as, blk);
+    uint64_t *in = &as->ins[idx * as->words];
+    size_t extra_idx = extra ? reg_index(as, extra) : SIZE_MAX;
+
+    for (size_t w = 0; w < as->words; w++)
+    {
+        uint64_t bits = as->state[w];
+
+        if (extra_idx / 64 == w)
+            bits |= (uint64_t)1 << (extra_idx % 64);
+
+        // The first path to reach a block defines its state;
+        // every other path can only remove registers from it.
+        uint64_t merged = as->reached[idx] ? in[w] & bits : bits;
+
+        if (merged != in[w] || !as->reached[idx])
+            as->changed = true;
+
+        in[w] = merged;
+    }
+
+    as->reached[idx] = true;
+}
+
+static void define_registers(Assignment *as, const ParaVMInstruction *insn)
+{
+    assert(as);
+    assert(insn);
+
+    const ParaVMRegister *const *regs = paravm_get_instruction_registers(insn);
+
+    for (uint8_t r = 0; r < insn->opcode->registers; r++)
+        if (insn->opcode->defs & (1 << r))
+            assign(as, regs[r]);
+}
+
+// Walks `blk` from its entry state, passing the state on to
+// its successors and its exception handler.
+static void flow_block(Assignment *as, const ParaVMBlock *blk)
+{
+    assert(as);
+    assert(blk);
+
+    memcpy(as->state, &as->ins[block_index(as, blk) * as->words], as->words * sizeof(uint64_t));
+
+    bool thrown = false;
+
+    for (const ParaVMInstruction *const *i = paravm_get_instructions(blk); *i; i++)
+    {
+        const ParaVMOpCode *op = (*i)->opcode;
+
+        // Registers only become assigned as the block goes on,
+        // so the first instruction that can throw is the only
+        // one that matters for the handler.
+        if (blk->handler && !thrown && (op->flags & PARAVM_OPCODE_FLAG_THROWS))
+        {
+            flow_to(as, blk->handler, blk->exception);
+            thrown = true;
+        }
+
+        const ParaVMInstruction *seq[PARAVM_MAX_EXPANSION];
+        bool fused;
+        size_t count = expand_sequence(*i, seq, &fused);
+
+        for (size_t p = 0; p < count; p++)
+            define_registers(as, seq[p]);
+
+        release_sequence(seq, count, fused);
+
+        if (op->operand == PARAVM_OPERAND_TYPE_BLOCK)
+            flow_to(as, (*i)->operand.block, null);
+        else if (op->operand == PARAVM_OPERAND_TYPE_BLOCKS)
+        {
+            flow_to(as, (*i)->operand.blocks[0], null);
+            flow_to(as, (*i)->operand.blocks[1], null);
+        }
+    }
+}
+
+// Checks that every register that `f` reads has been
+// assigned on every path from the entry block (the first
+// block) to the read. `f` must be structurally sound. Returns
+// `false` as soon as `report` does.
+static bool verify_assignment(const ParaVMFunction *f, bool (^ report)(const ParaVMDiagnostic *))
+{
+    assert(f);
+    assert(report);
+
+    size_t block_count = paravm_get_block_count(f);
+
+    if (!block_count)
+        return true;
+
+    Assignment as = {
+        .regs = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .blocks = g_hash_table_new(&g_direct_hash, &g_direct_equal),
+        .words = paravm_get_register_count(f) / 64 + 1,
+        .changed = true,
+    };
+
+    as.ins = g_new0(uint64_t, as.words * block_count);
+    as.reached = g_new0(bool, block_count);
+    as.state = g_new0(uint64_t, as.words);
+
+    size_t idx = 0;
+
+    for (const ParaVMRegister *const *r = paravm_get_registers(f); *r; r++)
+        g_hash_table_insert(as.regs, (ParaVMRegister *)*r, GSIZE_TO_POINTER(++idx));
+
+    idx = 0;
+
+    for (const ParaVMBlock *const *b = paravm_get_blocks(f); *b; b++)
+        g_hash_table_insert(as.blocks, (ParaVMBlock *)*b, GSIZE_TO_POINTER(++idx));
+
+    const ParaVMBlock *const *blocks = paravm_get_blocks(f);
+
+    // Only the arguments are assigned on entry to the function.
+    for (const ParaVMRegister *const *a = paravm_get_arguments(f); *a; a++)
+        assign(&as, *a);
+
+    flow_to(&as, blocks[0], null);
+
+    while (as.changed)
+    {
+        as.changed = false;
+
+        for (size_t b = 0; b < block_count; b++)
+            if (as.reached[b])
+                flow_block(&as, blocks[b]);
+    }
+
+    bool result = true;
+
+    // Blocks that are never reached cannot read anything, so
+    // they are not checked.
+    for (size_t b = 0; b < block_count && result; b++)
+    {
+        if (!as.reached[b])
+            continue;
+
+        memcpy(as.state, &as.ins[b * as.words], as.words * sizeof(uint64_t));
+
+        for (const ParaVMInstruction *const *i = paravm_get_instructions(blocks[b]); *i && result; i++)
+        {
+            const ParaVMInstruction *seq[PARAVM_MAX_EXPANSION];
+            bool fused;
+            size_t count = expand_sequence(*i, seq, &fused);
+
+            // Errors are reported against the instruction as
+            // written, whose registers its parts share.
+            for (size_t p = 0; p < count && result; p++)
+            {
+                const ParaVMOpCode *op = seq[p]->opcode;
+                size_t pos = 0;
+
+                for (const ParaVMRegister *const *r = paravm_get_instruction_registers(seq[p]); *r && result;
+                     r++, pos++)
+                {
+                    // Additional registers are always read.
+                    bool read = pos >= op->registers || (op->uses & (1 << pos));
+
+                    if (!read || is_assigned(&as, *r))
+                        continue;
+
+                    result = report_error(report, PARAVM_VERIFIER_UNASSIGNED_REGISTER, blocks[b], *i, *r);
+
+                    // Only report the first read of a register.
+                    assign(&as, *r);
+                }
+
+                define_registers(&as, seq[p]);
+            }
+
+            release_sequence(seq, count, fused);
+        }
+    }
+
+    g_free(as.state);
+    g_free(as.reached);
+    g_free(as.ins);
+    g_hash_table_destroy(as.blocks);
+    g_hash_table_destroy(as.regs);
+
+    return result;
+}
+
+// Checks `f` and calls `report` for each error found, in
+// order. Returns `false` as soon as `report` does.
+static bool verify_function(const ParaVMFunction *f, bool (^ report)(const ParaVMDiagnostic *))
+{
+    assert(f);
+    assert(report);
+
+    bool clean;
+
+    if (!verify_structure(f, report, &clean))
+        return false;
+
+    // The analysis relies on registers and branch targets
+    // being valid.
+    return !clean || verify_assignment(f, report);
+}
+
+// Checks every function of `mod` in module order, like
+// `verify_function`.
+static void verify(const ParaVMModule *mod, bool (^ report)(const ParaVMDiagnostic *))
+{
+    assert(mod);
+    assert(report);
+
+    for (const ParaVMFunction *const *f = paravm_get_functions(mod); *f; f++)
+        if (!verify_function(*f, report))
+            return;
+}
+
 ParaVMVerifierResult paravm_verify_module(const ParaVMModule *mod,
                                           const ParaVMFunction **offender_fun,
                                           const ParaVMBlock **offender_blk,
@@ -16,57 +445,260 @@ ParaVMVerifierResult paravm_verify_module(const ParaVMModule *mod,
     *offender_blk = null;
     *offender_insn = null;
 
-    for (const ParaVMFunction *const *f = paravm_get_functions(mod); *f; f++)
+    __block ParaVMVerifierResult result = PARAVM_VERIFIER_OK;
+
+    bool (^ report)(const ParaVMDiagnostic *) = ^ bool (const ParaVMDiagnostic *diag)
     {
-        for (const ParaVMBlock *const *b = paravm_get_blocks(*f); *b; b++)
-        {
-            bool have_term = false;
+        result = diag->result;
+        *offender_fun = diag->function;
+        *offender_blk = diag->block;
+        *offender_insn = diag->instruction;
 
-            for (const ParaVMInstruction *const *i = paravm_get_instructions(*b); *i; i++)
-            {
-                const ParaVMOpCode *op = (*i)->opcode;
-
-                if ((op == &paravm_op_bin_efs ||
-                     op == &paravm_op_bin_efd ||
-                     op == &paravm_op_bin_dfs ||
-                     op == &paravm_op_bin_dfd ||
-                     op == &paravm_op_bin_eisu ||
-                     op == &paravm_op_bin_dis ||
-                     op == &paravm_op_bin_diu) &&
-                    strcmp ((*i)->operand.string, "little") &&
-                    strcmp ((*i)->operand.string, "big") &&
-                    strcmp ((*i)->operand.string, "native"))
-                {
-                    *offender_fun = *f;
-                    *offender_blk = *b;
-                    *offender_insn = *i;
+        return false;
+    };
 
-                    return PARAVM_VERIFIER_BAD_ENDIANNESS;
-                }
+    verify(mod, report);
 
-                if ((*i)->opcode->control_flow != PARAVM_CONTROL_FLOW_NONE)
-                {
-                    if (have_term)
-                    {
-                        *offender_fun = *f;
-                        *offender_blk = *b;
+    return result;
+}
 
-                        return PARAVM_VERIFIER_MULTIPLE_TERMINATORS;
-                    }
+ParaVMVerifierResult paravm_verify_module_all(const ParaVMModule *mod,
+                                              ParaVMDiagnostic **diagnostics,
+                                              size_t *count)
+{
+    assert(mod);
+    assert(diagnostics);
+    assert(count);
 
-                    have_term = true;
-                }
-            }
+    GArray *diags = g_array_new(false, false, sizeof(ParaVMDiagnostic));
 
-            if (!have_term)
-            {
-                *offender_fun = *f;
-                *offender_blk = *b;
+    bool (^ report)(const ParaVMDiagnostic *) = ^ bool (const ParaVMDiagnostic *diag)
+    {
+        g_array_append_vals(diags, diag, 1);
 
-                return PARAVM_VERIFIER_NO_TERMINATOR;
-            }
-        }
+        return true;
+    };
+
+    verify(mod, report);
+
+    *count = diags->len;
+
+    ParaVMVerifierResult result = diags->len ? g_array_index(diags, ParaVMDiagnostic, 0).result :
+                                               PARAVM_VERIFIER_OK;
+
+    *diagnostics = (ParaVMDiagnostic *)g_array_free(diags, !diags->len);
+
+    return result;
+}
+
+// Functions are handed to threads in runs of this many. Idle
+// threads take the next run from the pool's queue, so a few
+// large functions do not hold up the others.
+#define FUNCTIONS_PER_JOB 32
+
+typedef struct
+{
+    const ParaVMFunction *const *funcs;
+    size_t count;
+    GArray *diagnostics;
+} FunctionJob;
+
+static void verify_job(void *data, var_unused void *user_data)
+{
+    assert(data);
+
+    FunctionJob *job = data;
+    GArray *diags = job->diagnostics;
+
+    bool (^ report)(const ParaVMDiagnostic *) = ^ bool (const ParaVMDiagnostic *diag)
+    {
+        g_array_append_vals(diags, diag, 1);
+
+        return true;
+    };
+
+    for (size_t i = 0; i < job->count; i++)
+        verify_function(job->funcs[i], report);
+}
+
+ParaVMVerifierResult paravm_verify_module_parallel(const ParaVMModule *mod, uint32_t threads,
+                                                   ParaVMDiagnostic **diagnostics, size_t *count)
+{
+    assert(mod);
+    assert(diagnostics);
+    assert(count);
+
+    const ParaVMFunction *const *funcs = paravm_get_functions(mod);
+    size_t func_count = paravm_get_function_count(mod);
+    size_t job_count = (func_count + FUNCTIONS_PER_JOB - 1) / FUNCTIONS_PER_JOB;
+
+    if (!threads)
+        threads = g_get_num_processors();
+
+    if (threads > job_count)
+        threads = (uint32_t)job_count;
+
+    if (threads <= 1)
+        return paravm_verify_module_all(mod, diagnostics, count);
+
+    FunctionJob *jobs = g_new(FunctionJob, job_count);
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        jobs[i] = (FunctionJob) {
+            .funcs = &funcs[i * FUNCTIONS_PER_JOB],
+            .count = MIN(FUNCTIONS_PER_JOB, func_count - i * FUNCTIONS_PER_JOB),
+            .diagnostics = g_array_new(false, false, sizeof(ParaVMDiagnostic)),
+        };
+    }
+
+    GThreadPool *pool = g_thread_pool_new(&verify_job, null, (gint)threads, true, null);
+
+    for (size_t i = 0; i < job_count; i++)
+        g_thread_pool_push(pool, &jobs[i], null);
+
+    g_thread_pool_free(pool, false, true);
+
+    // Merge the diagnostics in job order so that they come
+    // out in module order, regardless of which thread
+    // finished first.
+    GArray *diags = g_array_new(false, false, sizeof(ParaVMDiagnostic));
+
+    for (size_t i = 0; i < job_count; i++)
+    {
+        g_array_append_vals(diags, jobs[i].diagnostics->data, jobs[i].diagnostics->len);
+        g_array_free(jobs[i].diagnostics, true);
+    }
+
+    g_free(jobs);
+
+    *count = diags->len;
+
+    ParaVMVerifierResult result = diags->len ? g_array_index(diags, ParaVMDiagnostic, 0).result :
+                                               PARAVM_VERIFIER_OK;
+
+    *diagnostics = (ParaVMDiagnostic *)g_array_free(diags, !diags->len);
+
+    return result;
+}
+
+static const uint32_t record_fourcc = 0x4B565000;
+
+// A record holds the 4-character code, the ParaVM and verifier
+// versions, and the digest of the image it is about.
+#define RECORD_SIZE (3 * sizeof(uint32_t) + PARAVM_VERIFIER_DIGEST_SIZE)
+
+static void put_u32(uint8_t *pos, uint32_t value)
+{
+    assert(pos);
+
+    for (size_t i = 0; i < sizeof(uint32_t); i++)
+        pos[i] = (uint8_t)(value >> (i * 8));
+}
+
+static void make_record(const uint8_t *digest, uint8_t *record)
+{
+    assert(digest);
+    assert(record);
+
+    put_u32(record, record_fourcc);
+    put_u32(record + 4, paravm_version);
+    put_u32(record + 8, paravm_verifier_version);
+    memcpy(record + 12, digest, PARAVM_VERIFIER_DIGEST_SIZE);
+}
+
+static char *record_path(const char *dir, const uint8_t *digest)
+{
+    assert(dir);
+    assert(digest);
+
+    // Records in a shared directory are named after the image
+    // they are about, so identical modules share a record.
+    char name[PARAVM_VERIFIER_DIGEST_SIZE * 2 + sizeof(".chk")];
+
+    for (size_t i = 0; i < PARAVM_VERIFIER_DIGEST_SIZE; i++)
+        snprintf(name + i * 2, 3, "%02x", digest[i]);
+
+    strcpy(name + PARAVM_VERIFIER_DIGEST_SIZE * 2, ".chk");
+
+    return g_build_filename(dir, name, null);
+}
+
+void paravm_digest_module_image(const void *data, size_t size, uint8_t *digest)
+{
+    assert(data || !size);
+    assert(digest);
+
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize len = PARAVM_VERIFIER_DIGEST_SIZE;
+
+    g_checksum_update(checksum, data, (gssize)size);
+    g_checksum_get_digest(checksum, digest, &len);
+    g_checksum_free(checksum);
+}
+
+bool paravm_is_module_verified(const char *dir, const uint8_t *digest)
+{
+    assert(dir);
+    assert(digest);
+
+    char *rec_path = record_path(dir, digest);
+    void *data;
+    size_t size;
+    ParaVMError err = paravm_read_image(rec_path, &data, &size);
+
+    g_free(rec_path);
+
+    if (err != PARAVM_ERROR_OK)
+        return false;
+
+    uint8_t expected[RECORD_SIZE];
+
+    make_record(digest, expected);
+
+    bool verified = size == RECORD_SIZE && !memcmp(data, expected, RECORD_SIZE);
+
+    g_free(data);
+
+    return verified;
+}
+
+ParaVMError paravm_record_module_verified(const char *dir, const uint8_t *digest)
+{
+    assert(dir);
+    assert(digest);
+
+    uint8_t record[RECORD_SIZE];
+
+    make_record(digest, record);
+
+    char *rec_path = record_path(dir, digest);
+    char *tmp_path = g_strdup_printf("%s.XXXXXX", rec_path);
+
+    // The record is written to a file of its own and then
+    // moved into place, so a concurrent reader sees either the
+    // old record or the new one. It gets the permissions of a
+    // regular new file, so that other users sharing `dir` can
+    // read it.
+    int fd = g_mkstemp_full(tmp_path, O_RDWR, 0666);
+    bool ok = fd != -1;
+
+    // Records only save time, so the reason they could not be
+    // written does not matter.
+    if (ok)
+    {
+        ok = write(fd, record, RECORD_SIZE) == (ssize_t)RECORD_SIZE;
+        ok = !close(fd) && ok;
+        ok = ok && !rename(tmp_path, rec_path);
+
+        if (!ok)
+            unlink(tmp_path);
     }
 
-    return PARAVM_VERIFIER_OK;
+    ParaVMError err = ok ? PARAVM_ERROR_OK : PARAVM_ERROR_IO;
+
+    g_free(tmp_path);
+    g_free(rec_path);
+
+    return err;
 }
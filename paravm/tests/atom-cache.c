@@ -0,0 +1,168 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "atom.h"
+
+// Exercises the thread-local caches in front of atom tables.
+// The tool never looks atoms up one at a time, so this has to
+// go through the API directly.
+
+static int failures;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond)
+    {
+        fprintf(stderr, "Failed: %s\n", what);
+        failures++;
+    }
+}
+
+static bool is_atom(const ParaVMAtomTable *table, size_t atom, const char *str)
+{
+    const char *s = paravm_atom_to_string(table, atom);
+
+    return s && !strcmp(s, str);
+}
+
+static void check_stats(ParaVMAtomTable *table, uint64_t hits, uint64_t misses, const char *what)
+{
+    ParaVMAtomCacheStats stats;
+
+    paravm_get_atom_cache_stats(table, &stats);
+
+    if (stats.hits != hits || stats.misses != misses)
+    {
+        fprintf(stderr, "Failed: %s: %" PRIu64 " hits and %" PRIu64 " misses, expected %" PRIu64 " and %" PRIu64 "\n",
+                what, stats.hits, stats.misses, hits, misses);
+        failures++;
+    }
+}
+
+static void *lookup_main(void *data)
+{
+    ParaVMAtomTable *table = data;
+    size_t atom = paravm_string_to_atom(table, "shared");
+
+    for (int i = 0; i < 99; i++)
+        if (paravm_string_to_atom(table, "shared") != atom)
+            return GSIZE_TO_POINTER(false);
+
+    return GSIZE_TO_POINTER(true);
+}
+
+typedef struct
+{
+    ParaVMAtomTable *table;
+    GAsyncQueue *looked_up;
+    GAsyncQueue *destroyed;
+} Orphan;
+
+static void *orphan_main(void *data)
+{
+    Orphan *o = data;
+
+    paravm_string_to_atom(o->table, "orphan");
+    paravm_string_to_atom(o->table, "orphan");
+
+    g_async_queue_push(o->looked_up, o);
+    g_async_queue_pop(o->destroyed);
+
+    // Exiting publishes the pending counts, which must not
+    // touch the table that is gone by now.
+    return null;
+}
+
+int main(void)
+{
+    ParaVMAtomTable *table = paravm_create_atom_table();
+
+    // The first lookup fills the cache and the rest hit it.
+    size_t foo = paravm_string_to_atom(table, "foo");
+
+    for (int i = 0; i < 9; i++)
+        check(paravm_string_to_atom(table, "foo") == foo, "cached lookups agree with the table");
+
+    check_stats(table, 9, 1, "repeated lookups");
+
+    // Reserved atoms are constants and never reach the cache.
+    check(paravm_string_to_atom(table, "badarg") == PARAVM_ATOM_BADARG, "reserved atoms keep their IDs");
+    check_stats(table, 9, 1, "reserved lookups");
+
+    // Strings of up to 35 bytes are cached; longer ones always
+    // go through the table.
+    const char *fits = "abcdefghijklmnopqrstuvwxyz012345678";
+    const char *long_str = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+    check(strlen(fits) == 35 && strlen(long_str) == 36, "key lengths straddle the limit");
+
+    size_t fits_atom = paravm_string_to_atom(table, fits);
+    size_t long_atom = paravm_string_to_atom(table, long_str);
+
+    for (int i = 0; i < 4; i++)
+    {
+        check(paravm_string_to_atom(table, fits) == fits_atom, "lookups of cached keys agree");
+        check(paravm_string_to_atom(table, long_str) == long_atom, "lookups of uncached keys agree");
+    }
+
+    check(fits_atom != long_atom, "keys that share a prefix get different atoms");
+    check_stats(table, 13, 7, "keys around the length limit");
+
+    // Erasing an atom invalidates every cache entry of the table.
+    paravm_erase_atom(table, foo);
+
+    size_t foo2 = paravm_string_to_atom(table, "foo");
+
+    check(is_atom(table, foo2, "foo"), "erased atoms are not served from the cache");
+    check_stats(table, 13, 8, "lookups after erasure");
+
+    // Entries of one table never satisfy lookups in another,
+    // and counts go to the table they belong to.
+    ParaVMAtomTable *other = paravm_create_atom_table();
+    size_t bar = paravm_string_to_atom(other, "bar");
+
+    paravm_string_to_atom(other, "foo");
+    paravm_string_to_atom(other, "foo");
+
+    // The entry for "foo" now belongs to the other table.
+    check(paravm_string_to_atom(table, "foo") == foo2, "switching tables does not mix up atoms");
+    check(paravm_string_to_atom(other, "bar") == bar, "switching tables does not mix up atoms");
+    check_stats(other, 2, 2, "lookups in the second table");
+    check_stats(table, 13, 9, "lookups in the first table after switching");
+
+    // Threads publish their counts when they exit.
+    GThread *threads[4];
+
+    for (size_t i = 0; i < G_N_ELEMENTS(threads); i++)
+        threads[i] = g_thread_new("lookup", &lookup_main, table);
+
+    for (size_t i = 0; i < G_N_ELEMENTS(threads); i++)
+        check(GPOINTER_TO_SIZE(g_thread_join(threads[i])), "concurrent lookups agree");
+
+    check_stats(table, 13 + 4 * 99, 9 + 4, "lookups on other threads");
+
+    // A thread can outlive a table that it has pending counts for.
+    Orphan orphan = {
+        .table = other,
+        .looked_up = g_async_queue_new(),
+        .destroyed = g_async_queue_new(),
+    };
+    GThread *thread = g_thread_new("orphan", &orphan_main, &orphan);
+
+    g_async_queue_pop(orphan.looked_up);
+    paravm_destroy_atom_table(other);
+    g_async_queue_push(orphan.destroyed, &orphan);
+    g_thread_join(thread);
+
+    g_async_queue_unref(orphan.looked_up);
+    g_async_queue_unref(orphan.destroyed);
+
+    check_stats(table, 13 + 4 * 99, 9 + 4, "lookups in a destroyed table");
+
+    paravm_destroy_atom_table(table);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "atom.h"
+
+// Exercises garbage collection of atoms. The tool never runs
+// long enough for a sweep to matter, so this has to go through
+// the API directly.
+
+static int failures;
+
+static void check(bool cond, const char *what)
+{
+    if (!cond)
+    {
+        fprintf(stderr, "Failed: %s\n", what);
+        failures++;
+    }
+}
+
+static bool is_atom(const ParaVMAtomTable *table, size_t atom, const char *str)
+{
+    const char *s = paravm_atom_to_string(table, atom);
+
+    return s && !strcmp(s, str);
+}
+
+static void check_sweep(ParaVMAtomTable *table, size_t reclaimed, const char *what)
+{
+    size_t n = paravm_sweep_atoms(table);
+
+    if (n != reclaimed)
+    {
+        fprintf(stderr, "Failed: %s: %zu atoms reclaimed, expected %zu\n", what, n, reclaimed);
+        failures++;
+    }
+}
+
+static ParaVMAtomTableStats get_stats(ParaVMAtomTable *table)
+{
+    ParaVMAtomTableStats stats;
+
+    paravm_get_atom_table_stats(table, &stats);
+
+    return stats;
+}
+
+int main(void)
+{
+    ParaVMAtomTable *table = paravm_create_atom_table();
+    ParaVMAtomTableStats empty = get_stats(table);
+
+    check(empty.atoms == PARAVM_ATOM_RESERVED_COUNT, "a new table only has the reserved atoms");
+
+    // An atom survives the sweep of the epoch it was used in,
+    // and is reclaimed by the next one.
+    size_t a = paravm_string_to_atom(table, "a");
+
+    check_sweep(table, 0, "sweep right after a lookup");
+    check(is_atom(table, a, "a"), "recently used atoms survive");
+    check_sweep(table, 1, "sweep of an unused atom");
+    check(!paravm_atom_to_string(table, a), "unused atoms are reclaimed");
+
+    ParaVMAtomTableStats stats = get_stats(table);
+
+    check(stats.atoms == PARAVM_ATOM_RESERVED_COUNT && stats.sweeps == 2 && stats.reclaimed == 1,
+          "statistics after reclaiming an atom");
+
+    // Lookups served by the thread-local cache still count as use.
+    size_t c = paravm_string_to_atom(table, "c");
+
+    check_sweep(table, 0, "sweep right after a lookup");
+    check(paravm_string_to_atom(table, "c") == c, "cached lookups agree with the table");
+    check_sweep(table, 0, "sweep right after a cached lookup");
+    check_sweep(table, 1, "sweep of an atom whose lookups were cached");
+
+    // A cached lookup of a reclaimed atom must not hand out the
+    // old ID.
+    c = paravm_string_to_atom(table, "c");
+    check(is_atom(table, c, "c"), "reclaimed atoms are not served from the cache");
+    check_sweep(table, 0, "sweep right after a lookup");
+
+    // Referenced atoms are never reclaimed.
+    size_t b = paravm_string_to_retained_atom(table, "b");
+
+    paravm_retain_atom(table, c);
+
+    check_sweep(table, 0, "sweep of referenced atoms");
+    check_sweep(table, 0, "sweep of referenced atoms");
+    check(is_atom(table, b, "b") && is_atom(table, c, "c"), "referenced atoms survive");
+
+    paravm_release_atom(table, b);
+    paravm_release_atom(table, c);
+
+    check_sweep(table, 2, "sweep of released atoms");
+
+    const char *strs[] = { "x", "y", "z" };
+    size_t atoms[G_N_ELEMENTS(strs)];
+
+    paravm_strings_to_retained_atoms(table, strs, G_N_ELEMENTS(strs), atoms);
+
+    check_sweep(table, 0, "sweep of atoms referenced in a batch");
+    check_sweep(table, 0, "sweep of atoms referenced in a batch");
+
+    for (size_t i = 0; i < G_N_ELEMENTS(atoms); i++)
+        paravm_release_atom(table, atoms[i]);
+
+    check_sweep(table, 3, "sweep of atoms released after a batch");
+
+    // Reserved atoms are never reclaimed.
+    paravm_release_atom(table, PARAVM_ATOM_BIG);
+    paravm_sweep_atoms(table);
+    paravm_sweep_atoms(table);
+
+    check(is_atom(table, PARAVM_ATOM_BIG, "big"), "reserved atoms survive");
+
+    // Interning and reclaiming atoms over and over must neither
+    // grow the ID space nor the arena.
+    enum { ROUND_ATOMS = 1000 };
+
+    char **names = g_new(char *, ROUND_ATOMS);
+    size_t *ids = g_new(size_t, ROUND_ATOMS);
+    size_t max_id = 0;
+    uint64_t max_bytes = 0;
+
+    for (int round = 0; round < 10; round++)
+    {
+        for (size_t i = 0; i < ROUND_ATOMS; i++)
+            names[i] = g_strdup_printf("round %d atom %zu, padded to use up a good amount of arena memory", round, i);
+
+        paravm_strings_to_atoms(table, (const char *const *)names, ROUND_ATOMS, ids);
+
+        for (size_t i = 0; i < ROUND_ATOMS; i++)
+        {
+            max_id = MAX(max_id, ids[i]);
+
+            g_free(names[i]);
+        }
+
+        stats = get_stats(table);
+        max_bytes = MAX(max_bytes, stats.arena_bytes);
+
+        check(stats.atoms == PARAVM_ATOM_RESERVED_COUNT + ROUND_ATOMS, "interned atoms are counted");
+
+        paravm_sweep_atoms(table);
+        check_sweep(table, ROUND_ATOMS, "sweep of a round of atoms");
+    }
+
+    g_free(names);
+    g_free(ids);
+
+    stats = get_stats(table);
+
+    check(max_id < PARAVM_ATOM_RESERVED_COUNT + ROUND_ATOMS + 8, "IDs of reclaimed atoms are reused");
+    check(stats.atoms == PARAVM_ATOM_RESERVED_COUNT, "all rounds are reclaimed");
+    check(stats.arena_bytes < max_bytes / 4, "arena memory is returned");
+
+    // The background sweeper reclaims atoms on its own.
+    check(paravm_start_atom_sweeper(table, 10) == PARAVM_ERROR_OK, "starting the sweeper");
+    check(paravm_start_atom_sweeper(table, 10) == PARAVM_ERROR_ALREADY_SET, "starting the sweeper twice");
+
+    size_t g = paravm_string_to_atom(table, "g");
+    gint64 deadline = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+
+    while (get_stats(table).atoms != PARAVM_ATOM_RESERVED_COUNT && g_get_monotonic_time() < deadline)
+        g_usleep(1000);
+
+    check(!paravm_atom_to_string(table, g), "the sweeper reclaims unused atoms");
+
+    paravm_stop_atom_sweeper(table);
+    paravm_stop_atom_sweeper(table);
+
+    check(paravm_start_atom_sweeper(table, 10) == PARAVM_ERROR_OK, "restarting the sweeper");
+
+    // Destroying the table stops the sweeper.
+    paravm_destroy_atom_table(table);
+
+    return failures ? 1 : 0;
+}